@@ -0,0 +1,628 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#include <winsock2.h>
+#include <afunix.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "daemon.h"
+
+typedef struct _daemon_client_ {
+	daemon_server *srv;       // server
+	SOCKET sock;              // connection
+	char *out;                // response buffer, DAEMON_OUT bytes
+	u32 n_out;                // bytes in the buffer
+	BOOL broken;              // send failed, the client is gone
+	s64 id;                   // id of the request in work
+} daemon_client;
+
+static const char *daemon_types[4] = {"file", "dir", "link", "other"};
+static const char daemon_b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+
+/***********************************************************************
+* Send the buffered response.
+*
+* daemon_client *c = client
+***********************************************************************/
+static void daemon_flush(daemon_client *c)
+{
+	u32 done = 0;
+	s32 n;
+
+	while(done < c->n_out && !c->broken) {
+		if((n = send(c->sock, c->out + done, c->n_out - done, 0)) <= 0)
+			c->broken = TRUE;
+		else
+			done += n;
+	}
+
+	c->n_out = 0;
+}
+
+/***********************************************************************
+* Add formatted text to the response, at most 1 KiB per call.
+*
+* daemon_client *c = client
+* const char *fmt  = printf format
+***********************************************************************/
+static void daemon_put(daemon_client *c, const char *fmt, ...)
+{
+	va_list ap;
+	s32 n;
+
+	if(DAEMON_OUT - c->n_out < 1024)
+		daemon_flush(c);
+
+	va_start(ap, fmt);
+	n = vsnprintf(c->out + c->n_out, DAEMON_OUT - c->n_out, fmt, ap);
+	va_end(ap);
+
+	if(n > 0)
+		c->n_out += (n < 1024) ? n : 1023;
+}
+
+/***********************************************************************
+* Add a JSON string to the response.
+*
+* daemon_client *c = client
+* const char *s    = string
+***********************************************************************/
+static void daemon_put_str(daemon_client *c, const char *s)
+{
+	daemon_put(c, "\"");
+
+	for(; *s; s++) {
+		if(DAEMON_OUT - c->n_out < 8)
+			daemon_flush(c);
+		if(*s == '"' || *s == '\\') {
+			c->out[c->n_out++] = '\\';
+			c->out[c->n_out++] = *s;
+		}
+		else if((u8)*s < 0x20)
+			c->n_out += sprintf(c->out + c->n_out, "\\u%04x", (u8)*s);
+		else
+			c->out[c->n_out++] = *s;
+	}
+
+	daemon_put(c, "\"");
+}
+
+/***********************************************************************
+* Add data as a base64 JSON string to the response.
+*
+* daemon_client *c = client
+* const u8 *data   = data
+* u32 len          = byte count, at most DAEMON_CHUNK
+***********************************************************************/
+static void daemon_put_b64(daemon_client *c, const u8 *data, u32 len)
+{
+	u32 i, v;
+	char *o;
+
+	if(DAEMON_OUT - c->n_out < (len + 2) / 3 * 4 + 2)
+		daemon_flush(c);
+
+	o = c->out + c->n_out;
+	*o++ = '"';
+
+	for(i = 0; i + 2 < len; i += 3) {
+		v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+		*o++ = daemon_b64[(v >> 18) & 63];
+		*o++ = daemon_b64[(v >> 12) & 63];
+		*o++ = daemon_b64[(v >> 6) & 63];
+		*o++ = daemon_b64[v & 63];
+	}
+	if(i < len) {
+		v = data[i] << 16;
+		if(i + 1 < len)
+			v |= data[i + 1] << 8;
+		*o++ = daemon_b64[(v >> 18) & 63];
+		*o++ = daemon_b64[(v >> 12) & 63];
+		*o++ = (i + 1 < len) ? daemon_b64[(v >> 6) & 63] : '=';
+		*o++ = '=';
+	}
+
+	*o++ = '"';
+	c->n_out = o - c->out;
+}
+
+/***********************************************************************
+* Answer the request in work with an error.
+*
+* daemon_client *c = client
+* const char *msg  = error text
+***********************************************************************/
+static s32 daemon_error(daemon_client *c, const char *msg)
+{
+	daemon_put(c, "{\"id\":%lld,\"error\":", c->id);
+	daemon_put_str(c, msg);
+	daemon_put(c, "}\n");
+
+	return -1;
+}
+
+/***********************************************************************
+* Find the value of a key in a flat JSON object.
+*
+* const char *req = request
+* const char *key = key name
+***********************************************************************/
+static const char* daemon_find(const char *req, const char *key)
+{
+	size_t n = strlen(key);
+	const char *p;
+
+	for(p = strchr(req, '"'); p; p = strchr(p + 1, '"')) {
+		if(strncmp(p + 1, key, n) != 0 || p[n + 1] != '"')
+			continue;
+		for(p += n + 2; *p == ' ' || *p == '\t'; p++);
+		if(*p != ':')
+			continue;
+		for(p++; *p == ' ' || *p == '\t'; p++);
+		return p;
+	}
+
+	return NULL;
+}
+
+/***********************************************************************
+* Get a string value of a request.
+*
+* const char *req = request
+* const char *key = key name
+* char *out       = receives the string
+* size_t size     = size of out
+***********************************************************************/
+static BOOL daemon_get_str(const char *req, const char *key, char *out, size_t size)
+{
+	const char *p = daemon_find(req, key);
+	char hex[5];
+	size_t n = 0;
+
+	if(p == NULL || *p != '"')
+		return FALSE;
+
+	for(p++; *p && *p != '"' && n + 1 < size; p++) {
+		if(*p != '\\' || p[1] == '\0') {
+			out[n++] = *p;
+			continue;
+		}
+		switch(*++p) {
+			case 'n': out[n++] = '\n'; break;
+			case 't': out[n++] = '\t'; break;
+			case 'r': out[n++] = '\r'; break;
+			case 'u':
+				strncpy(hex, p + 1, 4);
+				hex[4] = '\0';
+				out[n++] = (char)strtol(hex, NULL, 16);
+				p += strlen(hex);
+			break;
+			default:  out[n++] = *p; break;
+		}
+	}
+
+	out[n] = '\0';
+	return TRUE;
+}
+
+/***********************************************************************
+* Get a number value of a request.
+*
+* const char *req = request
+* const char *key = key name
+* s64 *out        = receives the number
+***********************************************************************/
+static BOOL daemon_get_num(const char *req, const char *key, s64 *out)
+{
+	const char *p = daemon_find(req, key);
+
+	if(p == NULL || (*p != '-' && (*p < '0' || *p > '9')))
+		return FALSE;
+
+	*out = strtoll(p, NULL, 10);
+	return TRUE;
+}
+
+/***********************************************************************
+* Open all volumes of the device. The dev_hdd0 inodes are read into an
+* index once, so lookups and listings are served from memory.
+*
+* daemon_server *srv     = server
+* const char *index_file = metadata index of dev_hdd0, or NULL
+***********************************************************************/
+static void daemon_open(daemon_server *srv, const char *index_file)
+{
+	const char *name;
+	s32 i, err, n = 0;
+
+	for(i = 0; (name = vfs_name(srv->ctx, i)) != NULL; i++) {
+		if((srv->vol[n] = vfs_open(srv->ctx, name, &err)) == NULL) {
+			printf("can't open %s, %s!\n", name, ps3hdd_strerror(err));
+			continue;
+		}
+		vfs_index(srv->vol[n], index_file, srv->job->threads);
+		n++;
+	}
+}
+
+/***********************************************************************
+* Free the volumes of the device.
+*
+* daemon_server *srv = server
+***********************************************************************/
+static void daemon_close(daemon_server *srv)
+{
+	s32 i;
+
+	for(i = 0; i < VFS_COUNT; i++)
+		vfs_close(srv->vol[i]);
+}
+
+/***********************************************************************
+* Get an open volume.
+*
+* daemon_server *srv = server
+* const char *name   = volume name
+***********************************************************************/
+static vfs_volume* daemon_volume(daemon_server *srv, const char *name)
+{
+	s32 i;
+
+	for(i = 0; i < VFS_COUNT && srv->vol[i]; i++)
+		if(strcmp(srv->vol[i]->name, name) == 0)
+			return srv->vol[i];
+
+	return NULL;
+}
+
+/***********************************************************************
+* list, one response line per entry of a folder, then a done line.
+*
+* daemon_client *c = client
+* vfs_volume *vol = volume
+* const char *path = folder
+***********************************************************************/
+static s32 daemon_list(daemon_client *c, vfs_volume *vol, const char *path)
+{
+	vfs_node dir, *nodes;
+	s32 i, count, listed = 0;
+
+	if(vfs_lookup(vol, path, 1, &dir))
+		return daemon_error(c, "no such file or directory");
+	if((count = vfs_readdir(vol, &dir, &nodes)) < 0)
+		return daemon_error(c, "not a directory");
+
+	for(i = 0; i < count && !c->broken; i++) {
+		daemon_put(c, "{\"id\":%lld,\"name\":", c->id);
+		daemon_put_str(c, nodes[i].name);
+		daemon_put(c, ",\"type\":\"%s\",\"size\":%llu,\"mtime\":%lld,\"ino\":%llu}\n",
+		           daemon_types[nodes[i].type], nodes[i].size, (s64)nodes[i].mtime, nodes[i].id);
+		listed++;
+	}
+	free(nodes);
+
+	daemon_put(c, "{\"id\":%lld,\"done\":true,\"count\":%d}\n", c->id, listed);
+	return 0;
+}
+
+/***********************************************************************
+* stat, one response line with the inode or entry.
+*
+* daemon_client *c = client
+* vfs_volume *vol = volume
+* const char *path = file or folder
+***********************************************************************/
+static s32 daemon_stat(daemon_client *c, vfs_volume *vol, const char *path)
+{
+	vfs_node node;
+
+	if(vfs_lookup(vol, path, 0, &node))
+		return daemon_error(c, "no such file or directory");
+
+	daemon_put(c, "{\"id\":%lld,\"type\":\"%s\",\"size\":%llu,\"mode\":%u,\"ino\":%llu,\"fs\":\"%s\","
+	           "\"atime\":%lld,\"mtime\":%lld,\"ctime\":%lld}\n",
+	           c->id, daemon_types[node.type], node.size, node.mode, node.id, vol->ops->fs,
+	           (s64)node.atime, (s64)node.mtime, (s64)node.ctime);
+
+	return 0;
+}
+
+/***********************************************************************
+* read, the data of a file streamed in base64 chunks of DAEMON_CHUNK
+* bytes, then a done line.
+*
+* daemon_client *c = client
+* vfs_volume *vol = volume
+* const char *path = file
+* s64 offset       = byte offset in the file
+* s64 length       = byte count, -1 up to the end
+***********************************************************************/
+static s32 daemon_read(daemon_client *c, vfs_volume *vol, const char *path, s64 offset, s64 length)
+{
+	vfs_node node;
+	extract_file *f;
+	s64 n, done = 0;
+	u8 *buf;
+
+	if(vfs_lookup(vol, path, 1, &node))
+		return daemon_error(c, "no such file or directory");
+	if(node.type == VFS_DIR)
+		return daemon_error(c, "is a directory");
+
+	f = vfs_extents(vol, &node, path);
+
+	if(offset < 0)
+		offset = 0;
+	if(length < 0 || length > f->size - offset)
+		length = (f->size > offset) ? f->size - offset : 0;
+
+	buf = malloc(DAEMON_CHUNK);
+
+	while(done < length && !c->broken) {
+		n = (length - done < DAEMON_CHUNK) ? length - done : DAEMON_CHUNK;
+		if((n = vfs_pread(vol, f, buf, offset + done, n)) <= 0)
+			break;
+		daemon_put(c, "{\"id\":%lld,\"offset\":%lld,\"data\":", c->id, offset + done);
+		daemon_put_b64(c, buf, n);
+		daemon_put(c, "}\n");
+		daemon_flush(c);
+		done += n;
+	}
+
+	daemon_put(c, "{\"id\":%lld,\"done\":true,\"bytes\":%lld,\"size\":%lld}\n", c->id, done, f->size);
+
+	free(buf);
+	extract_file_free(f);
+	return 0;
+}
+
+/***********************************************************************
+* extract, copy a file or folder on this machine, then a done line with
+* the counts. Each request runs its own job with the options from the
+* command line.
+*
+* daemon_client *c = client
+* vfs_volume *vol = volume
+* const char *path = file or folder
+* const char *dest = output name, or NULL for the program folder
+***********************************************************************/
+static s32 daemon_extract(daemon_client *c, vfs_volume *vol, const char *path, const char *dest)
+{
+	daemon_server *srv = c->srv;
+	vfs_node node;
+	extract_job job;
+	s32 ret;
+
+	if(vfs_lookup(vol, path, 0, &node))
+		return daemon_error(c, "no such file or directory");
+
+	extract_job_init(&job, srv->ctx);
+	job.threads   = srv->job->threads;
+	job.lba_order = srv->job->lba_order;
+	job.crc       = srv->job->crc;
+	job.dedup     = srv->job->dedup;
+	job.filter    = srv->job->filter;
+
+	ret = vfs_copy(vol, path, dest, &job);
+
+	extract_job_finish(&job);
+
+	if(ret)
+		return daemon_error(c, ps3hdd_strerror(ret));
+
+	daemon_put(c, "{\"id\":%lld,\"done\":true,\"files\":%lld,\"bytes\":%lld}\n", c->id, job.files_done, job.bytes_done);
+	return 0;
+}
+
+/***********************************************************************
+* Serve one request line.
+*
+* daemon_client *c = client
+* const char *req  = request, a JSON object
+***********************************************************************/
+static void daemon_request(daemon_client *c, const char *req)
+{
+	daemon_server *srv = c->srv;
+	char op[32], volume[16], path[MAX_PATH], dest[MAX_PATH];
+	s64 offset = 0, length = -1;
+	const char *sep = "";
+	vfs_volume *vol;
+	s32 i;
+
+	c->id = 0;
+	daemon_get_num(req, "id", &c->id);
+
+	EnterCriticalSection(&srv->lock);
+	srv->requests++;
+	LeaveCriticalSection(&srv->lock);
+
+	if(!daemon_get_str(req, "op", op, sizeof(op))) {
+		daemon_error(c, "no op");
+	}
+	else if(strcmp(op, "volumes") == 0) {
+		daemon_put(c, "{\"id\":%lld,\"volumes\":[", c->id);
+		for(i = 0; i < VFS_COUNT && srv->vol[i]; i++) {
+			daemon_put(c, "%s\"%s\"", sep, srv->vol[i]->name);
+			sep = ",";
+		}
+		daemon_put(c, "]}\n");
+	}
+	else if(!daemon_get_str(req, "volume", volume, sizeof(volume)) || (vol = daemon_volume(srv, volume)) == NULL) {
+		daemon_error(c, "no such volume");
+	}
+	else {
+		if(!daemon_get_str(req, "path", path, sizeof(path)) || path[0] == '\0')
+			strcpy(path, "/");
+
+		if(path[0] != '/')
+			daemon_error(c, "path must start with /");
+		else if(strcmp(op, "list") == 0)
+			daemon_list(c, vol, path);
+		else if(strcmp(op, "stat") == 0)
+			daemon_stat(c, vol, path);
+		else if(strcmp(op, "read") == 0) {
+			daemon_get_num(req, "offset", &offset);
+			daemon_get_num(req, "length", &length);
+			daemon_read(c, vol, path, offset, length);
+		}
+		else if(strcmp(op, "extract") == 0)
+			daemon_extract(c, vol, path, daemon_get_str(req, "dest", dest, sizeof(dest)) ? dest : NULL);
+		else
+			daemon_error(c, "unknown op");
+	}
+
+	daemon_flush(c);
+}
+
+/***********************************************************************
+* Client thread, serves request lines until the client disconnects.
+*
+* LPVOID param = daemon_client
+***********************************************************************/
+static DWORD WINAPI daemon_client_run(LPVOID param)
+{
+	daemon_client *c = param;
+	daemon_server *srv = c->srv;
+	char in[4096];
+	char *line = malloc(DAEMON_LINE);
+	u32 n_line = 0;
+	BOOL too_long = FALSE;
+	s32 i, n;
+
+	while(!c->broken && (n = recv(c->sock, in, sizeof(in), 0)) > 0) {
+		for(i = 0; i < n; i++) {
+			if(in[i] == '\r')
+				continue;
+			if(in[i] != '\n') {
+				if(n_line < DAEMON_LINE - 1)
+					line[n_line++] = in[i];
+				else
+					too_long = TRUE;
+				continue;
+			}
+
+			line[n_line] = '\0';
+			if(too_long) {
+				c->id = 0;
+				daemon_error(c, "request too long");
+				daemon_flush(c);
+			}
+			else if(n_line)
+				daemon_request(c, line);
+			n_line = 0;
+			too_long = FALSE;
+		}
+	}
+
+	closesocket(c->sock);
+	free(line);
+	free(c->out);
+	free(c);
+
+	EnterCriticalSection(&srv->lock);
+	srv->clients--;
+	LeaveCriticalSection(&srv->lock);
+
+	return 0;
+}
+
+/***********************************************************************
+* Serve requests on a Unix domain socket until the program is ended.
+* The device stays open and the volumes are set up once, each client
+* gets its own thread. A request is one JSON object per line, each
+* response line carries the id of its request.
+*
+* ps3_context *ctx       = ps3 device information
+* extract_job *job       = options of the command line
+* const char *index_file = metadata index of dev_hdd0, or NULL
+* const char *sock_path  = socket file
+***********************************************************************/
+s32 daemon_run(ps3_context *ctx, extract_job *job, const char *index_file, const char *sock_path)
+{
+	WSADATA wsa;
+	SOCKET ls, s;
+	struct sockaddr_un addr;
+	daemon_server srv;
+	daemon_client *c;
+	HANDLE th;
+
+	if(strlen(sock_path) >= sizeof(addr.sun_path)) {
+		printf("socket path too long!\n");
+		return -1;
+	}
+
+	if(WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+		printf("can't init winsock!\n");
+		return -1;
+	}
+
+	if((ls = socket(AF_UNIX, SOCK_STREAM, 0)) == INVALID_SOCKET) {
+		printf("can't create socket!\n");
+		WSACleanup();
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, sock_path);
+
+	// a socket file left by an earlier run blocks bind
+	DeleteFileA(sock_path);
+
+	if(bind(ls, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR || listen(ls, SOMAXCONN) == SOCKET_ERROR) {
+		printf("can't listen on \"%s\"!\n", sock_path);
+		closesocket(ls);
+		WSACleanup();
+		return -1;
+	}
+
+	memset(&srv, 0, sizeof(srv));
+	srv.ctx = ctx;
+	srv.job = job;
+	InitializeCriticalSection(&srv.lock);
+	daemon_open(&srv, index_file);
+
+	printf("listening on %s\n", sock_path);
+
+	while((s = accept(ls, NULL, NULL)) != INVALID_SOCKET) {
+		c = malloc(sizeof(*c));
+		memset(c, 0, sizeof(*c));
+		c->srv = &srv;
+		c->sock = s;
+		c->out = malloc(DAEMON_OUT);
+
+		EnterCriticalSection(&srv.lock);
+		srv.clients++;
+		LeaveCriticalSection(&srv.lock);
+
+		if((th = CreateThread(NULL, 0, daemon_client_run, c, 0, NULL)) == NULL) {
+			printf("can't create client thread!\n");
+			closesocket(s);
+			free(c->out);
+			free(c);
+			EnterCriticalSection(&srv.lock);
+			srv.clients--;
+			LeaveCriticalSection(&srv.lock);
+			continue;
+		}
+		CloseHandle(th);
+	}
+
+	printf("accept failed, %lld requests served\n", srv.requests);
+	closesocket(ls);
+	DeleteFileA(sock_path);
+	WSACleanup();
+
+	// volumes stay with clients still running, the program ends anyway
+	if(srv.clients == 0)
+		daemon_close(&srv);
+
+	return -1;
+}
@@ -0,0 +1,28 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#ifndef _DAEMON_H_
+#define _DAEMON_H_
+
+#include "types.h"
+#include "extract.h"
+#include "fs/vfs.h"
+
+#define DAEMON_LINE   8192         // longest request line
+#define DAEMON_OUT    0x20000      // response buffer of a client, 128 KiB
+#define DAEMON_CHUNK  0xC000       // file bytes per read response, 48 KiB
+
+typedef struct _daemon_server_ {
+	ps3_context *ctx;         // ps3 device information
+	extract_job *job;         // options of the command line, used by each extract
+	vfs_volume *vol[VFS_COUNT]; // open volumes, NULL after the last
+	CRITICAL_SECTION lock;    // guards the counters below
+	s32 clients;              // connected clients
+	s64 requests;             // requests served
+} daemon_server;
+
+s32 daemon_run(ps3_context *ctx, extract_job *job, const char *index_file, const char *sock_path);
+
+#endif  // _DAEMON_H_
@@ -5,21 +5,52 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <immintrin.h>
 
 #include "device.h"
+#include "pool.h"
+#include "kgen.h"
+#include "hash.h"
 
-// decryption contexts
-static aes_context    cbc_dec;
-static aes_xts_ctxt_t xts_dec;
-static aes_xts_ctxt_t xts_dec_vf;
+typedef struct _dev_preload_task_ {
+	ps3_context *ctx;       // ps3 device information
+	u8 *buf;                // sectors read, decrypted in place
+	s64 n_sec;              // sector count
+	s64 sec_num;            // start sector number on hdd
+} dev_preload_task;
 
-// encryption contexts
-static aes_context    cbc_enc;
-static aes_xts_ctxt_t xts_enc;
-static aes_xts_ctxt_t xts_enc_vf;
+typedef struct _dev_crypt_batch_ {
+	CRITICAL_SECTION lock;  // guards left
+	CONDITION_VARIABLE done;// signalled when left drops to 0
+	s32 left;               // steps not decrypted yet
+} dev_crypt_batch;
+
+typedef struct _dev_crypt_task_ {
+	ps3_context *ctx;       // ps3 device information
+	u8 *buf;                // sectors read, decrypted in place
+	s64 n_sec;              // sector count
+	s64 sec_num;            // start sector number on hdd
+	dev_crypt_batch *batch; // read the step belongs to
+} dev_crypt_task;
+
+typedef struct _dev_cache_ {
+	char serial[64];        // serial number of the drive
+	u32 id;                 // id of the key that decrypted it
+} dev_cache;
+
+typedef struct _dev_probe_task_ {
+	dev_probe *p;           // candidate, receives the result
+	BOOL drive;             // a physical drive, not an image
+	BOOL filter;            // leave out removable and small drives
+	dev_key *ring;          // keys to try
+	s32 n_keys;             // key count
+	dev_cache *cache;       // keys of drives seen before
+	s32 n_cache;            // cache entries
+} dev_probe_task;
 
 
 
@@ -93,6 +124,7 @@ static s32 check_device(ps3_context *ctx)
 	
 	// get sector 0(first of ps3 main partition table)
 	// and sector 8(first of VFLASH partition table, if a VFLASH)
+	EnterCriticalSection(&ctx->io_lock);
   seek_device(ctx->dev, 0);
   ReadFile(ctx->dev, sec_0, SECTOR_SIZE * 1, &n_read, 0);
   _es16_buffer(sec_0, SECTOR_SIZE * 1);
@@ -100,11 +132,12 @@ static s32 check_device(ps3_context *ctx)
   seek_device(ctx->dev, 8);
   ReadFile(ctx->dev, sec_8, SECTOR_SIZE * 1, &n_read, 0);
   _es16_buffer(sec_8, SECTOR_SIZE * 1);
+	LeaveCriticalSection(&ctx->io_lock);
 	
 	// decrypt sector 0 layer 1(ATA) with aes_cbc_192
 	memcpy(tmp, sec_0, SECTOR_SIZE);
-	aes_setkey_dec(&cbc_dec, ctx->ata_k1, 192);
-	aes_crypt_cbc(&cbc_dec, AES_DECRYPT, SECTOR_SIZE, ctx->iv, tmp, tmp);
+	aes_setkey_dec(&ctx->cbc_dec, ctx->ata_k1, 192);
+	aes_crypt_cbc(&ctx->cbc_dec, AES_DECRYPT, SECTOR_SIZE, ctx->iv, tmp, tmp);
 	memset(ctx->iv, 0, 16);
 	
 	pt_hdd = (struct disklabel *)tmp;
@@ -116,13 +149,13 @@ static s32 check_device(ps3_context *ctx)
     memcpy(tmp, sec_8, SECTOR_SIZE);
 		    
     // decrypt sector 8 layer 1(ATA) with aes_cbc_192
-    aes_setkey_dec(&cbc_dec, ctx->ata_k1, 192);
-    aes_crypt_cbc(&cbc_dec, AES_DECRYPT, SECTOR_SIZE, ctx->iv, tmp, tmp);
+    aes_setkey_dec(&ctx->cbc_dec, ctx->ata_k1, 192);
+    aes_crypt_cbc(&ctx->cbc_dec, AES_DECRYPT, SECTOR_SIZE, ctx->iv, tmp, tmp);
     memset(ctx->iv, 0, 16);
     
     // decrypt sector 8 layer 2(VFLASH) with aes-xts-128
-    aes_xts_init(&xts_dec, AES_DECRYPT, ctx->encdec_k1, ctx->encdec_k2, 128);
-    aes_xts_crypt(&xts_dec, 8, SECTOR_SIZE, tmp, tmp);
+    aes_xts_init(&ctx->xts_dec, AES_DECRYPT, ctx->encdec_k1, ctx->encdec_k2, 128);
+    aes_xts_crypt(&ctx->xts_dec, 8, SECTOR_SIZE, tmp, tmp);
     
     pt_vflash = (struct disklabel *)tmp;
     
@@ -136,22 +169,22 @@ static s32 check_device(ps3_context *ctx)
       ctx->vflash_size  = _ES64(pt_hdd->d_partitions[0].p_size);
       
       // set encryption context for layer 2(VFLASH) 
-      aes_xts_init(&xts_enc_vf, AES_ENCRYPT, ctx->encdec_k1, ctx->encdec_k2, 128);
+      aes_xts_init(&ctx->xts_enc_vf, AES_ENCRYPT, ctx->encdec_k1, ctx->encdec_k2, 128);
 		}
 		else {
 		  // no partition table for first region; ps3_type == 1(FAT_NAND)
 		  ctx->ps3_type = 1;
 		}
 		// set encryption context for layer 1(ATA) 
-		aes_setkey_enc(&cbc_enc, ctx->ata_k1, 192);
+		aes_setkey_enc(&ctx->cbc_enc, ctx->ata_k1, 192);
 		
 	  return 0; 
 	}
 	
 	// not a FAT, test sector 0 layer 1(ATA) with aes_xts_128
   memcpy(tmp, sec_0, SECTOR_SIZE);
-  aes_xts_init(&xts_dec, AES_DECRYPT, ctx->ata_k1, ctx->ata_k2, 128);
-  aes_xts_crypt(&xts_dec, 0, SECTOR_SIZE, tmp, tmp);
+  aes_xts_init(&ctx->xts_dec, AES_DECRYPT, ctx->ata_k1, ctx->ata_k2, 128);
+  aes_xts_crypt(&ctx->xts_dec, 0, SECTOR_SIZE, tmp, tmp);
 	
 	pt_hdd = (struct disklabel *)tmp;
 	
@@ -164,11 +197,11 @@ static s32 check_device(ps3_context *ctx)
     ctx->vflash_size  = _ES64(pt_hdd->d_partitions[0].p_size);
     
     // set layer 2(VFLASH) decrytion context
-    aes_xts_init(&xts_dec_vf, AES_DECRYPT, ctx->encdec_k1, ctx->encdec_k2, 128);
+    aes_xts_init(&ctx->xts_dec_vf, AES_DECRYPT, ctx->encdec_k1, ctx->encdec_k2, 128);
     
     // set encryption contexts for layer 1(ATA) and layer 2(VFLASH)
-    aes_xts_init(&xts_enc, AES_ENCRYPT, ctx->ata_k1, ctx->ata_k2, 128);
-	  aes_xts_init(&xts_enc_vf, AES_ENCRYPT, ctx->encdec_k1, ctx->encdec_k2, 128);
+    aes_xts_init(&ctx->xts_enc, AES_ENCRYPT, ctx->ata_k1, ctx->ata_k2, 128);
+	  aes_xts_init(&ctx->xts_enc_vf, AES_ENCRYPT, ctx->encdec_k1, ctx->encdec_k2, 128);
 	  
 		return 0;
 	}
@@ -178,75 +211,402 @@ static s32 check_device(ps3_context *ctx)
 }
 
 /***********************************************************************
-* Get ps3 hdd/file handle.
+* Open a ps3 hdd/image by name and check it with the keys in ctx.
+* 
+* ps3_context *ctx = ps3 device information
+* const char *name = image file or "\\.\PhysicalDriveN"
+***********************************************************************/
+s32 open_device(ps3_context *ctx, const char *name)
+{
+	ctx->dev = CreateFile(name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+	
+	if(ctx->dev == INVALID_HANDLE_VALUE)
+		return -1;
+	
+	if(check_device(ctx) == 0)
+		return 0;
+	
+	CloseHandle(ctx->dev);
+	ctx->dev = INVALID_HANDLE_VALUE;
+	return -1;
+}
+
+/***********************************************************************
+* Prepare the trial contexts of a key, ata keys must be set.
+* 
+* dev_key *k = key to prepare
+***********************************************************************/
+static void dev_key_setup(dev_key *k)
+{
+	aes_setkey_dec(&k->cbc_dec, k->ata_k1, 192);
+	aes_xts_init(&k->xts_dec, AES_DECRYPT, k->ata_k1, k->ata_k2, 128);
+}
+
+/***********************************************************************
+* Derive the ata keys of a whole keyring once, so every device can be
+* tried against all of them without deriving again.
+* 
+* u8 *keys   = eid root keys/ivs, 0x30 bytes each
+* s32 n_keys = key count
+* 
+* return: n_keys prepared keys, free() them
+***********************************************************************/
+dev_key* device_keyring(u8 *keys, s32 n_keys)
+{
+	s32 i;
+	dev_key *ring = malloc(n_keys * sizeof(dev_key));
+	
+	if(ring == NULL)
+		return NULL;
+	
+	for(i = 0; i < n_keys; i++) {
+		generate_ata_keys(keys + i * 0x30, keys + i * 0x30 + 0x20, ring[i].ata_k1, ring[i].ata_k2);
+		ring[i].id = crc32c_update(0, keys + i * 0x30, 0x30);
+		dev_key_setup(&ring[i]);
+	}
+	
+	return ring;
+}
+
+/***********************************************************************
+* Does a key decrypt sector 0? Only the first two AES blocks are
+* decrypted, they hold the partition table magic in both modes.
+* 
+* dev_key *k = key to try
+* u8 *sec_0  = byte swapped sector 0
+***********************************************************************/
+static BOOL dev_trial(dev_key *k, u8 *sec_0)
+{
+	u8 iv[0x10] = {0};
+	u8 tmp[DEV_TRIAL_SIZE];
+	u64 *magic = (u64 *)(tmp + offsetof(struct disklabel, d_magic1));
+	
+	// layer 1(ATA) aes-cbc-192, FAT_NAND and FAT_NOR
+	memcpy(tmp, sec_0, DEV_TRIAL_SIZE);
+	aes_crypt_cbc(&k->cbc_dec, AES_DECRYPT, DEV_TRIAL_SIZE, iv, tmp, tmp);
+	if(_ES64(magic[0]) == MAGIC1 && _ES64(magic[1]) == MAGIC2)
+		return TRUE;
+	
+	// layer 1(ATA) aes-xts-128, SLIM_NOR
+	aes_xts_crypt(&k->xts_dec, 0, DEV_TRIAL_SIZE, sec_0, tmp);
+	if(_ES64(magic[0]) == MAGIC1 && _ES64(magic[1]) == MAGIC2)
+		return TRUE;
+	
+	return FALSE;
+}
+
+/***********************************************************************
+* Size and serial number of a drive. With filter, removable media and
+* drives too small for a ps3 hdd are left out.
+* 
+* HANDLE dev   = drive handle
+* dev_probe *p = receives size and serial
+* BOOL filter  = leave out removable and small drives
+***********************************************************************/
+static s32 dev_drive_info(HANDLE dev, dev_probe *p, BOOL filter)
+{
+	STORAGE_PROPERTY_QUERY query;
+	GET_LENGTH_INFORMATION len;
+	u8 buf[1024];
+	STORAGE_DEVICE_DESCRIPTOR *desc = (STORAGE_DEVICE_DESCRIPTOR *)buf;
+	DWORD n = 0, i, j = 0;
+	
+	memset(&query, 0, sizeof(query));
+	memset(buf, 0, sizeof(buf));
+	query.PropertyId = StorageDeviceProperty;
+	query.QueryType  = PropertyStandardQuery;
+	
+	if(DeviceIoControl(dev, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), buf, sizeof(buf), &n, NULL)) {
+		if(filter && desc->RemovableMedia)
+			return -1;
+		// serial without blanks, it is a word in the cache file
+		if(desc->SerialNumberOffset)
+			for(i = desc->SerialNumberOffset; i < n && buf[i] && j < sizeof(p->serial) - 1; i++)
+				if(buf[i] > ' ')
+					p->serial[j++] = buf[i];
+		p->serial[j] = '\0';
+	}
+	
+	if(DeviceIoControl(dev, IOCTL_DISK_GET_LENGTH_INFO, NULL, 0, &len, sizeof(len), &n, NULL))
+		p->size = len.Length.QuadPart;
+	if(filter && p->size && p->size < DEV_PROBE_MIN_SIZE)
+		return -1;
+	
+	return 0;
+}
+
+/***********************************************************************
+* Probe thread of one drive/image. Sector 0 is read once and tried
+* against the key cached for the drive first, then the whole keyring.
+* 
+* LPVOID param = dev_probe_task
+***********************************************************************/
+static DWORD WINAPI dev_probe_thread(LPVOID param)
+{
+	dev_probe_task *t = param;
+	dev_probe *p = t->p;
+	u8 sec_0[SECTOR_SIZE];
+	DWORD n_read = 0;
+	HANDLE dev;
+	s32 i, hint = -1;
+	
+	dev = CreateFile(p->name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0, 0);
+	if(dev == INVALID_HANDLE_VALUE)
+		return 0;
+	
+	if(t->drive && dev_drive_info(dev, p, t->filter) != 0) {
+		CloseHandle(dev);
+		return 0;
+	}
+	
+	ReadFile(dev, sec_0, SECTOR_SIZE, &n_read, 0);
+	CloseHandle(dev);
+	if(n_read != SECTOR_SIZE)
+		return 0;
+	_es16_buffer(sec_0, SECTOR_SIZE);
+	
+	// the key this drive had last time
+	for(i = 0; p->serial[0] && i < t->n_cache && hint < 0; i++)
+		if(strcmp(t->cache[i].serial, p->serial) == 0)
+			for(hint = 0; hint < t->n_keys && t->ring[hint].id != t->cache[i].id; hint++);
+	if(hint >= t->n_keys)
+		hint = -1;
+	
+	if(hint >= 0 && dev_trial(&t->ring[hint], sec_0)) {
+		p->key = hint;
+		p->cached = TRUE;
+		return 0;
+	}
+	
+	for(i = 0; i < t->n_keys; i++) {
+		if(i != hint && dev_trial(&t->ring[i], sec_0)) {
+			p->key = i;
+			break;
+		}
+	}
+	
+	return 0;
+}
+
+/***********************************************************************
+* Read the key cache, one "serial id" line per drive.
+* 
+* const char *cache = cache file
+* dev_cache *c      = receives the entries, DEV_CACHE_MAX
+***********************************************************************/
+static s32 dev_cache_load(const char *cache, dev_cache *c)
+{
+	s32 n = 0;
+	FILE *fd;
+	
+	if((fd = fopen(cache, "r")) == NULL)
+		return 0;
+	
+	while(n < DEV_CACHE_MAX && fscanf(fd, "%63s %x", c[n].serial, &c[n].id) == 2)
+		n++;
+	
+	fclose(fd);
+	return n;
+}
+
+/***********************************************************************
+* Note the keys found for drives in the cache, rewritten if changed.
+* 
+* const char *cache = cache file
+* dev_cache *c      = entries read, DEV_CACHE_MAX
+* s32 n             = entry count
+* dev_probe *probe  = probed drives/images
+* s32 n_probe       = probe count
+* dev_key *ring     = keyring probed with
+***********************************************************************/
+static void dev_cache_save(const char *cache, dev_cache *c, s32 n, dev_probe *probe, s32 n_probe, dev_key *ring)
+{
+	s32 i, j;
+	BOOL changed = FALSE;
+	FILE *fd;
+	
+	for(i = 0; i < n_probe; i++) {
+		if(probe[i].key < 0 || probe[i].serial[0] == '\0' || probe[i].cached)
+			continue;
+		for(j = 0; j < n && strcmp(c[j].serial, probe[i].serial); j++);
+		if(j == n) {
+			if(n == DEV_CACHE_MAX)
+				continue;
+			strcpy(c[n++].serial, probe[i].serial);
+		}
+		c[j].id = ring[probe[i].key].id;
+		changed = TRUE;
+	}
+	
+	if(!changed || (fd = fopen(cache, "w")) == NULL)
+		return;
+	
+	for(i = 0; i < n; i++)
+		fprintf(fd, "%s %08x\n", c[i].serial, c[i].id);
+	
+	fclose(fd);
+}
+
+/***********************************************************************
+* Find ps3 hdds/images. PhysicalDrive1..15 and the images given are
+* probed at the same time, each on its own thread, against all keys of
+* the keyring. Nothing is kept open.
+* 
+* dev_key *ring     = keys to try
+* s32 n_keys        = key count
+* char *images[]    = image files to probe besides the drives
+* s32 n_images      = image file count
+* const char *cache = key cache by drive serial, or NULL
+* BOOL filter       = leave out removable drives and drives under
+*                     DEV_PROBE_MIN_SIZE, USB bridges often report
+*                     removable media
+* dev_probe *probe  = receives the results, DEV_PROBE_MAX
+* 
+* return: count of drives/images probed, key is -1 where none fits
+***********************************************************************/
+s32 device_probe(dev_key *ring, s32 n_keys, char *images[], s32 n_images, const char *cache, BOOL filter, dev_probe *probe)
+{
+	s32 i, n = 0, n_threads = 0, n_cache = 0;
+	dev_probe_task task[DEV_PROBE_MAX];
+	HANDLE threads[DEV_PROBE_MAX];
+	dev_cache *c = NULL;
+	
+	if(cache && (c = malloc(DEV_CACHE_MAX * sizeof(dev_cache))) != NULL)
+		n_cache = dev_cache_load(cache, c);
+	
+	memset(probe, 0, DEV_PROBE_MAX * sizeof(dev_probe));
+	
+	for(i = 1; i < DEV_PROBE_DRIVES; i++, n++)
+		sprintf(probe[n].name, "\\\\.\\PhysicalDrive%d", i);
+	for(i = 0; i < n_images && n < DEV_PROBE_MAX; i++) {
+		if(strlen(images[i]) >= MAX_PATH)
+			continue;
+		strcpy(probe[n++].name, images[i]);
+	}
+	
+	for(i = 0; i < n; i++) {
+		probe[i].key    = -1;
+		task[i].p       = &probe[i];
+		task[i].drive   = i < DEV_PROBE_DRIVES - 1;
+		task[i].filter  = filter;
+		task[i].ring    = ring;
+		task[i].n_keys  = n_keys;
+		task[i].cache   = c;
+		task[i].n_cache = n_cache;
+		
+		if((threads[n_threads] = CreateThread(NULL, 0, dev_probe_thread, &task[i], 0, NULL)) != NULL)
+			n_threads++;
+		else
+			dev_probe_thread(&task[i]);
+	}
+	
+	if(n_threads)
+		WaitForMultipleObjects(n_threads, threads, TRUE, INFINITE);
+	for(i = 0; i < n_threads; i++)
+		CloseHandle(threads[i]);
+	
+	if(c) {
+		dev_cache_save(cache, c, n_cache, probe, n, ring);
+		free(c);
+	}
+	
+	return n;
+}
+
+/***********************************************************************
+* Get ps3 hdd/file handle. With several ps3 hdds attached, the one on
+* the lowest drive number is taken.
 * 
 * ps3_context *ctx = ps3 device information
 * u8 mode          = 0(file) or 1(hdd)
 ***********************************************************************/
 s32 get_device_handle(ps3_context *ctx, u8 mode)
 {
-	s32 i, ret = -1;
-	char drive[32];
+	s32 i, n;
+	dev_key key;
+	dev_probe *probe;
+	
+	InitializeCriticalSection(&ctx->io_lock);
+	InitializeCriticalSection(&ctx->fat_lock);
 	
 	if(mode) {
-		for(i = 1; i < 16; i++) {
-			sprintf(drive, "\\\\.\\PhysicalDrive%d", i);
-			ctx->dev = CreateFile(drive, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
-			
-			if(ctx->dev == INVALID_HANDLE_VALUE)
-			  CloseHandle(ctx->dev);
-		  else
-		    if((ret = check_device(ctx)) == 0)
-		      return 0;
+		memcpy(key.ata_k1, ctx->ata_k1, 0x20);
+		memcpy(key.ata_k2, ctx->ata_k2, 0x20);
+		key.id = 0;
+		dev_key_setup(&key);
+		
+		if((probe = malloc(DEV_PROBE_MAX * sizeof(dev_probe))) == NULL)
+			return -1;
+		// every drive is tried like before the probe, whatever it reports
+		n = device_probe(&key, 1, NULL, 0, NULL, FALSE, probe);
+		for(i = 0; i < n; i++) {
+			if(probe[i].key == 0 && open_device(ctx, probe[i].name) == 0) {
+				free(probe);
+				return 0;
+			}
 		}
+		free(probe);
 	}
 	else {
-		ctx->dev = CreateFile("backup.bin", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
-	  
-	  if(ctx->dev == INVALID_HANDLE_VALUE)
-		  CloseHandle(ctx->dev);
-		
-		if((ret = check_device(ctx)) == 0)
-		  return 0;
+		if(open_device(ctx, "backup.bin") == 0)
+			return 0;
 	}
 	
 	return -1;
 }
 
 /***********************************************************************
-* Read decrypted sector/s from ps3 hdd/image.
+* Close a ps3 hdd/image and free what was read from it.
 * 
 * ps3_context *ctx = ps3 device information
-* uint8_t *buf     = buffer to hold data
-* s64 n_sec        = count of sectors to read
+***********************************************************************/
+void close_device(ps3_context *ctx)
+{
+	s32 i;
+	
+	fat_free_tables(ctx);
+	
+	for(i = 0; i < 3; i++) {
+		free(ctx->flash_ram[i]);
+		ctx->flash_ram[i] = NULL;
+	}
+	
+	if(ctx->dev != INVALID_HANDLE_VALUE && ctx->dev != NULL)
+		CloseHandle(ctx->dev);
+	ctx->dev = INVALID_HANDLE_VALUE;
+	
+	DeleteCriticalSection(&ctx->io_lock);
+	DeleteCriticalSection(&ctx->fat_lock);
+}
+
+/***********************************************************************
+* Byte swap and decrypt sector/s read from ps3 hdd/image, in place.
+* 
+* ps3_context *ctx = ps3 device information
+* uint8_t *buf     = sectors as read from hdd
+* s64 n_sec        = count of sectors
 * s64 sec_num      = start sector number on hdd
 ***********************************************************************/
-s64 block_read(ps3_context *ctx, u8 *buf, s64 n_sec, s64 sec_num)
+static void block_decrypt(ps3_context *ctx, u8 *buf, s64 n_sec, s64 sec_num)
 {
 	s64 i;
-	DWORD n_read;
-	
-	// check device handle
-	if(ctx->dev <= 0)
-		return -1;
+	u8 iv[0x10];
 	
-	// read and byte swap data
-	seek_device(ctx->dev, sec_num * SECTOR_SIZE);
-	ReadFile(ctx->dev, buf, n_sec * SECTOR_SIZE, &n_read, 0);
+	// byte swap data
 	_es16_buffer(buf, n_sec * SECTOR_SIZE);
 	
-	// decrypt layer 1(ATA)
+	// decrypt layer 1(ATA), every sector starts with a zero iv
   switch(ctx->ps3_type) {
     case 1:  // FAT_NAND
 	  case 2:  // FAT_NOR
 	    for(i = 0; i < n_sec; i++) {
-		    aes_crypt_cbc(&cbc_dec, AES_DECRYPT, SECTOR_SIZE, ctx->iv, buf + (SECTOR_SIZE * i), buf + (SECTOR_SIZE * i));
-		    memset(ctx->iv, 0, 16);
+		    memset(iv, 0, 16);
+		    aes_crypt_cbc(&ctx->cbc_dec, AES_DECRYPT, SECTOR_SIZE, iv, buf + (SECTOR_SIZE * i), buf + (SECTOR_SIZE * i));
       }
 	    break;
 	  case 3:  // SLIM_NOR
 		  for(i = 0; i < n_sec; i++)
-		    aes_xts_crypt(&xts_dec, sec_num + i, SECTOR_SIZE, buf + (SECTOR_SIZE * i), buf + (SECTOR_SIZE * i));
+		    aes_xts_crypt(&ctx->xts_dec, sec_num + i, SECTOR_SIZE, buf + (SECTOR_SIZE * i), buf + (SECTOR_SIZE * i));
 		  break;
   }
 	
@@ -254,7 +614,186 @@ s64 block_read(ps3_context *ctx, u8 *buf, s64 n_sec, s64 sec_num)
 	if(ctx->vflash_start != 0)
 		for(i = 0; i < n_sec; i++)
 			if(((sec_num + i) >= ctx->vflash_start) && ((sec_num + i) <= (ctx->vflash_start + ctx->vflash_size)))
-			  aes_xts_crypt(&xts_dec_vf, sec_num + i, SECTOR_SIZE, buf + (SECTOR_SIZE * i), buf + (SECTOR_SIZE * i));
+			  aes_xts_crypt(&ctx->xts_dec_vf, sec_num + i, SECTOR_SIZE, buf + (SECTOR_SIZE * i), buf + (SECTOR_SIZE * i));
+}
+
+/***********************************************************************
+* Start and sector count of a VFLASH volume that can be preloaded.
+* 
+* ps3_context *ctx = ps3 device information
+* s32 i            = 0(dev_flash), 1(dev_flash2) or 2(dev_flash3)
+* s64 *size        = receives the sector count
+***********************************************************************/
+static s64 dev_ram_region(ps3_context *ctx, s32 i, s64 *size)
+{
+	s64 start[3] = {ctx->flash_start, ctx->flash2_start, ctx->flash3_start};
+	s64 count[3] = {ctx->flash_size, ctx->flash2_size, ctx->flash3_size};
+	
+	*size = count[i];
+	return start[i];
+}
+
+/***********************************************************************
+* Read decrypted sector/s from a preloaded volume.
+* 
+* ps3_context *ctx = ps3 device information
+* uint8_t *buf     = buffer to hold data
+* s64 n_sec        = count of sectors to read
+* s64 sec_num      = start sector number on hdd
+* 
+* return: TRUE if all sectors lie in one preloaded volume
+***********************************************************************/
+static BOOL dev_ram_read(ps3_context *ctx, u8 *buf, s64 n_sec, s64 sec_num)
+{
+	s32 i;
+	s64 start, size;
+	
+	for(i = 0; i < 3; i++) {
+		if(ctx->flash_ram[i] == NULL)
+			continue;
+		start = dev_ram_region(ctx, i, &size);
+		if(sec_num >= start && sec_num + n_sec <= start + size) {
+			memcpy(buf, ctx->flash_ram[i] + (sec_num - start) * SECTOR_SIZE, n_sec * SECTOR_SIZE);
+			return TRUE;
+		}
+	}
+	
+	return FALSE;
+}
+
+/***********************************************************************
+* Keep preloaded volumes in step with sector/s written to the hdd.
+* 
+* ps3_context *ctx = ps3 device information
+* uint8_t *buf     = decrypted data to be written
+* s64 n_sec        = count of sectors
+* s64 sec_num      = start sector number on hdd
+***********************************************************************/
+static void dev_ram_write(ps3_context *ctx, u8 *buf, s64 n_sec, s64 sec_num)
+{
+	s32 i;
+	s64 start, size, from, to;
+	
+	for(i = 0; i < 3; i++) {
+		if(ctx->flash_ram[i] == NULL)
+			continue;
+		start = dev_ram_region(ctx, i, &size);
+		from = (sec_num > start) ? sec_num : start;
+		to = (sec_num + n_sec < start + size) ? sec_num + n_sec : start + size;
+		if(from < to)
+			memcpy(ctx->flash_ram[i] + (from - start) * SECTOR_SIZE, buf + (from - sec_num) * SECTOR_SIZE, (to - from) * SECTOR_SIZE);
+	}
+}
+
+/***********************************************************************
+* Preload worker, decrypt one step of sectors.
+* 
+* void *arg  = dev_preload_task
+* s32 worker = worker index, unused
+***********************************************************************/
+static void dev_preload_worker(void *arg, s32 worker)
+{
+	dev_preload_task *t = arg;
+	
+	block_decrypt(t->ctx, t->buf, t->n_sec, t->sec_num);
+	free(t);
+}
+
+/***********************************************************************
+* Shared crypto worker, decrypt one step of a read.
+* 
+* void *arg  = dev_crypt_task
+* s32 worker = worker index, unused
+***********************************************************************/
+static void dev_crypt_worker(void *arg, s32 worker)
+{
+	dev_crypt_task *t = arg;
+	
+	block_decrypt(t->ctx, t->buf, t->n_sec, t->sec_num);
+	
+	EnterCriticalSection(&t->batch->lock);
+	if(--t->batch->left == 0)
+		WakeConditionVariable(&t->batch->done);
+	LeaveCriticalSection(&t->batch->lock);
+}
+
+/***********************************************************************
+* Decrypt a big read on the shared crypto pool. The pool serves the
+* readers of all devices, so only the steps of this read are waited
+* for. The last step is decrypted by the reader itself.
+* 
+* ps3_context *ctx = ps3 device information
+* uint8_t *buf     = sectors as read from hdd
+* s64 n_sec        = count of sectors
+* s64 sec_num      = start sector number on hdd
+***********************************************************************/
+static void block_decrypt_shared(ps3_context *ctx, u8 *buf, s64 n_sec, s64 sec_num)
+{
+	s32 i, n_task = (s32)((n_sec + DEV_CRYPT_STEP - 1) / DEV_CRYPT_STEP);
+	dev_crypt_task *t = malloc(n_task * sizeof(dev_crypt_task));
+	dev_crypt_batch batch;
+	
+	if(t == NULL) {
+		block_decrypt(ctx, buf, n_sec, sec_num);
+		return;
+	}
+	
+	InitializeCriticalSection(&batch.lock);
+	InitializeConditionVariable(&batch.done);
+	batch.left = n_task - 1;
+	
+	for(i = 0; i < n_task; i++) {
+		t[i].ctx     = ctx;
+		t[i].buf     = buf + (s64)i * DEV_CRYPT_STEP * SECTOR_SIZE;
+		t[i].n_sec   = (n_sec - (s64)i * DEV_CRYPT_STEP < DEV_CRYPT_STEP) ? n_sec - (s64)i * DEV_CRYPT_STEP : DEV_CRYPT_STEP;
+		t[i].sec_num = sec_num + (s64)i * DEV_CRYPT_STEP;
+		t[i].batch   = &batch;
+		if(i < n_task - 1)
+			pool_submit(ctx->crypto_pool, dev_crypt_worker, &t[i]);
+	}
+	
+	block_decrypt(ctx, t[n_task - 1].buf, t[n_task - 1].n_sec, t[n_task - 1].sec_num);
+	
+	EnterCriticalSection(&batch.lock);
+	while(batch.left > 0)
+		SleepConditionVariableCS(&batch.done, &batch.lock, INFINITE);
+	LeaveCriticalSection(&batch.lock);
+	
+	DeleteCriticalSection(&batch.lock);
+	free(t);
+}
+
+/***********************************************************************
+* Read decrypted sector/s from ps3 hdd/image.
+* 
+* ps3_context *ctx = ps3 device information
+* uint8_t *buf     = buffer to hold data
+* s64 n_sec        = count of sectors to read
+* s64 sec_num      = start sector number on hdd
+***********************************************************************/
+s64 block_read(ps3_context *ctx, u8 *buf, s64 n_sec, s64 sec_num)
+{
+	DWORD n_read;
+	
+	// check device handle
+	if(ctx->dev <= 0)
+		return -1;
+	
+	// preloaded volumes are served from memory
+	if(dev_ram_read(ctx, buf, n_sec, sec_num))
+		return n_sec * SECTOR_SIZE;
+	
+	// read data, only seek and read must be serialized
+	EnterCriticalSection(&ctx->io_lock);
+	seek_device(ctx->dev, sec_num * SECTOR_SIZE);
+	ReadFile(ctx->dev, buf, n_sec * SECTOR_SIZE, &n_read, 0);
+	LeaveCriticalSection(&ctx->io_lock);
+	
+	// big reads are split over the shared crypto workers, if there are
+	if(ctx->crypto_pool && n_sec >= 2 * DEV_CRYPT_STEP)
+		block_decrypt_shared(ctx, buf, n_sec, sec_num);
+	else
+		block_decrypt(ctx, buf, n_sec, sec_num);
   
 	return (s64)n_read;
 }
@@ -271,36 +810,42 @@ s64 block_write(ps3_context *ctx, u8 *buf, s64 n_sec, s64 sec_num)
 {
 	s64 i;
 	DWORD n_write;
+	u8 iv[0x10];
   	
 	// check device handle
 	if(ctx->dev <= 0)
 		return -1;
 	
+	// preloaded volumes get the data before it is encrypted
+	dev_ram_write(ctx, buf, n_sec, sec_num);
+	
 	// if data into VFLASH region, encrypt layer 2(VFLASH) first
 	if(ctx->vflash_start != 0)
 		for(i = 0; i < n_sec; i++)
 			if(((sec_num + i) >= ctx->vflash_start) && ((sec_num + i) <= (ctx->vflash_start + ctx->vflash_size)))
-			  aes_xts_crypt(&xts_enc_vf, sec_num + i, SECTOR_SIZE, buf + (SECTOR_SIZE * i), buf + (SECTOR_SIZE * i));
+			  aes_xts_crypt(&ctx->xts_enc_vf, sec_num + i, SECTOR_SIZE, buf + (SECTOR_SIZE * i), buf + (SECTOR_SIZE * i));
 	
 	// encrypt layer 1(ATA)
   switch(ctx->ps3_type) {
     case 1:  // FAT_NAND
 	  case 2:  // FAT_NOR
 	    for(i = 0; i < n_sec; i++) {
-		    aes_crypt_cbc(&cbc_enc, AES_ENCRYPT, SECTOR_SIZE, ctx->iv, buf + (SECTOR_SIZE * i), buf + (SECTOR_SIZE * i));
-		    memset(ctx->iv, 0, 16);
+		    memset(iv, 0, 16);
+		    aes_crypt_cbc(&ctx->cbc_enc, AES_ENCRYPT, SECTOR_SIZE, iv, buf + (SECTOR_SIZE * i), buf + (SECTOR_SIZE * i));
       }
 	    break;
 	  case 3:  // SLIM_NOR
 		  for(i = 0; i < n_sec; i++)
-		    aes_xts_crypt(&xts_enc, sec_num + i, SECTOR_SIZE, buf + (SECTOR_SIZE * i), buf + (SECTOR_SIZE * i));
+		    aes_xts_crypt(&ctx->xts_enc, sec_num + i, SECTOR_SIZE, buf + (SECTOR_SIZE * i), buf + (SECTOR_SIZE * i));
 		  break;
   }
 	
 	// byte swap data and write to HDD
 	_es16_buffer(buf, n_sec * SECTOR_SIZE);
+	EnterCriticalSection(&ctx->io_lock);
 	seek_device(ctx->dev, sec_num * SECTOR_SIZE);
 	WriteFile(ctx->dev, buf, n_sec * SECTOR_SIZE, &n_write, NULL);
+	LeaveCriticalSection(&ctx->io_lock);
 	
 	return (s64)n_write;
 }
@@ -357,58 +902,216 @@ s64 device_read(ps3_context *ctx, u8 *buf, u64 numbytes, s64 dev_off)
 }
 
 /***********************************************************************
-* Write encrypted data to ps3 hdd.
+* Write encrypted data to ps3 hdd. Only a partly written first or last
+* sector is read back, full sectors are written directly.
 * 
 * ps3_context *ctx = ps3 device information
-* uint8_t *buf     = buffer with data to encrypt and write
+* uint8_t *buf     = buffer with data to encrypt and write, full
+*                    sectors are encrypted in place
 * int64_t numbytes = write size in bytes(must not be sector aligned)
 * int64_t dev_off	 = byte offset on hdd(must not be sector aligned)
 ***********************************************************************/
 s64 device_write(ps3_context *ctx, u8 *buf, u64 numbytes, s64 dev_off)
 {
-	s64 r_sec = 0, r_byte = 0, remain = 0;
+	s64 n, n_sec, done = 0;
 	u8 tmp1[SECTOR_SIZE];
 	
 	u64 seq_nr    = dev_off / SECTOR_SIZE;
 	u64 byte_rest = dev_off % SECTOR_SIZE;
-	u64 sec_rest  = SECTOR_SIZE - byte_rest;
 	
-  block_read(ctx, tmp1, 1, seq_nr);
-  
-  if(numbytes <= sec_rest) {
-		memcpy(tmp1 + byte_rest, buf, numbytes);
+	if(numbytes == 0)
+		return 0;
+	
+	// partly written first sector
+	if(byte_rest || numbytes < SECTOR_SIZE) {
+		n = (numbytes < SECTOR_SIZE - byte_rest) ? numbytes : SECTOR_SIZE - byte_rest;
+		block_read(ctx, tmp1, 1, seq_nr);
+		memcpy(tmp1 + byte_rest, buf, n);
 		block_write(ctx, tmp1, 1, seq_nr);
-		return numbytes;
+		done += n;
+		seq_nr++;
 	}
-  
-	if(numbytes > sec_rest) {
-		memcpy(tmp1 + byte_rest, buf, sec_rest);
+	
+	// full sectors
+	if((n_sec = (numbytes - done) / SECTOR_SIZE) > 0) {
+		block_write(ctx, buf + done, n_sec, seq_nr);
+		done   += n_sec * SECTOR_SIZE;
+		seq_nr += n_sec;
+	}
+	
+	// partly written last sector
+	if(done < numbytes) {
+		block_read(ctx, tmp1, 1, seq_nr);
+		memcpy(tmp1, buf + done, numbytes - done);
 		block_write(ctx, tmp1, 1, seq_nr);
+	}
+	
+	return numbytes;
+}
+
+/***********************************************************************
+* Init a write buffer, it collects writes that follow each other on
+* hdd and hands them to device_write as one.
+* 
+* dev_writer *w    = writer
+* ps3_context *ctx = ps3 device information
+***********************************************************************/
+void dev_writer_init(dev_writer *w, ps3_context *ctx)
+{
+	w->ctx     = ctx;
+	w->buf     = malloc(DEV_WRITE_BUF_SIZE);
+	w->start   = 0;
+	w->len     = 0;
+	w->written = 0;
+	w->delta   = FALSE;
+	w->cmp     = NULL;
+	w->changed = 0;
+}
+
+/***********************************************************************
+* Write the buffered data to hdd.
+* 
+* dev_writer *w = writer
+***********************************************************************/
+void dev_writer_flush(dev_writer *w)
+{
+	if(w->len == 0)
+		return;
+	
+	device_write(w->ctx, w->buf, w->len, w->start);
+	w->written += w->len;
+	w->len = 0;
+}
+
+/***********************************************************************
+* Queue data to write, it is written when it does not follow the
+* buffered data or the buffer is full.
+* 
+* dev_writer *w   = writer
+* u8 *buf         = data
+* u64 numbytes    = byte count
+* s64 dev_off     = byte offset on hdd
+***********************************************************************/
+static void dev_writer_queue(dev_writer *w, u8 *buf, u64 numbytes, s64 dev_off)
+{
+	u64 n;
+	
+	while(numbytes) {
+		if(w->len && (w->start + w->len != dev_off || w->len == DEV_WRITE_BUF_SIZE))
+			dev_writer_flush(w);
+		if(w->len == 0)
+			w->start = dev_off;
 		
-		remain = numbytes - sec_rest;
+		n = DEV_WRITE_BUF_SIZE - w->len;
+		if(n > numbytes)
+			n = numbytes;
+		memcpy(w->buf + w->len, buf, n);
+		w->len   += n;
+		buf      += n;
+		dev_off  += n;
+		numbytes -= n;
+	}
+}
+
+/***********************************************************************
+* Count differing bytes of two buffers, 32 bytes per step with AVX2.
+* 
+* const u8 *a = first buffer
+* const u8 *b = second buffer
+* u64 n       = byte count
+***********************************************************************/
+__attribute__((target("avx2")))
+static u64 dev_count_diff_avx2(const u8 *a, const u8 *b, u64 n)
+{
+	u64 i, count = 0;
+	
+	for(i = 0; i + 32 <= n; i += 32)
+		count += 32 - __builtin_popcount((u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+		           _mm256_loadu_si256((const __m256i *)(a + i)), _mm256_loadu_si256((const __m256i *)(b + i)))));
+	
+	for(; i < n; i++)
+		if(a[i] != b[i])
+			count++;
+	
+	return count;
+}
+
+/***********************************************************************
+* Count differing bytes of two buffers.
+* 
+* const u8 *a = first buffer
+* const u8 *b = second buffer
+* u64 n       = byte count
+***********************************************************************/
+static u64 dev_count_diff(const u8 *a, const u8 *b, u64 n)
+{
+	u64 i, count = 0;
+	
+	if(__builtin_cpu_supports("avx2"))
+		return dev_count_diff_avx2(a, b, n);
+	
+	for(i = 0; i < n; i++)
+		if(a[i] != b[i])
+			count++;
+	
+	return count;
+}
+
+/***********************************************************************
+* Queue data to write. In delta mode the data on hdd is read first and
+* only the sectors that differ are queued, so unchanged runs are
+* neither encrypted nor written.
+* 
+* dev_writer *w   = writer
+* u8 *buf         = data
+* u64 numbytes    = byte count
+* s64 dev_off     = byte offset on hdd
+***********************************************************************/
+void dev_writer_write(dev_writer *w, u8 *buf, u64 numbytes, s64 dev_off)
+{
+	u64 n, off, len, diff;
+	
+	if(!w->delta) {
+		dev_writer_queue(w, buf, numbytes, dev_off);
+		return;
+	}
+	
+	if(w->cmp == NULL)
+		w->cmp = malloc(DEV_WRITE_BUF_SIZE);
+	
+	while(numbytes) {
+		n = (numbytes < DEV_WRITE_BUF_SIZE) ? numbytes : DEV_WRITE_BUF_SIZE;
+		device_read(w->ctx, w->cmp, n, dev_off);
 		
-		if((remain / SECTOR_SIZE) > 0) {
-			r_sec = remain / SECTOR_SIZE;
-			block_write(ctx, buf + sec_rest, r_sec, seq_nr + 1);
-			
-			if((numbytes - sec_rest - (r_sec * SECTOR_SIZE)) > 0) {
-				r_byte = numbytes - sec_rest - (r_sec * SECTOR_SIZE);
-				block_read(ctx, tmp1, 1, (seq_nr + 1 + r_sec));
-				memcpy(tmp1, buf + sec_rest + (r_sec * SECTOR_SIZE), r_byte);
-				block_write(ctx, tmp1, 1, (seq_nr + 1 + r_sec));
-				return numbytes;
+		// compare sector by sector, a partial sector at either end is compared as far as it goes
+		for(off = 0; off < n; off += len) {
+			len = SECTOR_SIZE - ((dev_off + off) % SECTOR_SIZE);
+			if(len > n - off)
+				len = n - off;
+			if((diff = dev_count_diff(buf + off, w->cmp + off, len)) != 0) {
+				dev_writer_queue(w, buf + off, len, dev_off + off);
+				w->changed += diff;
 			}
-			return numbytes;
 		}
 		
-		r_byte = numbytes - sec_rest;
-		block_read(ctx, tmp1, 1, (seq_nr + 1));
-		memcpy(tmp1, buf + sec_rest, r_byte);
-		block_write(ctx, tmp1, 1, (seq_nr + 1));
-		return numbytes;
+		buf      += n;
+		dev_off  += n;
+		numbytes -= n;
 	}
-	
-	return 0;
+}
+
+/***********************************************************************
+* Flush and free a write buffer.
+* 
+* dev_writer *w = writer
+***********************************************************************/
+void dev_writer_close(dev_writer *w)
+{
+	dev_writer_flush(w);
+	free(w->buf);
+	free(w->cmp);
+	w->buf = NULL;
+	w->cmp = NULL;
 }
 
 /***********************************************************************
@@ -445,3 +1148,79 @@ s32 get_partitions(ps3_context *ctx)
 	free(tmp);
 	return 0;
 }
+
+/***********************************************************************
+* Read dev_flash, dev_flash2 and dev_flash3 into memory. Each volume is
+* read in one sequential pass, the steps are decrypted by workers while
+* the next ones are read. Later reads of these volumes are served from
+* memory, writes go to the hdd and to memory.
+* 
+* ps3_context *ctx = ps3 device information
+* s32 threads      = decryption workers, 1 decrypts inline
+***********************************************************************/
+s32 device_preload_flash(ps3_context *ctx, s32 threads)
+{
+	s32 i;
+	s64 start, size, n, done;
+	DWORD n_read;
+	u8 *ram[3] = {NULL, NULL, NULL};
+	BOOL bad[3] = {FALSE, FALSE, FALSE};
+	thread_pool *pool = NULL;
+	dev_preload_task *t;
+	
+	if(threads > 1)
+		pool = pool_create(threads);
+	
+	for(i = 0; i < 3; i++) {
+		start = dev_ram_region(ctx, i, &size);
+		if(start == 0 || size <= 0 || ctx->flash_ram[i])
+			continue;
+		
+		if((ram[i] = malloc(size * SECTOR_SIZE)) == NULL) {
+			printf("not enough memory to preload VFLASH!\n");
+			continue;
+		}
+		
+		for(done = 0; done < size; done += n) {
+			n = (size - done < DEV_PRELOAD_CHUNK) ? size - done : DEV_PRELOAD_CHUNK;
+			
+			EnterCriticalSection(&ctx->io_lock);
+			seek_device(ctx->dev, (start + done) * SECTOR_SIZE);
+			if(!ReadFile(ctx->dev, ram[i] + done * SECTOR_SIZE, n * SECTOR_SIZE, &n_read, 0))
+				n_read = 0;
+			LeaveCriticalSection(&ctx->io_lock);
+			
+			// short read, the volume stays on the hdd
+			if(n_read != n * SECTOR_SIZE) {
+				printf("can't preload VFLASH, read error at sector 0x%llX!\n", (unsigned long long)(start + done));
+				bad[i] = TRUE;
+				break;
+			}
+			
+			t = malloc(sizeof(*t));
+			t->ctx     = ctx;
+			t->buf     = ram[i] + done * SECTOR_SIZE;
+			t->n_sec   = n;
+			t->sec_num = start + done;
+			if(pool)
+				pool_submit(pool, dev_preload_worker, t);
+			else
+				dev_preload_worker(t, 0);
+		}
+	}
+	
+	if(pool) {
+		pool_wait(pool);
+		pool_destroy(pool);
+	}
+	
+	// only fully read and decrypted volumes are served from memory
+	for(i = 0; i < 3; i++) {
+		if(bad[i])
+			free(ram[i]);
+		else if(ram[i])
+			ctx->flash_ram[i] = ram[i];
+	}
+	
+	return 0;
+}
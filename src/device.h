@@ -13,12 +13,56 @@
 #include "fs/fat.h"
 #include "fs/ufs.h"
 
+#define DEV_WRITE_BUF_SIZE 0x400000   // write coalescing buffer, 4 MiB
+#define DEV_PRELOAD_CHUNK  0x2000     // sectors read per preload step, 4 MiB
+#define DEV_CRYPT_STEP     0x100      // sectors per task of the shared crypto pool, 128 KiB
+#define DEV_PROBE_MAX      32         // drives and images probed at once
+#define DEV_PROBE_DRIVES   16         // PhysicalDrive1..15 are probed
+#define DEV_PROBE_MIN_SIZE 0x100000000LL // smaller drives are no ps3 hdd, 4 GiB
+#define DEV_TRIAL_SIZE     0x20       // bytes of sector 0 up to the partition table magic
+#define DEV_CACHE_MAX      256        // drives remembered in the key cache
 
+typedef struct _dev_writer_ {
+	ps3_context *ctx;       // ps3 device information
+	u8 *buf;                // data not written yet
+	s64 start;              // byte offset on hdd of buf
+	s64 len;                // bytes in buf
+	s64 written;            // bytes written so far
+	BOOL delta;             // write only sectors that differ from hdd
+	u8 *cmp;                // data read from hdd in delta mode
+	s64 changed;            // bytes that differed from hdd
+} dev_writer;
+
+typedef struct _dev_key_ {
+	u8 ata_k1[0x20];        // ATA key 1
+	u8 ata_k2[0x20];        // ATA key 2
+	u32 id;                 // CRC32C of the eid root key/iv, names the key in the cache
+	aes_context cbc_dec;    // layer 1(ATA) trial, aes-cbc-192
+	aes_xts_ctxt_t xts_dec; // layer 1(ATA) trial, aes-xts-128
+} dev_key;
+
+typedef struct _dev_probe_ {
+	char name[MAX_PATH];    // drive or image file
+	char serial[64];        // serial number of a drive, "" if none
+	s64 size;               // byte count of a drive, 0 if unknown
+	s32 key;                // index of the matching key, -1 if none
+	BOOL cached;            // key found through the cache
+} dev_probe;
+
+dev_key* device_keyring(u8 *keys, s32 n_keys);
+s32 device_probe(dev_key *ring, s32 n_keys, char *images[], s32 n_images, const char *cache, BOOL filter, dev_probe *probe);
+s32 open_device(ps3_context *ctx, const char *name);
 s32 get_device_handle(ps3_context *ctx, u8 mode);
+void close_device(ps3_context *ctx);
 s64 block_read(ps3_context *ctx, u8 *buf, s64 n_sec, s64 sec_num);
 s64 block_write(ps3_context *ctx, u8 *buf, s64 n_sec, s64 sec_num);
 s64 device_read(ps3_context *ctx, u8 *buf, u64 numbytes, s64 dev_off);
 s64 device_write(ps3_context *ctx, u8 *buf, u64 numbytes, s64 dev_off);
+void dev_writer_init(dev_writer *w, ps3_context *ctx);
+void dev_writer_write(dev_writer *w, u8 *buf, u64 numbytes, s64 dev_off);
+void dev_writer_flush(dev_writer *w);
+void dev_writer_close(dev_writer *w);
 s32 get_partitions(ps3_context *ctx);
+s32 device_preload_flash(ps3_context *ctx, s32 threads);
 
 #endif  // _DEVICE_H_
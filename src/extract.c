@@ -0,0 +1,1476 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <utime.h>
+#include <io.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#include "extract.h"
+#include "device.h"
+#include "hash.h"
+
+typedef struct _extract_task_ {
+	extract_job *job;
+	extract_file *file;
+} extract_task;
+
+typedef struct _extract_piece_ {
+	s64 dev_off;            // byte offset on hdd
+	s64 len;                // byte count, at most EXTRACT_BUF_SIZE
+	s64 file_off;           // byte offset in output file
+	u32 file;               // index into the plan
+} extract_piece;
+
+typedef struct _extract_open_ {
+	FILE *fd;               // open output file or NULL
+	u32 file;               // index into the plan
+	u64 used;               // last use, for LRU replacement
+} extract_open;
+
+typedef struct _tar_header_ {
+	char name[100];         // ustar header, numbers in octal
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+} tar_header;
+
+static volatile sig_atomic_t extract_stop = 0;   // Ctrl+C count
+static volatile sig_atomic_t extract_armed = 0;  // trap set, a stopped job sets it again
+
+
+
+/***********************************************************************
+* Set the end of an output file without writing anything up to it. On
+* a sparse file the range past the data stays a hole, _chsize_s would
+* write zeros over it. The file position is left at the new end.
+*
+* FILE *fd = output file
+* s64 size = size in bytes
+***********************************************************************/
+static s32 extract_set_end(FILE *fd, s64 size)
+{
+	HANDLE h;
+	LARGE_INTEGER pos;
+
+	fflush(fd);
+	h = (HANDLE)_get_osfhandle(_fileno(fd));
+	pos.QuadPart = size;
+	if(!SetFilePointerEx(h, pos, NULL, FILE_BEGIN) || !SetEndOfFile(h))
+		return -1;
+	return 0;
+}
+
+/***********************************************************************
+* Mark an output file sparse, so holes and a size set past the written
+* data take no space. Fails quietly on FAT, the zeros are stored then.
+*
+* FILE *fd = output file
+***********************************************************************/
+static void extract_set_sparse(FILE *fd)
+{
+	DWORD ret;
+
+	fflush(fd);
+	DeviceIoControl((HANDLE)_get_osfhandle(_fileno(fd)), FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &ret, NULL);
+}
+
+/***********************************************************************
+* Check if a file has holes.
+*
+* extract_file *f = file
+***********************************************************************/
+static BOOL extract_file_sparse(extract_file *f)
+{
+	u32 i;
+	s64 len = 0;
+
+	for(i = 0; i < f->n_ext; i++) {
+		if(f->ext[i].dev_off == EXTRACT_HOLE)
+			return TRUE;
+		len += f->ext[i].len;
+	}
+
+	return len < f->size;
+}
+
+/***********************************************************************
+* Create an output file. With a filter the folders are not made during
+* the walk, so the missing ones are made for the first file in them.
+* An old file is removed first, it may be a hardlink of a -dedup run and
+* writing through it would change the files linked to it.
+*
+* extract_job *job = extraction job
+* const char *dest = output file name
+***********************************************************************/
+static FILE* extract_create(extract_job *job, const char *dest)
+{
+	char tmp[MAX_PATH];
+	char *s;
+	FILE *fd;
+
+	DeleteFileA(dest);
+	if((fd = fopen(dest, "wb")) != NULL || job->filter == NULL)
+		return fd;
+
+	strncpy(tmp, dest, MAX_PATH - 1);
+	tmp[MAX_PATH - 1] = '\0';
+	for(s = strchr(tmp + 1, '/'); s; s = strchr(s + 1, '/')) {
+		*s = '\0';
+		mkdir(tmp, 0777);
+		*s = '/';
+	}
+
+	return fopen(dest, "wb");
+}
+
+/***********************************************************************
+* Add data to the hashes of a file.
+*
+* extract_job *job  = extraction job
+* sha256_context *c = SHA-256 of the file
+* u32 *crc          = CRC32C of the file
+* const u8 *buf     = data
+* s64 n             = byte count
+***********************************************************************/
+static void extract_hash(extract_job *job, sha256_context *c, u32 *crc, const u8 *buf, s64 n)
+{
+	sha256_update(c, buf, n);
+	if(job->crc)
+		*crc = crc32c_update(*crc, buf, n);
+}
+
+/***********************************************************************
+* Add zeros of a hole to the hashes of a file.
+*
+* extract_job *job  = extraction job
+* sha256_context *c = SHA-256 of the file
+* u32 *crc          = CRC32C of the file
+* u8 *buf           = copy buffer of EXTRACT_BUF_SIZE bytes
+* s64 len           = byte count
+***********************************************************************/
+static void extract_hash_hole(extract_job *job, sha256_context *c, u32 *crc, u8 *buf, s64 len)
+{
+	s64 n;
+
+	memset(buf, 0, (len < EXTRACT_BUF_SIZE) ? len : EXTRACT_BUF_SIZE);
+	for(; len; len -= n) {
+		n = (len < EXTRACT_BUF_SIZE) ? len : EXTRACT_BUF_SIZE;
+		extract_hash(job, c, crc, buf, n);
+	}
+}
+
+/***********************************************************************
+* Write the manifest line of a file, like sha256sum does, with the
+* CRC32C in front of the name if asked for.
+*
+* extract_job *job  = extraction job
+* extract_file *f   = file
+* const u8 *digest  = SHA-256 of the file
+* u32 crc           = CRC32C of the file
+***********************************************************************/
+static void extract_manifest_add(extract_job *job, extract_file *f, const u8 *digest, u32 crc)
+{
+	s32 i;
+	char hex[SHA256_SIZE * 2 + 1];
+
+	for(i = 0; i < SHA256_SIZE; i++)
+		sprintf(hex + i * 2, "%02x", digest[i]);
+
+	EnterCriticalSection(&job->lock);
+	if(job->crc)
+		fprintf(job->manifest, "%s %08x  %s\n", hex, crc, f->dest);
+	else
+		fprintf(job->manifest, "%s  %s\n", hex, f->dest);
+	LeaveCriticalSection(&job->lock);
+}
+
+/***********************************************************************
+* Write zeros to the tar stream.
+*
+* extract_job *job = extraction job
+* s64 len          = byte count
+***********************************************************************/
+static void extract_tar_zero(extract_job *job, s64 len)
+{
+	static const u8 zero[TAR_BLOCK * 8];
+	s64 n;
+
+	for(; len; len -= n) {
+		n = (len < (s64)sizeof(zero)) ? len : (s64)sizeof(zero);
+		fwrite(zero, 1, n, job->tar);
+	}
+}
+
+/***********************************************************************
+* Fill the last tar block of an entry with zeros.
+*
+* extract_job *job = extraction job
+* s64 size         = data size of the entry
+***********************************************************************/
+static void extract_tar_pad(extract_job *job, s64 size)
+{
+	if(size % TAR_BLOCK)
+		extract_tar_zero(job, TAR_BLOCK - size % TAR_BLOCK);
+}
+
+/***********************************************************************
+* Append a pax record "<len> key=value\n", len counts itself.
+*
+* char *pax         = records, at least TAR_PAX_MAX bytes
+* const char *key   = keyword
+* const char *value = value
+***********************************************************************/
+static void extract_tar_pax(char *pax, const char *key, const char *value)
+{
+	s32 n = strlen(key) + strlen(value) + 3, len = n + 1;
+
+	while(len != n + (s32)snprintf(NULL, 0, "%d", len))
+		len = n + snprintf(NULL, 0, "%d", len);
+
+	if(strlen(pax) + len < TAR_PAX_MAX)
+		sprintf(pax + strlen(pax), "%d %s=%s\n", len, key, value);
+}
+
+/***********************************************************************
+* Write a ustar header. Names or link targets longer than the header
+* fields and sizes of 8 GiB and more go into a pax header before it.
+*
+* extract_job *job = extraction job
+* const char *name = entry name, a leading "./" is dropped
+* char type        = TAR_FILE, TAR_SYMLINK or TAR_DIR
+* u32 mode         = permission bits
+* s64 size         = data size
+* time_t mtime     = last modified time
+* const char *link = symlink target or NULL
+***********************************************************************/
+static void extract_tar_header(extract_job *job, const char *name, char type, u32 mode, s64 size, time_t mtime, const char *link)
+{
+	u32 i, sum = 0;
+	char path[MAX_PATH + 2], pax[TAR_PAX_MAX], num[32];
+	tar_header h;
+
+	while(name[0] == '.' && name[1] == '/')
+		name += 2;
+	strcpy(path, name);
+	if(type == TAR_DIR)
+		strcat(path, "/");
+
+	pax[0] = '\0';
+	if(strlen(path) > sizeof(h.name))
+		extract_tar_pax(pax, "path", path);
+	if(link && strlen(link) > sizeof(h.linkname))
+		extract_tar_pax(pax, "linkpath", link);
+	if(size > TAR_SIZE_MAX) {
+		sprintf(num, "%lld", size);
+		extract_tar_pax(pax, "size", num);
+	}
+	if(pax[0]) {
+		extract_tar_header(job, "PaxHeader", TAR_PAX, 0644, strlen(pax), mtime, NULL);
+		fwrite(pax, 1, strlen(pax), job->tar);
+		extract_tar_pad(job, strlen(pax));
+	}
+
+	memset(&h, 0, sizeof(h));
+	strncpy(h.name, path, sizeof(h.name));
+	if(link)
+		strncpy(h.linkname, link, sizeof(h.linkname));
+	sprintf(h.mode,  "%07o", mode & 07777);
+	sprintf(h.uid,   "%07o", 0);
+	sprintf(h.gid,   "%07o", 0);
+	sprintf(num,     "%011llo", (u64)((size > TAR_SIZE_MAX) ? 0 : size));
+	memcpy(h.size, num, sizeof(h.size));
+	sprintf(num,     "%011llo", (u64)mtime);
+	memcpy(h.mtime, num, sizeof(h.mtime));
+	h.typeflag = type;
+	memcpy(h.magic, "ustar", 6);
+	memcpy(h.version, "00", 2);
+
+	// the checksum is taken with its own field as spaces
+	memset(h.chksum, ' ', sizeof(h.chksum));
+	for(i = 0; i < sizeof(h); i++)
+		sum += ((u8*)&h)[i];
+	sprintf(h.chksum, "%06o", sum);
+
+	fwrite(&h, 1, sizeof(h), job->tar);
+}
+
+/***********************************************************************
+* Read all data of a file in order from a byte offset on, write it to
+* fd and hash it if given. Holes are seeked over, written out in a tar
+* stream and hashed as zeros. With a journal the offset reached is
+* noted every EXTRACT_JOURNAL_STEP bytes, an interrupt stops the copy
+* after the buffer in work.
+*
+* extract_job *job  = extraction job
+* extract_file *f   = file
+* u8 *buf           = copy buffer of EXTRACT_BUF_SIZE bytes
+* FILE *fd          = output file at offset from, or NULL
+* sha256_context *c = SHA-256 of the file or NULL, from must be 0
+* u32 *crc          = CRC32C of the file
+* s64 from          = byte offset to start at
+* BOOL progress     = print percentage of this file
+***********************************************************************/
+static s64 extract_stream(extract_job *job, extract_file *f, u8 *buf, FILE *fd, sha256_context *c, u32 *crc, s64 from, BOOL progress)
+{
+	u32 i;
+	s64 n, off, len, done = 0, mark = from;
+
+	for(i = 0; i < f->n_ext && !extract_job_stopped(job); i++) {
+		// data before the resume point is already written
+		off = (from > done) ? from - done : 0;
+		if(off >= f->ext[i].len) {
+			done += f->ext[i].len;
+			continue;
+		}
+		done += off;
+
+		// holes are skipped, not read and not written
+		if(f->ext[i].dev_off == EXTRACT_HOLE) {
+			len = f->ext[i].len - off;
+			if(c)
+				extract_hash_hole(job, c, crc, buf, len);
+			if(fd && fd == job->tar) {
+				extract_tar_zero(job, len);
+			}
+			else if(fd) {
+				fflush(fd);
+				_fseeki64(fd, len, SEEK_CUR);
+			}
+			done += len;
+			continue;
+		}
+
+		for(; off < f->ext[i].len && !extract_job_stopped(job); off += n) {
+			n = f->ext[i].len - off;
+			if(n > EXTRACT_BUF_SIZE)
+				n = EXTRACT_BUF_SIZE;
+
+			device_read(job->ctx, buf, n, f->ext[i].dev_off + off);
+			if(c)
+				extract_hash(job, c, crc, buf, n);
+			if(fd)
+				fwrite(buf, 1, n, fd);
+			done += n;
+
+			if(job->journal && fd && fd != job->tar && done - mark >= EXTRACT_JOURNAL_STEP) {
+				fflush(fd);
+				extract_journal_mark(job, f->dest, done, FALSE);
+				mark = done;
+			}
+
+			if(progress)
+				fprintf(stderr,"(%03lld%%)\r", done * 100 / f->size);
+		}
+	}
+
+	if(c && done < f->size && !extract_job_stopped(job))
+		extract_hash_hole(job, c, crc, buf, f->size - done);
+
+	return done;
+}
+
+/***********************************************************************
+* CRC32C of the first EXTRACT_DUP_HEAD bytes of a file, the cheap part
+* of the duplicate check.
+*
+* extract_job *job  = extraction job
+* extract_file *f   = file
+* u8 *buf           = copy buffer of EXTRACT_BUF_SIZE bytes
+***********************************************************************/
+static u32 extract_dup_head(extract_job *job, extract_file *f, u8 *buf)
+{
+	u32 i;
+	s64 n, len = 0;
+
+	for(i = 0; i < f->n_ext && len < EXTRACT_DUP_HEAD; i++) {
+		n = f->ext[i].len;
+		if(n > EXTRACT_DUP_HEAD - len)
+			n = EXTRACT_DUP_HEAD - len;
+		if(f->ext[i].dev_off == EXTRACT_HOLE)
+			memset(buf + len, 0, n);
+		else
+			device_read(job->ctx, buf + len, n, f->ext[i].dev_off);
+		len += n;
+	}
+
+	return crc32c_update(0, buf, len);
+}
+
+/***********************************************************************
+* Register a file for the duplicate check before it is written. An
+* identical file copied at the same time waits for it when done, and
+* then becomes a link to it.
+*
+* extract_job *job  = extraction job
+* extract_file *f   = file to copy
+* u32 head          = CRC32C of the head
+***********************************************************************/
+static extract_dup* extract_dup_add(extract_job *job, extract_file *f, u32 head)
+{
+	extract_dup *d = malloc(sizeof(*d));
+	u32 bucket = (f->size ^ head) % EXTRACT_DUP_BUCKETS;
+
+	memset(d, 0, sizeof(*d));
+	d->size = f->size;
+	d->head = head;
+	d->dest = strdup(f->dest);
+	d->busy = TRUE;
+
+	EnterCriticalSection(&job->lock);
+	d->seq  = job->dup_seq++;
+	d->next = job->dup[bucket];
+	job->dup[bucket] = d;
+	LeaveCriticalSection(&job->lock);
+
+	return d;
+}
+
+/***********************************************************************
+* Note the SHA-256 of a written file and replace the file by a hardlink
+* to an older one with the same content. The file is hashed while it
+* is copied, so it is read once. Older files with the same size and
+* head still being written are waited for, they never wait for newer
+* ones. The link is made under a temporary name and moved over the
+* copy, a link that fails, e.g. on FAT, leaves the copy as it is.
+*
+* extract_job *job  = extraction job
+* extract_file *f   = written file
+* extract_dup *d    = its entry
+* const u8 *digest  = SHA-256 of the file, NULL if it was not written
+*
+* return: TRUE if the file is a link now
+***********************************************************************/
+static BOOL extract_dup_link(extract_job *job, extract_file *f, extract_dup *d, const u8 *digest)
+{
+	char tmp[MAX_PATH + 8];
+	char *link = NULL;
+	extract_dup *o;
+	BOOL wait = TRUE, ret = FALSE;
+
+	EnterCriticalSection(&job->lock);
+	d->busy = FALSE;
+	d->bad  = (digest == NULL);
+	if(digest)
+		memcpy(d->sha, digest, SHA256_SIZE);
+	WakeAllConditionVariable(&job->dup_ready);
+
+	while(digest && wait && link == NULL) {
+		wait = FALSE;
+		for(o = job->dup[(d->size ^ d->head) % EXTRACT_DUP_BUCKETS]; o && link == NULL; o = o->next) {
+			if(o->seq >= d->seq || o->bad || o->size != d->size || o->head != d->head)
+				continue;
+			if(o->busy)
+				wait = TRUE;
+			else if(memcmp(o->sha, d->sha, SHA256_SIZE) == 0)
+				link = strdup(o->dest);
+		}
+		if(wait && link == NULL)
+			SleepConditionVariableCS(&job->dup_ready, &job->lock, INFINITE);
+	}
+	LeaveCriticalSection(&job->lock);
+
+	if(link == NULL)
+		return FALSE;
+
+	sprintf(tmp, "%s.lnk~", f->dest);
+	DeleteFileA(tmp);
+	if(CreateHardLinkA(tmp, link, NULL)) {
+		if(MoveFileExA(tmp, f->dest, MOVEFILE_REPLACE_EXISTING))
+			ret = TRUE;
+		else
+			DeleteFileA(tmp);
+	}
+
+	if(ret) {
+		EnterCriticalSection(&job->lock);
+		job->dup_files++;
+		job->dup_saved += f->size;
+		LeaveCriticalSection(&job->lock);
+	}
+
+	free(link);
+	return ret;
+}
+
+/***********************************************************************
+* Sort function for state entries, by path on the volume.
+***********************************************************************/
+static s32 extract_sort_state(const void *first, const void *second)
+{
+	return strcmp(((const extract_state *)first)->src, ((const extract_state *)second)->src);
+}
+
+/***********************************************************************
+* Free state entries.
+*
+* extract_state *st = entries
+* u32 count         = entry count
+***********************************************************************/
+static void extract_state_free(extract_state *st, u32 count)
+{
+	u32 i;
+
+	for(i = 0; i < count; i++) {
+		free(st[i].src);
+		free(st[i].dest);
+	}
+	free(st);
+}
+
+/***********************************************************************
+* Write the state of this run, remove files of the last run that are
+* gone from the volume if asked for.
+*
+* extract_job *job = extraction job
+***********************************************************************/
+static void extract_state_save(extract_job *job)
+{
+	u32 i;
+	s64 removed = 0;
+	FILE *fd;
+	extract_state *e;
+
+	// after a stop the files of this run are not all copied, the old state stays
+	if(extract_job_stopped(job)) {
+		printf("copy stopped, state file \"%s\" not updated\n", job->state_file);
+	}
+	else if((fd = fopen(job->state_file, "w")) == NULL) {
+		printf("can't create file! \"%s\"\n", job->state_file);
+	}
+	else {
+		for(i = 0; i < job->n_state; i++) {
+			e = &job->state[i];
+			fprintf(fd, "%llu %llu %lld %lld\t%s\t%s\n", e->id, e->gen, e->size, (s64)e->mtime, e->src, e->dest);
+		}
+		fclose(fd);
+	}
+
+	// only files, emptied folders stay
+	if(job->prune && !job->tar && !job->hash_only && !extract_job_stopped(job))
+		for(i = 0; i < job->n_old; i++)
+			if(!job->old[i].seen && remove(job->old[i].dest) == 0)
+				removed++;
+
+	printf("%lld unchanged files skipped, %lld removed\n", job->skipped, removed);
+
+	extract_state_free(job->old, job->n_old);
+	extract_state_free(job->state, job->n_state);
+	free(job->state_file);
+	job->old = job->state = NULL;
+	job->n_old = job->n_state = job->max_state = 0;
+	job->state_file = NULL;
+}
+
+/***********************************************************************
+* Copy one file from hdd to its destination. With a manifest the data
+* is hashed on the way, hash_only skips the output file. With dedup a
+* file identical to one written before is replaced by a hardlink to it
+* once copied. In a tar stream the file is appended as an entry instead.
+*
+* extract_job *job  = extraction job
+* extract_file *f   = file to copy
+* u8 *buf           = copy buffer of EXTRACT_BUF_SIZE bytes
+* BOOL progress     = print percentage of this file
+***********************************************************************/
+static s32 extract_copy_file(extract_job *job, extract_file *f, u8 *buf, BOOL progress)
+{
+	s64 done, from = 0;
+	BOOL sparse = extract_file_sparse(f);
+	BOOL dedup = job->dup && !job->hash_only && !job->tar && f->size > 0;
+	BOOL complete;
+	FILE *fd = NULL;
+	sha256_context sha;
+	u8 digest[SHA256_SIZE];
+	u32 crc = 0;
+	extract_dup *d = NULL;
+	struct utimbuf filetime;
+
+	if(extract_job_stopped(job))
+		return -1;
+
+	// a file stopped halfway goes on where it was, unless it must be hashed in full
+	if(job->n_resume && !job->manifest && !dedup && !job->tar && !job->hash_only)
+		from = extract_journal_resume(job, f->dest, &complete);
+
+	// registered before the copy, so an identical file in flight waits for this one
+	if(dedup)
+		d = extract_dup_add(job, f, extract_dup_head(job, f, buf));
+
+	if(job->tar) {
+		fd = job->tar;
+		extract_tar_header(job, f->dest, TAR_FILE, f->mode, f->size, f->mtime, NULL);
+	}
+	else if(!job->hash_only) {
+		if(from && (fd = fopen(f->dest, "r+b")) != NULL) {
+			_fseeki64(fd, from, SEEK_SET);
+		}
+		else {
+			from = 0;
+			fd = extract_create(job, f->dest);
+		}
+		if(!fd) {
+			printf("can't create file! \"%s\"\n", f->dest);
+			if(d)
+				extract_dup_link(job, f, d, NULL);
+			return -1;
+		}
+		if(sparse)
+			extract_set_sparse(fd);
+	}
+
+	if(job->manifest || dedup)
+		sha256_init(&sha);
+
+	done = extract_stream(job, f, buf, fd, (job->manifest || dedup) ? &sha : NULL, &crc, from, progress);
+
+	// interrupted, note how far the file got
+	if(done < f->size && extract_job_stopped(job) && fd && fd != job->tar) {
+		fclose(fd);
+		if(job->journal)
+			extract_journal_mark(job, f->dest, done, FALSE);
+		if(d)
+			extract_dup_link(job, f, d, NULL);
+		return -1;
+	}
+
+	if(job->manifest || dedup)
+		sha256_final(&sha, digest);
+	if(job->manifest)
+		extract_manifest_add(job, f, digest, crc);
+
+	if(fd && fd == job->tar) {
+		extract_tar_zero(job, f->size - done);
+		extract_tar_pad(job, f->size);
+	}
+	else if(fd) {
+		// a hole at the end leaves nothing written to give the size
+		if(sparse)
+			extract_set_end(fd, f->size);
+
+		fclose(fd);
+
+		// a link keeps the times of the file it points to
+		if(d == NULL || !extract_dup_link(job, f, d, digest)) {
+			filetime.actime  = f->atime;
+			filetime.modtime = f->mtime;
+			utime(f->dest, &filetime);
+		}
+
+		if(job->journal)
+			extract_journal_mark(job, f->dest, f->size, TRUE);
+	}
+
+	EnterCriticalSection(&job->lock);
+	job->files_done++;
+	job->bytes_done += done - from;
+	LeaveCriticalSection(&job->lock);
+
+	return 0;
+}
+
+/***********************************************************************
+* Sort function for planned pieces, ascending hdd offset.
+***********************************************************************/
+static s32 extract_sort_piece(const void *first, const void *second)
+{
+	const extract_piece *a = first;
+	const extract_piece *b = second;
+
+	if(a->dev_off < b->dev_off)
+		return -1;
+	if(a->dev_off > b->dev_off)
+		return 1;
+	return 0;
+}
+
+/***********************************************************************
+* Get an output file of the plan, keep the last used ones open.
+*
+* extract_job *job  = extraction job
+* extract_open *op  = open file cache of EXTRACT_PLAN_OPEN entries
+* u32 file          = index into the plan
+* u64 tick          = use counter
+***********************************************************************/
+static FILE* extract_plan_open(extract_job *job, extract_open *op, u32 file, u64 tick)
+{
+	u32 i, lru = 0;
+
+	for(i = 0; i < EXTRACT_PLAN_OPEN; i++) {
+		if(op[i].fd && op[i].file == file) {
+			op[i].used = tick;
+			return op[i].fd;
+		}
+	}
+
+	for(i = 0; i < EXTRACT_PLAN_OPEN && op[lru].fd; i++)
+		if(op[i].fd == NULL || op[i].used < op[lru].used)
+			lru = i;
+
+	if(op[lru].fd)
+		fclose(op[lru].fd);
+
+	op[lru].fd   = fopen(job->plan[file]->dest, "r+b");
+	op[lru].file = file;
+	op[lru].used = tick;
+
+	return op[lru].fd;
+}
+
+/***********************************************************************
+* Copy all collected files. The output files are created with their
+* final size first, then the data of all files is read in ascending
+* LBA order and written to wherever it belongs. Reads of pieces that
+* follow each other on hdd are merged up to EXTRACT_BUF_SIZE.
+*
+* extract_job *job = extraction job
+***********************************************************************/
+static void extract_run_plan(extract_job *job)
+{
+	u32 i, j, k, n_piece = 0, max_piece = 0;
+	s64 off, n, file_off, total = 0, done = 0;
+	u8 *buf = job->buf[0];
+	BOOL *ok;
+	FILE *fd;
+	extract_file *f;
+	extract_piece *piece = NULL;
+	extract_open op[EXTRACT_PLAN_OPEN];
+	struct utimbuf filetime;
+
+	ok = malloc(job->n_plan * sizeof(*ok));
+
+	// size output files, nothing written yet, and cut their extents into pieces
+	for(i = 0; i < job->n_plan; i++) {
+		f = job->plan[i];
+		ok[i] = FALSE;
+
+		if((fd = extract_create(job, f->dest)) == NULL) {
+			printf("can't create file! \"%s\"\n", f->dest);
+			continue;
+		}
+		if(extract_file_sparse(f))
+			extract_set_sparse(fd);
+		extract_set_end(fd, f->size);
+		fclose(fd);
+		ok[i] = TRUE;
+
+		for(j = 0, file_off = 0; j < f->n_ext; j++) {
+			// holes cost nothing, the file is already sized
+			if(f->ext[j].dev_off == EXTRACT_HOLE) {
+				file_off += f->ext[j].len;
+				continue;
+			}
+
+			for(off = 0; off < f->ext[j].len; off += n) {
+				n = f->ext[j].len - off;
+				if(n > EXTRACT_BUF_SIZE)
+					n = EXTRACT_BUF_SIZE;
+
+				if(n_piece == max_piece) {
+					max_piece = max_piece ? max_piece * 2 : 1024;
+					piece = realloc(piece, max_piece * sizeof(*piece));
+				}
+				piece[n_piece].dev_off  = f->ext[j].dev_off + off;
+				piece[n_piece].len      = n;
+				piece[n_piece].file_off = file_off;
+				piece[n_piece].file     = i;
+				n_piece++;
+
+				file_off += n;
+				total += n;
+			}
+		}
+	}
+
+	qsort(piece, n_piece, sizeof(*piece), extract_sort_piece);
+	memset(op, 0, sizeof(op));
+
+	for(i = 0; i < n_piece && !extract_job_stopped(job); i = j) {
+		// merge pieces that follow each other on hdd into one read
+		n = piece[i].len;
+		for(j = i + 1; j < n_piece; j++) {
+			if(piece[j].dev_off != piece[j - 1].dev_off + piece[j - 1].len || n + piece[j].len > EXTRACT_BUF_SIZE)
+				break;
+			n += piece[j].len;
+		}
+
+		device_read(job->ctx, buf, n, piece[i].dev_off);
+
+		for(k = i, off = 0; k < j; off += piece[k].len, k++) {
+			if((fd = extract_plan_open(job, op, piece[k].file, k)) == NULL)
+				continue;
+			_fseeki64(fd, piece[k].file_off, SEEK_SET);
+			fwrite(buf + off, 1, piece[k].len, fd);
+		}
+
+		done += n;
+		fprintf(stderr,"(%03lld%%)\r", done * 100 / total);
+	}
+
+	for(i = 0; i < EXTRACT_PLAN_OPEN; i++)
+		if(op[i].fd)
+			fclose(op[i].fd);
+
+	// set times after the last write
+	for(i = 0; i < job->n_plan; i++) {
+		f = job->plan[i];
+		// after a stop no file is known to be complete
+		if(ok[i] && !extract_job_stopped(job)) {
+			filetime.actime  = f->atime;
+			filetime.modtime = f->mtime;
+			utime(f->dest, &filetime);
+			job->files_done++;
+			job->bytes_done += f->size;
+			if(job->journal)
+				extract_journal_mark(job, f->dest, f->size, TRUE);
+		}
+		extract_file_free(f);
+	}
+
+	free(piece);
+	free(ok);
+	free(job->plan);
+	job->plan = NULL;
+	job->n_plan = job->max_plan = 0;
+}
+
+/***********************************************************************
+* Signal handler, ask running copies to stop. A second Ctrl+C ends the
+* program at once.
+***********************************************************************/
+static void extract_interrupt(s32 sig)
+{
+	extract_stop++;
+	signal(SIGINT, SIG_DFL);
+}
+
+/***********************************************************************
+* Compare journal entries by name only.
+***********************************************************************/
+static s32 extract_sort_name(const void *first, const void *second)
+{
+	return strcmp(((const extract_mark *)first)->name, ((const extract_mark *)second)->name);
+}
+
+/***********************************************************************
+* Sort function for journal entries, by name and line.
+***********************************************************************/
+static s32 extract_sort_mark(const void *first, const void *second)
+{
+	const extract_mark *a = first;
+	const extract_mark *b = second;
+	s32 ret = strcmp(a->name, b->name);
+
+	if(ret)
+		return ret;
+	return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+/***********************************************************************
+* Close the journal. A job that ran to the end needs no resume, its
+* journal is removed.
+*
+* extract_job *job = extraction job
+***********************************************************************/
+static void extract_journal_close(extract_job *job)
+{
+	u32 i;
+
+	fclose(job->journal);
+	job->journal = NULL;
+
+	if(extract_job_stopped(job))
+		printf("copy stopped, continue with -journal %s -resume\n", job->journal_file);
+	else
+		remove(job->journal_file);
+
+	for(i = 0; i < job->n_resume; i++)
+		free(job->resume[i].name);
+	free(job->resume);
+	free(job->journal_file);
+	job->resume = NULL;
+	job->n_resume = 0;
+	job->journal_file = NULL;
+}
+
+/***********************************************************************
+* Pool task, copy a file with the buffer of the running worker.
+***********************************************************************/
+static void extract_worker(void *arg, s32 worker)
+{
+	extract_task *t = arg;
+	extract_job *job = t->job;
+
+	extract_copy_file(job, t->file, job->buf[worker], FALSE);
+
+	EnterCriticalSection(&job->lock);
+	job->inflight -= t->file->size;
+	WakeAllConditionVariable(&job->room);
+	LeaveCriticalSection(&job->lock);
+
+	extract_file_free(t->file);
+	free(t);
+}
+
+/***********************************************************************
+* Start worker threads and allocate one copy buffer per worker.
+*
+* extract_job *job = extraction job
+***********************************************************************/
+static s32 extract_job_start(extract_job *job)
+{
+	s32 i, n = 1;
+
+	// the planner writes pieces out of file order, they can't be hashed on the way
+	if(job->manifest || job->dedup || job->tar)
+		job->lba_order = FALSE;
+
+	if(job->dedup && !job->hash_only)
+		job->dup = calloc(EXTRACT_DUP_BUCKETS, sizeof(*job->dup));
+
+	// the planner reads on one thread, ordered, a tar stream is written in order
+	if(job->threads > 1 && !job->lba_order && !job->tar) {
+		if((job->pool = pool_create(job->threads)) == NULL)
+			printf("can't start workers, copy inline!\n");
+		else
+			n = job->pool->n_workers;
+	}
+
+	job->buf = malloc(n * sizeof(*job->buf));
+	for(i = 0; i < n; i++)
+		job->buf[i] = malloc(EXTRACT_BUF_SIZE);
+
+	return 0;
+}
+
+/***********************************************************************
+* Init an extraction job with defaults.
+*
+* extract_job *job = job to init
+* ps3_context *ctx = ps3 device information
+***********************************************************************/
+void extract_job_init(extract_job *job, ps3_context *ctx)
+{
+	memset(job, 0, sizeof(*job));
+	job->ctx = ctx;
+	job->threads = pool_cpu_count();
+	if(job->threads > EXTRACT_MAX_THREADS)
+		job->threads = EXTRACT_MAX_THREADS;
+	job->max_inflight = EXTRACT_MAX_INFLIGHT;
+	job->stop_base = extract_stop;
+	InitializeCriticalSection(&job->lock);
+	InitializeConditionVariable(&job->room);
+	InitializeConditionVariable(&job->dup_ready);
+}
+
+/***********************************************************************
+* Wait for all submitted files, stop workers and free buffers.
+*
+* extract_job *job = extraction job
+***********************************************************************/
+void extract_job_finish(extract_job *job)
+{
+	s32 i, n = 1;
+	extract_dup *d;
+
+	if(job->buf) {
+		if(job->n_plan)
+			extract_run_plan(job);
+
+		if(job->pool) {
+			pool_wait(job->pool);
+			n = job->pool->n_workers;
+			pool_destroy(job->pool);
+			job->pool = NULL;
+		}
+
+		for(i = 0; i < n; i++)
+			free(job->buf[i]);
+		free(job->buf);
+		job->buf = NULL;
+	}
+
+	// two zero blocks end the archive
+	if(job->tar) {
+		extract_tar_zero(job, TAR_BLOCK * 2);
+		fflush(job->tar);
+	}
+
+	if(job->dup) {
+		printf("%lld duplicate files linked, %lld bytes saved\n", job->dup_files, job->dup_saved);
+		for(i = 0; i < EXTRACT_DUP_BUCKETS; i++) {
+			while((d = job->dup[i]) != NULL) {
+				job->dup[i] = d->next;
+				free(d->dest);
+				free(d);
+			}
+		}
+		free(job->dup);
+		job->dup = NULL;
+	}
+
+	if(job->state_file)
+		extract_state_save(job);
+
+	if(job->journal)
+		extract_journal_close(job);
+
+	// a Ctrl+C ends the program only while the jobs stop, the next one is trapped again
+	if(extract_job_stopped(job) && extract_armed)
+		signal(SIGINT, extract_interrupt);
+}
+
+/***********************************************************************
+* Create a file to extract.
+*
+* const char *dest = output file name
+* s64 size         = file size in bytes
+* time_t atime     = last access time
+* time_t mtime     = last modified time
+***********************************************************************/
+extract_file* extract_file_new(const char *dest, s64 size, time_t atime, time_t mtime)
+{
+	extract_file *f = malloc(sizeof(*f));
+
+	f->dest    = strdup(dest);
+	f->size    = size;
+	f->atime   = atime;
+	f->mtime   = mtime;
+	f->mode    = 0644;
+	f->n_ext   = 0;
+	f->max_ext = 8;
+	f->ext     = malloc(f->max_ext * sizeof(*f->ext));
+
+	return f;
+}
+
+/***********************************************************************
+* Append data to a file, merge with the last extent if contiguous.
+*
+* extract_file *f = file
+* s64 dev_off     = byte offset on hdd or EXTRACT_HOLE
+* s64 len         = byte count
+***********************************************************************/
+void extract_file_add(extract_file *f, s64 dev_off, s64 len)
+{
+	extract_extent *e;
+
+	if(f->n_ext) {
+		e = &f->ext[f->n_ext - 1];
+		if(dev_off == EXTRACT_HOLE ? e->dev_off == EXTRACT_HOLE : 
+		   (e->dev_off != EXTRACT_HOLE && e->dev_off + e->len == dev_off)) {
+			e->len += len;
+			return;
+		}
+	}
+
+	if(f->n_ext == f->max_ext) {
+		f->max_ext *= 2;
+		f->ext = realloc(f->ext, f->max_ext * sizeof(*f->ext));
+	}
+
+	f->ext[f->n_ext].dev_off = dev_off;
+	f->ext[f->n_ext].len     = len;
+	f->n_ext++;
+}
+
+/***********************************************************************
+* Free a file to extract.
+*
+* extract_file *f = file
+***********************************************************************/
+void extract_file_free(extract_file *f)
+{
+	free(f->dest);
+	free(f->ext);
+	free(f);
+}
+
+/***********************************************************************
+* Read part of a file by its extents, holes read as zeros.
+*
+* ps3_context *ctx = ps3 device information
+* extract_file *f  = file
+* u8 *buf          = receives the data
+* s64 offset       = byte offset in the file
+* s64 len          = byte count
+*
+* return: bytes read, less at the end of the file
+***********************************************************************/
+s64 extract_file_read(ps3_context *ctx, extract_file *f, u8 *buf, s64 offset, s64 len)
+{
+	u32 i;
+	s64 pos, skip, n, done = 0;
+
+	if(offset < 0 || offset >= f->size)
+		return 0;
+	if(len > f->size - offset)
+		len = f->size - offset;
+
+	for(i = 0, pos = 0; i < f->n_ext && done < len; pos += f->ext[i].len, i++) {
+		if(pos + f->ext[i].len <= offset + done)
+			continue;
+
+		skip = offset + done - pos;
+		n = f->ext[i].len - skip;
+		if(n > len - done)
+			n = len - done;
+
+		if(f->ext[i].dev_off == EXTRACT_HOLE)
+			memset(buf + done, 0, n);
+		else
+			device_read(ctx, buf + done, n, f->ext[i].dev_off + skip);
+		done += n;
+	}
+
+	return done;
+}
+
+/***********************************************************************
+* Write all output of the job as a tar stream to out, in the order the
+* files are submitted, instead of creating files.
+*
+* extract_job *job = extraction job
+* FILE *out        = tar stream, stdout or a file
+***********************************************************************/
+void extract_tar_open(extract_job *job, FILE *out)
+{
+	_setmode(_fileno(out), _O_BINARY);
+	setvbuf(out, NULL, _IOFBF, EXTRACT_TAR_BUF);
+	job->tar = out;
+}
+
+/***********************************************************************
+* Add a folder or symlink entry to the tar stream.
+*
+* extract_job *job = extraction job
+* const char *name = entry name
+* char type        = TAR_DIR or TAR_SYMLINK
+* u32 mode         = permission bits
+* time_t mtime     = last modified time
+* const char *link = symlink target or NULL
+***********************************************************************/
+void extract_tar_entry(extract_job *job, const char *name, char type, u32 mode, time_t mtime, const char *link)
+{
+	extract_tar_header(job, name, type, mode, 0, mtime, link);
+}
+
+/***********************************************************************
+* Load the state file of the last run for an incremental copy. A
+* missing file is a first run, everything is copied. The file is
+* rewritten with the state of this run when the job finishes.
+*
+* extract_job *job  = extraction job
+* const char *file  = state file
+* BOOL prune        = remove files gone from the volume since the last run
+***********************************************************************/
+s32 extract_state_load(extract_job *job, const char *file, BOOL prune)
+{
+	char line[MAX_PATH * 2 + 128];
+	char *src, *dest;
+	u32 max = 0;
+	s64 mtime;
+	FILE *fd;
+	extract_state *e;
+
+	job->state_file = strdup(file);
+	job->prune = prune;
+
+	if((fd = fopen(file, "r")) == NULL)
+		return 0;
+
+	while(fgets(line, sizeof(line), fd)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if((src = strchr(line, '\t')) == NULL || (dest = strchr(src + 1, '\t')) == NULL)
+			continue;
+		*src++ = '\0';
+		*dest++ = '\0';
+
+		if(job->n_old == max) {
+			max = max ? max * 2 : 1024;
+			job->old = realloc(job->old, max * sizeof(*job->old));
+		}
+		e = &job->old[job->n_old];
+		if(sscanf(line, "%llu %llu %lld %lld", &e->id, &e->gen, &e->size, &mtime) != 4)
+			continue;
+		e->mtime = (time_t)mtime;
+		e->src   = strdup(src);
+		e->dest  = strdup(dest);
+		e->seen  = FALSE;
+		job->n_old++;
+	}
+	fclose(fd);
+
+	qsort(job->old, job->n_old, sizeof(*job->old), extract_sort_state);
+
+	return 0;
+}
+
+/***********************************************************************
+* Record a file for the state of this run and check it against the last
+* run. A file with the same identity, size and time is unchanged and
+* needs no copy, its data is not read.
+*
+* extract_job *job = extraction job
+* const char *src  = path on the volume
+* const char *dest = output file name
+* u64 id           = inode or FAT start cluster
+* u64 gen          = di_gen, 0 on FAT
+* s64 size         = file size in bytes
+* time_t mtime     = last modified time
+***********************************************************************/
+BOOL extract_state_check(extract_job *job, const char *src, const char *dest, u64 id, u64 gen, s64 size, time_t mtime)
+{
+	BOOL same = FALSE;
+	extract_state key, *e;
+
+	if(job->state_file == NULL)
+		return FALSE;
+
+	key.src = (char *)src;
+
+	EnterCriticalSection(&job->lock);
+	if((e = bsearch(&key, job->old, job->n_old, sizeof(*job->old), extract_sort_state)) != NULL) {
+		e->seen = TRUE;
+		same = e->id == id && e->gen == gen && e->size == size && e->mtime == mtime && strcmp(e->dest, dest) == 0;
+	}
+
+	if(job->n_state == job->max_state) {
+		job->max_state = job->max_state ? job->max_state * 2 : 1024;
+		job->state = realloc(job->state, job->max_state * sizeof(*job->state));
+	}
+	e = &job->state[job->n_state++];
+	e->src   = strdup(src);
+	e->dest  = strdup(dest);
+	e->id    = id;
+	e->gen   = gen;
+	e->size  = size;
+	e->mtime = mtime;
+	e->seen  = TRUE;
+
+	if(same)
+		job->skipped++;
+	LeaveCriticalSection(&job->lock);
+
+	return same;
+}
+
+/***********************************************************************
+* Catch Ctrl+C, the jobs running then stop cleanly after the buffer in
+* work. Jobs made later don't see it, so a session sets the trap once.
+***********************************************************************/
+void extract_trap_interrupt(void)
+{
+	extract_armed = 1;
+	signal(SIGINT, extract_interrupt);
+}
+
+/***********************************************************************
+* Give Ctrl+C back to the default handler, a stop noted so far is kept
+* for extract_interrupted.
+***********************************************************************/
+void extract_clear_interrupt(void)
+{
+	extract_armed = 0;
+	signal(SIGINT, SIG_DFL);
+}
+
+/***********************************************************************
+* Check if Ctrl+C was pressed since the program started, for commands
+* that run without a job.
+***********************************************************************/
+BOOL extract_interrupted(void)
+{
+	return extract_stop != 0;
+}
+
+/***********************************************************************
+* Check if Ctrl+C was pressed since the job was made, its copies and
+* walks over folders stop then.
+*
+* extract_job *job = extraction job
+***********************************************************************/
+BOOL extract_job_stopped(extract_job *job)
+{
+	return extract_stop != job->stop_base;
+}
+
+/***********************************************************************
+* Open a checkpoint journal. It gets a line for each finished file and
+* for the offset reached in a big file every EXTRACT_JOURNAL_STEP bytes.
+* With resume the journal of a stopped run is read first and appended
+* to, finished files are skipped and started ones go on.
+*
+* extract_job *job  = extraction job
+* const char *file  = journal file
+* BOOL resume       = continue a stopped run
+***********************************************************************/
+s32 extract_journal_open(extract_job *job, const char *file, BOOL resume)
+{
+	char line[MAX_PATH + 64];
+	char type;
+	s64 offset;
+	s32 pos;
+	u32 i, n, max = 0;
+	FILE *fd;
+
+	if(resume && (fd = fopen(file, "r")) != NULL) {
+		while(fgets(line, sizeof(line), fd)) {
+			line[strcspn(line, "\r\n")] = '\0';
+			if(sscanf(line, "%c %lld %n", &type, &offset, &pos) != 2)
+				continue;
+			if(job->n_resume == max) {
+				max = max ? max * 2 : 1024;
+				job->resume = realloc(job->resume, max * sizeof(*job->resume));
+			}
+			job->resume[job->n_resume].name   = strdup(line + pos);
+			job->resume[job->n_resume].offset = offset;
+			job->resume[job->n_resume].done   = (type == 'D');
+			job->resume[job->n_resume].seq    = job->n_resume;
+			job->n_resume++;
+		}
+		fclose(fd);
+
+		// the last line of a file counts
+		qsort(job->resume, job->n_resume, sizeof(*job->resume), extract_sort_mark);
+		for(i = 0, n = 0; i < job->n_resume; i++) {
+			if(i + 1 < job->n_resume && strcmp(job->resume[i].name, job->resume[i + 1].name) == 0)
+				free(job->resume[i].name);
+			else
+				job->resume[n++] = job->resume[i];
+		}
+		job->n_resume = n;
+	}
+
+	if((job->journal = fopen(file, resume ? "a" : "w")) == NULL) {
+		printf("can't create file! \"%s\"\n", file);
+		return -1;
+	}
+	job->journal_file = strdup(file);
+	job->journal_tick = GetTickCount();
+
+	return 0;
+}
+
+/***********************************************************************
+* Get how far a file got in the stopped run.
+*
+* extract_job *job = extraction job
+* const char *name = output file name
+* BOOL *complete   = set if the file was finished
+***********************************************************************/
+s64 extract_journal_resume(extract_job *job, const char *name, BOOL *complete)
+{
+	extract_mark key, *m;
+
+	*complete = FALSE;
+	key.name = (char *)name;
+	key.seq  = 0;
+
+	if((m = bsearch(&key, job->resume, job->n_resume, sizeof(*job->resume), extract_sort_name)) == NULL)
+		return 0;
+
+	*complete = m->done;
+	return m->offset;
+}
+
+/***********************************************************************
+* Note the offset reached in a file, or that it is finished. The
+* journal is flushed at most every EXTRACT_JOURNAL_FLUSH ms.
+*
+* extract_job *job = extraction job
+* const char *name = output file name
+* s64 offset       = bytes written
+* BOOL done        = file is finished
+***********************************************************************/
+void extract_journal_mark(extract_job *job, const char *name, s64 offset, BOOL done)
+{
+	EnterCriticalSection(&job->lock);
+	fprintf(job->journal, "%c %lld %s\n", done ? 'D' : 'P', offset, name);
+	if(GetTickCount() - job->journal_tick >= EXTRACT_JOURNAL_FLUSH || extract_job_stopped(job)) {
+		fflush(job->journal);
+		job->journal_tick = GetTickCount();
+	}
+	LeaveCriticalSection(&job->lock);
+}
+
+/***********************************************************************
+* Hand a file to the job. With workers the call returns once the file
+* is queued, and blocks while max_inflight bytes are outstanding. With
+* lba_order the file is only collected, extract_job_finish copies it.
+* The job owns the file afterwards.
+*
+* extract_job *job = extraction job
+* extract_file *f  = file to copy
+***********************************************************************/
+s32 extract_submit(extract_job *job, extract_file *f)
+{
+	s32 ret;
+	BOOL complete;
+	extract_task *t;
+
+	if(extract_job_stopped(job)) {
+		extract_file_free(f);
+		return -1;
+	}
+
+	// files finished before the stop are not copied again
+	if(job->n_resume) {
+		extract_journal_resume(job, f->dest, &complete);
+		if(complete) {
+			extract_file_free(f);
+			return 0;
+		}
+	}
+
+	if(job->buf == NULL)
+		extract_job_start(job);
+
+	if(job->lba_order) {
+		if(job->n_plan == job->max_plan) {
+			job->max_plan = job->max_plan ? job->max_plan * 2 : 256;
+			job->plan = realloc(job->plan, job->max_plan * sizeof(*job->plan));
+		}
+		job->plan[job->n_plan++] = f;
+		return 0;
+	}
+
+	if(job->pool == NULL) {
+		ret = extract_copy_file(job, f, job->buf[0], TRUE);
+		extract_file_free(f);
+		return ret;
+	}
+
+	EnterCriticalSection(&job->lock);
+	while(job->inflight > 0 && job->inflight + f->size > job->max_inflight)
+		SleepConditionVariableCS(&job->room, &job->lock, INFINITE);
+	job->inflight += f->size;
+	LeaveCriticalSection(&job->lock);
+
+	t = malloc(sizeof(*t));
+	t->job  = job;
+	t->file = f;
+	pool_submit(job->pool, extract_worker, t);
+
+	return 0;
+}
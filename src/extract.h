@@ -0,0 +1,141 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#ifndef _EXTRACT_H_
+#define _EXTRACT_H_
+
+#include <stdio.h>
+#include <time.h>
+
+#include "types.h"
+#include "pool.h"
+#include "hash.h"
+#include "filter.h"
+
+#define EXTRACT_BUF_SIZE      0x100000     // copy buffer per worker, 1 MiB
+#define EXTRACT_MAX_INFLIGHT  0x10000000   // default bound of queued file bytes, 256 MiB
+#define EXTRACT_MAX_THREADS   8            // default worker count limit
+#define EXTRACT_PLAN_OPEN     64           // output files kept open by the planner
+#define EXTRACT_HOLE          -1           // dev_off of a hole, no data on hdd
+#define EXTRACT_DUP_HEAD      0x10000      // bytes of a file in the cheap duplicate check
+#define EXTRACT_DUP_BUCKETS   4096         // hash buckets of written files
+#define EXTRACT_TAR_BUF       0x400000     // stdio buffer of the tar stream, 4 MiB
+#define EXTRACT_JOURNAL_STEP  0x4000000    // offset of a big file noted every 64 MiB
+#define EXTRACT_JOURNAL_FLUSH 1000         // journal flushed at most every second
+
+#define TAR_BLOCK             512          // tar record size
+#define TAR_PAX_MAX           2048         // pax records of one entry
+#define TAR_SIZE_MAX          077777777777LL // largest size in a ustar header
+#define TAR_FILE              '0'
+#define TAR_SYMLINK           '2'
+#define TAR_DIR               '5'
+#define TAR_PAX               'x'
+
+typedef struct _extract_extent_ {
+	s64 dev_off;            // byte offset on hdd or EXTRACT_HOLE
+	s64 len;                // byte count
+} extract_extent;
+
+typedef struct _extract_file_ {
+	char *dest;             // output file name
+	s64 size;               // file size in bytes
+	time_t atime;           // last access time
+	time_t mtime;           // last modified time
+	u32 mode;               // permission bits, for tar
+	u32 n_ext;              // extent count
+	u32 max_ext;            // allocated extents
+	extract_extent *ext;    // file data on hdd, in file order
+} extract_file;
+
+typedef struct _extract_dup_ {
+	s64 size;               // file size in bytes
+	u32 head;               // CRC32C of the first EXTRACT_DUP_HEAD bytes
+	u8 sha[SHA256_SIZE];    // SHA-256 of the file
+	char *dest;             // output file name
+	u32 seq;                // order of registration, files link to older ones
+	BOOL busy;              // still being written, sha not known yet
+	BOOL bad;               // not written, never linked to
+	struct _extract_dup_ *next;
+} extract_dup;
+
+typedef struct _extract_state_ {
+	char *src;              // path on the volume
+	char *dest;             // output file name
+	u64 id;                 // inode or FAT start cluster
+	u64 gen;                // di_gen, 0 on FAT
+	s64 size;               // file size in bytes
+	time_t mtime;           // last modified time
+	BOOL seen;              // found again in this run
+} extract_state;
+
+typedef struct _extract_mark_ {
+	char *name;             // output file name
+	s64 offset;             // bytes written
+	BOOL done;              // file is finished
+	u32 seq;                // line in the journal
+} extract_mark;
+
+typedef struct _extract_job_ {
+	ps3_context *ctx;       // ps3 device information
+	s32 threads;            // worker count, 1 copies inline
+	s64 max_inflight;       // bound of queued or copying file bytes
+	thread_pool *pool;      // workers, started on first submit
+	u8 **buf;               // one copy buffer per worker
+	CRITICAL_SECTION lock;  // guards the counters below
+	CONDITION_VARIABLE room;// signalled when inflight drops
+	s64 inflight;           // bytes of queued or copying files
+	s64 files_done;         // files written
+	s64 bytes_done;         // bytes written
+	BOOL lba_order;         // collect all files, read in ascending LBA order
+	extract_file **plan;    // files collected for LBA ordered reads
+	u32 n_plan;             // collected file count
+	u32 max_plan;           // allocated plan entries
+	FILE *manifest;         // SHA-256 of each copied file, or NULL
+	BOOL crc;               // add CRC32C to the manifest
+	BOOL hash_only;         // hash files without writing them
+	BOOL dedup;             // hardlink files identical to one already written
+	extract_dup **dup;      // written files by size and head, EXTRACT_DUP_BUCKETS
+	u32 dup_seq;            // next registration number
+	CONDITION_VARIABLE dup_ready; // signalled when a file of dup is done
+	s64 dup_files;          // files linked instead of written
+	s64 dup_saved;          // bytes not written by linking
+	FILE *tar;              // tar stream taking all output, or NULL
+	path_filter *filter;    // files and folders to take, or NULL for all
+	char *state_file;       // state of the last run, rewritten at the end, or NULL
+	BOOL prune;             // remove files gone from the volume since the last run
+	extract_state *old;     // files of the last run, sorted by src
+	u32 n_old;              // file count of the last run
+	extract_state *state;   // files of this run
+	u32 n_state;            // file count of this run
+	u32 max_state;          // allocated entries of this run
+	s64 skipped;            // unchanged files not copied
+	FILE *journal;          // checkpoint journal, or NULL
+	char *journal_file;     // journal file name
+	DWORD journal_tick;     // time of the last journal flush
+	extract_mark *resume;   // journal of the stopped run, by name
+	u32 n_resume;           // entries of the stopped run
+	s32 stop_base;          // Ctrl+C count when the job was made, later ones stop it
+} extract_job;
+
+void extract_job_init(extract_job *job, ps3_context *ctx);
+void extract_job_finish(extract_job *job);
+extract_file* extract_file_new(const char *dest, s64 size, time_t atime, time_t mtime);
+void extract_file_add(extract_file *f, s64 dev_off, s64 len);
+void extract_file_free(extract_file *f);
+s64 extract_file_read(ps3_context *ctx, extract_file *f, u8 *buf, s64 offset, s64 len);
+void extract_tar_open(extract_job *job, FILE *out);
+void extract_tar_entry(extract_job *job, const char *name, char type, u32 mode, time_t mtime, const char *link);
+s32 extract_state_load(extract_job *job, const char *file, BOOL prune);
+BOOL extract_state_check(extract_job *job, const char *src, const char *dest, u64 id, u64 gen, s64 size, time_t mtime);
+void extract_trap_interrupt(void);
+void extract_clear_interrupt(void);
+BOOL extract_interrupted(void);
+BOOL extract_job_stopped(extract_job *job);
+s32 extract_journal_open(extract_job *job, const char *file, BOOL resume);
+s64 extract_journal_resume(extract_job *job, const char *name, BOOL *complete);
+void extract_journal_mark(extract_job *job, const char *name, s64 offset, BOOL done);
+s32 extract_submit(extract_job *job, extract_file *f);
+
+#endif  // _EXTRACT_H_
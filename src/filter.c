@@ -0,0 +1,355 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+
+
+
+/***********************************************************************
+* Match a character class "[...]" at the start of a pattern.
+*
+* const char **p = pattern at '[', moved past ']'
+* char c         = character to test
+***********************************************************************/
+static BOOL filter_class(const char **p, char c)
+{
+	const char *s = *p + 1;
+	BOOL neg = FALSE, hit = FALSE;
+
+	if(*s == '!' || *s == '^') {
+		neg = TRUE;
+		s++;
+	}
+
+	// a ']' right after the '[' is a member
+	do {
+		if(s[1] == '-' && s[2] && s[2] != ']') {
+			if(c >= s[0] && c <= s[2])
+				hit = TRUE;
+			s += 3;
+		}
+		else {
+			if(c == *s)
+				hit = TRUE;
+			s++;
+		}
+	} while(*s && *s != ']');
+
+	*p = *s ? s : s - 1;
+	return hit != neg;
+}
+
+/***********************************************************************
+* Match a string against a glob pattern. "*", "?" and "[...]" stay in
+* one path component, "**" matches across folders, "**" followed by
+* "/" also matches no folder at all.
+*
+* const char *p = pattern
+* const char *s = string
+***********************************************************************/
+static BOOL filter_glob(const char *p, const char *s)
+{
+	for(; *p; p++, s++) {
+		if(p[0] == '*' && p[1] == '*') {
+			p += 2;
+			if(*p == '/') {
+				for(p++;; s++) {
+					if(filter_glob(p, s))
+						return TRUE;
+					if((s = strchr(s, '/')) == NULL)
+						return FALSE;
+				}
+			}
+			for(;; s++) {
+				if(filter_glob(p, s))
+					return TRUE;
+				if(*s == '\0')
+					return FALSE;
+			}
+		}
+		if(*p == '*') {
+			for(p++;; s++) {
+				if(filter_glob(p, s))
+					return TRUE;
+				if(*s == '\0' || *s == '/')
+					return FALSE;
+			}
+		}
+		if(*s == '\0')
+			return FALSE;
+		if(*p == '?') {
+			if(*s == '/')
+				return FALSE;
+			continue;
+		}
+		if(*p == '[') {
+			if(*s == '/' || !filter_class(&p, *s))
+				return FALSE;
+			continue;
+		}
+		if(*p != *s)
+			return FALSE;
+	}
+
+	return *s == '\0';
+}
+
+/***********************************************************************
+* Match a path against a pattern. A pattern starting with "/" is taken
+* from the volume root, one without "/" is matched against the name,
+* any other against the end of the path at a folder boundary.
+*
+* const char *pat  = pattern
+* const char *path = path on the volume
+***********************************************************************/
+static BOOL filter_match(const char *pat, const char *path)
+{
+	const char *s;
+
+	if(pat[0] == '/')
+		return filter_glob(pat, path);
+
+	if(strchr(pat, '/') == NULL)
+		return filter_glob(pat, (s = strrchr(path, '/')) ? s + 1 : path);
+
+	for(s = path; s; s = strchr(s, '/')) {
+		if(*s == '/')
+			s++;
+		if(filter_glob(pat, s))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/***********************************************************************
+* Match a path or one of its parent folders against a pattern.
+*
+* const char *pat  = pattern
+* const char *path = path on the volume
+***********************************************************************/
+static BOOL filter_match_tree(const char *pat, const char *path)
+{
+	char tmp[MAX_PATH];
+	char *s;
+
+	strncpy(tmp, path, MAX_PATH - 1);
+	tmp[MAX_PATH - 1] = '\0';
+
+	for(;;) {
+		if(tmp[0] && filter_match(pat, tmp))
+			return TRUE;
+		if((s = strrchr(tmp, '/')) == NULL || s == tmp)
+			return FALSE;
+		*s = '\0';
+	}
+}
+
+/***********************************************************************
+* Check if a pattern from the root can match something below a folder,
+* each folder name must match the pattern part at the same depth.
+*
+* const char *pat = pattern starting with "/"
+* const char *dir = folder path
+***********************************************************************/
+static BOOL filter_below(const char *pat, const char *dir)
+{
+	char pc[MAX_PATH], dc[MAX_PATH];
+	size_t n;
+
+	for(;;) {
+		while(*dir == '/')
+			dir++;
+		while(*pat == '/')
+			pat++;
+		if(*dir == '\0')
+			return *pat != '\0';
+		if(*pat == '\0')
+			return FALSE;
+
+		n = strcspn(pat, "/");
+		if(n >= MAX_PATH)
+			return TRUE;
+		memcpy(pc, pat, n);
+		pc[n] = '\0';
+		pat += n;
+
+		n = strcspn(dir, "/");
+		if(n >= MAX_PATH)
+			return TRUE;
+		memcpy(dc, dir, n);
+		dc[n] = '\0';
+		dir += n;
+
+		if(strstr(pc, "**"))
+			return TRUE;
+		if(!filter_glob(pc, dc))
+			return FALSE;
+	}
+}
+
+/***********************************************************************
+* Create an empty filter, it takes everything.
+***********************************************************************/
+path_filter* filter_new(void)
+{
+	path_filter *pf = malloc(sizeof(*pf));
+
+	memset(pf, 0, sizeof(*pf));
+	pf->min_size = -1;
+	pf->max_size = -1;
+
+	return pf;
+}
+
+/***********************************************************************
+* Free a filter.
+*
+* path_filter *pf = filter
+***********************************************************************/
+void filter_free(path_filter *pf)
+{
+	u32 i;
+
+	if(pf == NULL)
+		return;
+
+	for(i = 0; i < pf->n_include; i++)
+		free(pf->include[i]);
+	for(i = 0; i < pf->n_exclude; i++)
+		free(pf->exclude[i]);
+	free(pf->include);
+	free(pf->exclude);
+	free(pf);
+}
+
+/***********************************************************************
+* Add an include pattern, with any of them only matching files are
+* taken.
+*
+* path_filter *pf     = filter
+* const char *pattern = glob pattern
+***********************************************************************/
+void filter_include(path_filter *pf, const char *pattern)
+{
+	pf->include = realloc(pf->include, (pf->n_include + 1) * sizeof(*pf->include));
+	pf->include[pf->n_include++] = strdup(pattern);
+}
+
+/***********************************************************************
+* Add an exclude pattern, matching files and folders are left out.
+*
+* path_filter *pf     = filter
+* const char *pattern = glob pattern
+***********************************************************************/
+void filter_exclude(path_filter *pf, const char *pattern)
+{
+	pf->exclude = realloc(pf->exclude, (pf->n_exclude + 1) * sizeof(*pf->exclude));
+	pf->exclude[pf->n_exclude++] = strdup(pattern);
+}
+
+/***********************************************************************
+* Parse a size like "4096", "64K", "100M" or "2G".
+*
+* const char *str = size
+***********************************************************************/
+s64 filter_parse_size(const char *str)
+{
+	char *end;
+	s64 size = strtoll(str, &end, 10);
+
+	switch(*end) {
+		case 'k': case 'K': return size << 10;
+		case 'm': case 'M': return size << 20;
+		case 'g': case 'G': return size << 30;
+		default:            return size;
+	}
+}
+
+/***********************************************************************
+* Parse a local date "YYYY-MM-DD" or seconds since 1970.
+*
+* const char *str = date
+***********************************************************************/
+time_t filter_parse_date(const char *str)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	if(sscanf(str, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3)
+		return (time_t)strtoll(str, NULL, 10);
+
+	tm.tm_year -= 1900;
+	tm.tm_mon  -= 1;
+	tm.tm_isdst = -1;
+
+	return mktime(&tm);
+}
+
+/***********************************************************************
+* Check if a folder has to be read. A folder is left out if it is
+* excluded, or if no include pattern can match anything inside it.
+*
+* path_filter *pf  = filter
+* const char *path = folder path on the volume
+***********************************************************************/
+BOOL filter_want_dir(path_filter *pf, const char *path)
+{
+	u32 i;
+
+	for(i = 0; i < pf->n_exclude; i++)
+		if(filter_match(pf->exclude[i], path))
+			return FALSE;
+
+	if(pf->n_include == 0)
+		return TRUE;
+
+	for(i = 0; i < pf->n_include; i++) {
+		if(pf->include[i][0] != '/')
+			return TRUE;
+		if(filter_below(pf->include[i], path) || filter_match_tree(pf->include[i], path))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/***********************************************************************
+* Check if a file is taken. It must not be excluded, fit the size and
+* time limits and match an include pattern itself or by a folder.
+*
+* path_filter *pf  = filter
+* const char *path = file path on the volume
+* s64 size         = file size in bytes
+* time_t mtime     = last modified time
+***********************************************************************/
+BOOL filter_want_file(path_filter *pf, const char *path, s64 size, time_t mtime)
+{
+	u32 i;
+
+	if(pf->min_size >= 0 && size < pf->min_size)
+		return FALSE;
+	if(pf->max_size >= 0 && size > pf->max_size)
+		return FALSE;
+	if(pf->newer && mtime <= pf->newer)
+		return FALSE;
+
+	for(i = 0; i < pf->n_exclude; i++)
+		if(filter_match(pf->exclude[i], path))
+			return FALSE;
+
+	if(pf->n_include == 0)
+		return TRUE;
+
+	for(i = 0; i < pf->n_include; i++)
+		if(filter_match_tree(pf->include[i], path))
+			return TRUE;
+
+	return FALSE;
+}
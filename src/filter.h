@@ -0,0 +1,32 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include <time.h>
+
+#include "types.h"
+
+typedef struct _path_filter_ {
+	u32 n_include;          // include pattern count, 0 takes all
+	char **include;         // include patterns
+	u32 n_exclude;          // exclude pattern count
+	char **exclude;         // exclude patterns
+	s64 min_size;           // smallest file size, -1 for any
+	s64 max_size;           // largest file size, -1 for any
+	time_t newer;           // files modified after, 0 for any
+} path_filter;
+
+path_filter* filter_new(void);
+void filter_free(path_filter *pf);
+void filter_include(path_filter *pf, const char *pattern);
+void filter_exclude(path_filter *pf, const char *pattern);
+s64 filter_parse_size(const char *str);
+time_t filter_parse_date(const char *str);
+BOOL filter_want_dir(path_filter *pf, const char *path);
+BOOL filter_want_file(path_filter *pf, const char *path, s64 size, time_t mtime);
+
+#endif  // _FILTER_H_
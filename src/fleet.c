@@ -0,0 +1,339 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "fleet.h"
+#include "kgen.h"
+#include "device.h"
+#include "util.h"
+#include "fs/vfs.h"
+
+static const char *fleet_types[4] = {"unknown", "FAT_NAND", "FAT_NOR", "SLIM_NOR"};
+
+
+
+/***********************************************************************
+* Load the keyring, one eid root key/iv after the other. A single
+* "eid_root_key" is a keyring with one key.
+*
+* fleet *f            = fleet run
+* const char *keyring = keyring file, NULL for the default names
+***********************************************************************/
+static s32 fleet_load_keys(fleet *f, const char *keyring)
+{
+	const char *name = keyring ? keyring : "eid_root_keys";
+	u32 size = 0;
+
+	if((f->keys = _read_buffer((s8*)name, &size)) == NULL && keyring == NULL)
+		f->keys = _read_buffer((s8*)(name = "eid_root_key"), &size);
+
+	if(f->keys == NULL) {
+		printf("file \"%s\" not found !\n", name);
+		return -1;
+	}
+	if(size == 0 || size % FLEET_KEY_SIZE) {
+		printf("file \"%s\" is no keyring, size must be a multiple of 0x%X!\n", name, FLEET_KEY_SIZE);
+		return -1;
+	}
+
+	f->n_keys = size / FLEET_KEY_SIZE;
+	return 0;
+}
+
+/***********************************************************************
+* Open a drive or image found by the probe with its key.
+*
+* fleet *f     = fleet run
+* dev_probe *p = probe result, key is the matching one
+***********************************************************************/
+static s32 fleet_add(fleet *f, dev_probe *p)
+{
+	u8 *key = f->keys + p->key * FLEET_KEY_SIZE;
+	fleet_disk *d;
+	ps3_context *ctx;
+
+	if(f->n_disks == FLEET_MAX_DISKS)
+		return -1;
+
+	ctx = malloc(sizeof(ps3_context));
+	memset(ctx, 0, sizeof(ps3_context));
+	ctx->dev = INVALID_HANDLE_VALUE;
+	InitializeCriticalSection(&ctx->io_lock);
+	InitializeCriticalSection(&ctx->fat_lock);
+
+	generate_ata_keys(key, key + 0x20, ctx->ata_k1, ctx->ata_k2);
+	generate_encdec_keys(key, key + 0x20, ctx->encdec_k1, ctx->encdec_k2);
+
+	if(open_device(ctx, p->name)) {
+		printf("%s: can't open!\n", p->name);
+		close_device(ctx);
+		free(ctx);
+		return -1;
+	}
+
+	d = &f->disk[f->n_disks];
+	strcpy(d->name, p->name);
+	strcpy(d->serial, p->serial);
+	sprintf(d->label, "disk%d", f->n_disks + 1);
+	d->key    = p->key;
+	d->cached = p->cached;
+	d->ctx    = ctx;
+	d->f      = f;
+	d->ret    = -1;
+	f->n_disks++;
+
+	return 0;
+}
+
+/***********************************************************************
+* Inventory job, all inodes of dev_hdd0 into <dest>/<label>.csv.
+*
+* fleet_disk *d = disk of the job
+***********************************************************************/
+static s32 fleet_inventory(fleet_disk *d)
+{
+	char out[MAX_PATH];
+	vfs_volume *vol;
+	FILE *fd;
+	s32 err, ret = -1;
+
+	if((vol = vfs_open(d->ctx, "dev_hdd0", &err)) == NULL) {
+		printf("%s: can't open dev_hdd0, %s!\n", d->label, ps3hdd_strerror(err));
+		return -1;
+	}
+
+	sprintf(out, "%s/%s.csv", d->f->dest, d->label);
+
+	if(vfs_index(vol, NULL, 1) == 0) {
+		if((fd = fopen(out, "w")) != NULL) {
+			ret = ufs_print_inventory(d->ctx, vol->ufs2, vol->inv, fd, TRUE);
+			d->bytes = ftell(fd);
+			fclose(fd);
+		}
+		else
+			printf("can't create file! \"%s\"\n", out);
+	}
+
+	vfs_close(vol);
+	return ret;
+}
+
+/***********************************************************************
+* Image job, the decrypted hdd up to the end of the last region into
+* <dest>/<label>.img, read in one sequential pass.
+*
+* fleet_disk *d = disk of the job
+***********************************************************************/
+static s32 fleet_image(fleet_disk *d)
+{
+	ps3_context *ctx = d->ctx;
+	char out[MAX_PATH];
+	s64 end = 0, sec, n;
+	u8 *buf;
+	FILE *fd;
+
+	// regions as found by get_partitions
+	if(ctx->vflash_start + ctx->vflash_size > end)
+		end = ctx->vflash_start + ctx->vflash_size;
+	if(ctx->hdd0_start + ctx->hdd0_size > end)
+		end = ctx->hdd0_start + ctx->hdd0_size;
+	if(ctx->hdd1_start + ctx->hdd1_size > end)
+		end = ctx->hdd1_start + ctx->hdd1_size;
+	if(end == 0) {
+		printf("%s: no regions found!\n", d->label);
+		return -1;
+	}
+
+	sprintf(out, "%s/%s.img", d->f->dest, d->label);
+	if((fd = fopen(out, "wb")) == NULL) {
+		printf("can't create file! \"%s\"\n", out);
+		return -1;
+	}
+
+	buf = malloc(FLEET_IMAGE_STEP * SECTOR_SIZE);
+
+	for(sec = 0; sec < end && !extract_interrupted(); sec += n) {
+		n = (end - sec < FLEET_IMAGE_STEP) ? end - sec : FLEET_IMAGE_STEP;
+		block_read(ctx, buf, n, sec);
+		if(fwrite(buf, SECTOR_SIZE, n, fd) != (size_t)n) {
+			printf("can't write file! \"%s\"\n", out);
+			break;
+		}
+		d->bytes += n * SECTOR_SIZE;
+	}
+
+	free(buf);
+	fclose(fd);
+	return (sec < end) ? -1 : 0;
+}
+
+/***********************************************************************
+* Extract job, all volumes or the ones named into <dest>/<label>. The
+* disk thread is the only reader of its disk, the files are read in
+* ascending LBA order.
+*
+* fleet_disk *d = disk of the job
+***********************************************************************/
+static s32 fleet_extract(fleet_disk *d)
+{
+	char out[MAX_PATH];
+	extract_job job;
+	s32 ret;
+
+	extract_job_init(&job, d->ctx);
+	job.threads   = 1;
+	job.lba_order = TRUE;
+	job.filter    = d->f->opts->filter;
+	job.dedup     = d->f->opts->dedup;
+
+	sprintf(out, "%s/%s", d->f->dest, d->label);
+	ret = vfs_backup(d->ctx, &job, NULL, out, d->f->names);
+
+	extract_job_finish(&job);
+	d->bytes = job.bytes_done;
+	return ret;
+}
+
+/***********************************************************************
+* Reader thread of one disk, runs the job of the fleet on it.
+*
+* LPVOID param = fleet_disk
+***********************************************************************/
+static DWORD WINAPI fleet_disk_thread(LPVOID param)
+{
+	fleet_disk *d = param;
+	DWORD start = GetTickCount();
+
+	// stopped before this disk got its turn
+	if(extract_interrupted())
+		return 0;
+
+	get_partitions(d->ctx);
+	d->ctx->crypto_pool = d->f->crypto;
+
+	if(strcmp(d->f->job, "inventory") == 0)
+		d->ret = fleet_inventory(d);
+	else if(strcmp(d->f->job, "image") == 0)
+		d->ret = fleet_image(d);
+	else
+		d->ret = fleet_extract(d);
+
+	d->ticks = GetTickCount() - start;
+	return 0;
+}
+
+/***********************************************************************
+* Find all ps3 hdds and images that decrypt with a key of the keyring
+* and run one job on each of them at the same time. Every disk gets its
+* own reader thread, the decryption of all disks is done by one pool.
+*
+* extract_job *opts   = options of the command line
+* const char *keyring = keyring file, NULL for the default names
+* const char *job     = "inventory", "image" or "extract"
+* const char *dest    = output folder
+* const char *names   = volumes to extract, NULL for all
+* char *images[]      = image files to check besides the drives
+* s32 n_images        = image file count
+***********************************************************************/
+s32 fleet_run(extract_job *opts, const char *keyring, const char *job, const char *dest, const char *names, char *images[], s32 n_images)
+{
+	fleet f;
+	fleet_disk *d;
+	HANDLE threads[FLEET_MAX_DISKS];
+	dev_probe probe[DEV_PROBE_MAX];
+	dev_key *ring;
+	DWORD start;
+	s32 i, n = 0, n_probe, ret = 0;
+
+	if(strcmp(job, "inventory") && strcmp(job, "image") && strcmp(job, "extract")) {
+		printf("unknown job! \"%s\"\n", job);
+		return -1;
+	}
+	if(strlen(dest) + 32 > MAX_PATH) {
+		printf("path too long!\n");
+		return -1;
+	}
+
+	memset(&f, 0, sizeof(f));
+	f.job   = job;
+	f.dest  = dest;
+	f.opts  = opts;
+	f.names = names;
+
+	if(fleet_load_keys(&f, keyring)) {
+		free(f.keys);
+		return -1;
+	}
+
+	// all drives and the images given at once, against the whole keyring
+	start = GetTickCount();
+	if((ring = device_keyring(f.keys, f.n_keys)) == NULL) {
+		free(f.keys);
+		return -1;
+	}
+	n_probe = device_probe(ring, f.n_keys, images, n_images, FLEET_CACHE, TRUE, probe);
+	printf("%d drives/images probed with %d keys in %lu ms\n", n_probe, f.n_keys, (unsigned long)(GetTickCount() - start));
+	free(ring);
+
+	for(i = 0; i < n_probe; i++) {
+		if(probe[i].key >= 0)
+			fleet_add(&f, &probe[i]);
+		else if(i >= DEV_PROBE_DRIVES - 1)
+			printf("%s: no PS3 hdd or no matching key!\n", probe[i].name);
+	}
+
+	if(f.n_disks == 0) {
+		printf("no PS3 hdd found or eid root keys wrong!\n");
+		free(f.keys);
+		return -1;
+	}
+
+	for(i = 0; i < f.n_disks; i++) {
+		d = &f.disk[i];
+		printf("%s = %s, %s, serial %s, key %d%s\n", d->label, d->name, fleet_types[d->ctx->ps3_type & 3],
+		       d->serial[0] ? d->serial : "-", d->key, d->cached ? " (cached)" : "");
+	}
+
+	mkdir(dest, 0777);
+
+	// one trap for all disks, the jobs neither arm nor clear it
+	extract_trap_interrupt();
+	f.crypto = pool_create(opts->threads > 1 ? opts->threads : 1);
+
+	for(i = 0; i < f.n_disks; i++) {
+		d = &f.disk[i];
+		if((d->thread = CreateThread(NULL, 0, fleet_disk_thread, d, 0, NULL)) == NULL) {
+			printf("%s: can't start reader thread!\n", d->label);
+			continue;
+		}
+		threads[n++] = d->thread;
+	}
+
+	if(n)
+		WaitForMultipleObjects(n, threads, TRUE, INFINITE);
+	extract_clear_interrupt();
+
+	for(i = 0; i < f.n_disks; i++) {
+		d = &f.disk[i];
+		if(d->thread)
+			CloseHandle(d->thread);
+		printf("%s: %s, %lld bytes in %lu ms\n", d->label, d->ret ? "failed" : "done", d->bytes, (unsigned long)d->ticks);
+		if(d->ret)
+			ret = -1;
+		close_device(d->ctx);
+		free(d->ctx);
+	}
+
+	if(f.crypto)
+		pool_destroy(f.crypto);
+	free(f.keys);
+	return ret;
+}
@@ -0,0 +1,48 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#ifndef _FLEET_H_
+#define _FLEET_H_
+
+#include "types.h"
+#include "extract.h"
+#include "pool.h"
+
+#define FLEET_MAX_DISKS   32         // PhysicalDrive1..15 and image files
+#define FLEET_KEY_SIZE    0x30       // eid root key and iv
+#define FLEET_IMAGE_STEP  0x800      // sectors per read of the image job, 1 MiB
+#define FLEET_CACHE       "eid_root_keys.cache" // key of each drive by serial number
+
+typedef struct _fleet_ fleet;
+
+typedef struct _fleet_disk_ {
+	char name[MAX_PATH];      // drive or image file
+	char serial[64];          // serial number of a drive, "" if none
+	char label[16];           // "disk1", ... name of its output
+	s32 key;                  // index of the matching eid root key
+	BOOL cached;              // key found through the cache
+	ps3_context *ctx;         // ps3 device information, own handle and keys
+	fleet *f;                 // run the disk belongs to
+	HANDLE thread;            // reader thread of the disk
+	s32 ret;                  // result of the job
+	s64 bytes;                // bytes written by the job
+	DWORD ticks;              // run time of the job
+} fleet_disk;
+
+struct _fleet_ {
+	u8 *keys;                 // keyring, FLEET_KEY_SIZE bytes per key
+	s32 n_keys;               // key count
+	fleet_disk disk[FLEET_MAX_DISKS]; // disks found
+	s32 n_disks;              // disk count
+	thread_pool *crypto;      // decryption workers shared by all disks
+	const char *job;          // "inventory", "image" or "extract"
+	const char *dest;         // output folder
+	extract_job *opts;        // options of the command line
+	const char *names;        // volumes to extract, NULL for all
+};
+
+s32 fleet_run(extract_job *opts, const char *keyring, const char *job, const char *dest, const char *names, char *images[], s32 n_images);
+
+#endif  // _FLEET_H_
@@ -11,6 +11,7 @@
 #include <sys/stat.h>
 #include <utime.h>
 #include <time.h>
+#include <immintrin.h>
 
 #include "fat.h"
 
@@ -103,101 +104,308 @@ s32 get_fat_type(struct fat_bs *fat)
 	return 0;
 }
 /***********************************************************************
-* Return the size of the free memory in the file system.
+* Get the FAT table of a volume, it is created on first use and read
+* region by region when entries are needed.
 * 
-* ps3_context *ctx = ps3 device information
+* ps3_context *ctx       = ps3 device information
 * u64 storage						 = partition
 * struct fat_bs *fat_fs  = Fat12/16 bootsector
 * struct fat32_bs *fat32 = Fat32 bootsector
 ***********************************************************************/
-u64 fat_how_many_free_bytes(ps3_context *ctx, u64 storage, struct fat_bs *fat, struct fat32_bs *fat32)
+static fat_table* fat_get_table(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct fat32_bs *fat32)
 {
-	s32 i, t = 0;
-	u64 count = 0, free_byte = 0, data_clu = 0;
-	u8 *fat_buf, *buf;
-	struct f_entry *add = NULL;
+	s64 fat_bytes;
+	fat_table *t;
+	
+	EnterCriticalSection(&ctx->fat_lock);
 	
+	for(t = ctx->fat_tables; t; t = t->next)
+		if(t->storage == storage)
+			break;
 	
-	if(fat) t = get_fat_type(fat);
+	if(t == NULL) {
+		t = malloc(sizeof(*t));
+		memset(t, 0, sizeof(*t));
+		t->storage = storage;
 		
-	if(fat32) t = 32;
+		if(fat_fs) {
+			t->type    = get_fat_type(fat_fs);
+			t->fat_off = (storage * SECTOR_SIZE) + fat1_off(fat_fs);
+			fat_bytes  = fat_size(fat_fs);
+		}
+		else {
+			t->type    = 32;
+			t->fat_off = (storage * SECTOR_SIZE) + fat1_off32(fat32);
+			fat_bytes  = fat_size32(fat32);
+		}
+		
+		t->count    = (t->type == 12) ? (fat_bytes * 2) / 3 : fat_bytes / (t->type / 8);
+		t->entry    = malloc((t->count + 1) * sizeof(*t->entry));
+		t->n_region = (t->count + FAT_TABLE_REGION - 1) / FAT_TABLE_REGION;
+		t->loaded   = malloc(t->n_region + 1);
+		memset(t->loaded, 0, t->n_region + 1);
+		
+		t->next = ctx->fat_tables;
+		ctx->fat_tables = t;
+	}
 	
-	switch(t) {
+	LeaveCriticalSection(&ctx->fat_lock);
+	
+	return t;
+}
+/***********************************************************************
+* Read and decode one region of a FAT, call with fat_lock held.
+* 
+* ps3_context *ctx = ps3 device information
+* fat_table *t     = FAT table
+* u32 r            = region number
+***********************************************************************/
+static void fat_load_region(ps3_context *ctx, fat_table *t, u32 r)
+{
+	u32 i, first, last;
+	s64 off, end;
+	u8 *buf, *p;
+	
+	first = r * FAT_TABLE_REGION;
+	last  = min(first + FAT_TABLE_REGION, t->count);
+	
+	if(t->type == 12) {
+		off = (first * 3) / 2;
+		end = (((last - 1) * 3) / 2) + 2;
+	}
+	else {
+		off = (s64)first * (t->type / 8);
+		end = (s64)last * (t->type / 8);
+	}
+	
+	buf = malloc(end - off);
+	device_read(ctx, buf, end - off, t->fat_off + off);
+	
+	switch(t->type) {
 		case 12:
-			data_clu = ((fat->bs_tsec + fat->bs_nrsec) * fat->bs_ssize - data_off(fat)) / clu_size(fat);/* data cluster in partition */
-			buf = malloc(0x02);																																					/* buffer für entry allokieren... */
-			fat_buf = malloc(fat_size(fat));																														/* buffer für FAT allokieren... */
-			
-			device_read(ctx, fat_buf, (fat_size(fat)), (storage * SECTOR_SIZE) + fat1_off(fat));
-			
-			for(i = 2; i < data_clu; i ++) {
-				memcpy(buf, fat_buf + (fat12_e(fat, i) - fat1_off(fat)), 0x02);
-				
-				add = (struct f_entry*)buf;
-				if((i % 2) == 0) {add->entry = add->entry & 0x00000FFF;}	/* entry adresse aufbereiten... */
-				else {add->entry = add->entry >> 4 & 0x00000FFF;}
-				add->entry &= 0x00000FFF;
-					
-				if(add->entry == 0x00000000)
-					count++;
+			// two entries packed in three bytes, regions start on even entries
+			for(i = first, p = buf; i + 1 < last; i += 2, p += 3) {
+				t->entry[i]     = p[0] | ((p[1] & 0x0F) << 8);
+				t->entry[i + 1] = (p[1] >> 4) | (p[2] << 4);
 			}
-			
-			free_byte = count * clu_size(fat);
-			free(add);
-			free(fat_buf);
-			return free_byte;
+			if(i < last)
+				t->entry[i] = p[0] | ((p[1] & 0x0F) << 8);
 		break;
 		case 16:
-			data_clu = ((fat->bs_tsec + fat->bs_nrsec) * fat->bs_ssize - data_off(fat)) / clu_size(fat);	/* data cluster in partition */
-			buf = malloc(0x02);																													/* buffer für entry allokieren... */
-			fat_buf = malloc(fat_size(fat));																						/* buffer für FAT allokieren... */
-      
-			device_read(ctx, fat_buf, fat_size(fat), (storage * SECTOR_SIZE) + fat1_off(fat));
-			
-			for(i = 0; i < data_clu; i ++) {				  																  /* free cluster zählen... */
-				memcpy(buf, fat_buf + (i * 2), 0x02);
-				
-				add = (struct f_entry*)buf;
-				add->entry &= 0x0000FFFF;
-						
-				if(add->entry == 0x00000000)
-					count++;
-			}
-			
-			free_byte = count * clu_size(fat);
-			
-			free(add);
-			free(fat_buf);
-			return free_byte;
+			for(i = first, p = buf; i < last; i++, p += 2)
+				t->entry[i] = p[0] | (p[1] << 8);
 		break;
-		case 32:
-			data_clu = (fat32->bs_nrsec * fat32->bs_ssize - data_off32(fat32)) / clu_size32(fat32); /* data cluster in partition */
-			buf = malloc(0x04);																																			/* buffer für entry allokieren... */
-			fat_buf = malloc(fat_size32(fat32));							  																		/* buffer für FAT allokieren... */
-      
-			device_read(ctx, fat_buf, (fat_size32(fat32)), (storage * SECTOR_SIZE) + fat1_off32(fat32));
-			
-			for(i = 0; i < data_clu; i ++) {				  																		          /* free cluster zählen... */
-				memcpy(buf, fat_buf + (i * 4), 0x04);
-						
-				add = (struct f_entry*)buf;
-						
-				if(add->entry == 0x00000000)
-					count++;
-			}
-			
-			free_byte = count * clu_size32(fat32);
-			
-			free(add);
-			free(fat_buf);
-			return free_byte;
+		default:
+			for(i = first, p = buf; i < last; i++, p += 4)
+				t->entry[i] = (p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24)) & 0x0FFFFFFF;
 		break;
 	}
 	
-	return 0;
+	free(buf);
+	t->loaded[r] = 1;
 }
 /***********************************************************************
-* Get cluster count of a chain.
+* Read all regions of a FAT that are not loaded yet.
+* 
+* ps3_context *ctx = ps3 device information
+* fat_table *t     = FAT table
+***********************************************************************/
+static void fat_load_table(ps3_context *ctx, fat_table *t)
+{
+	u32 r;
+	
+	EnterCriticalSection(&ctx->fat_lock);
+	for(r = 0; r < t->n_region; r++)
+		if(!t->loaded[r])
+			fat_load_region(ctx, t, r);
+	LeaveCriticalSection(&ctx->fat_lock);
+}
+/***********************************************************************
+* Get a FAT entry, the next cluster of a chain.
+* 
+* ps3_context *ctx  = ps3 device information
+* fat_table *t      = FAT table
+* fat_add_t cluster = cluster
+* 
+* return: entry, end of chain for clusters outside the FAT
+***********************************************************************/
+static fat_add_t fat_next_cluster(ps3_context *ctx, fat_table *t, fat_add_t cluster)
+{
+	fat_add_t ret;
+	
+	if(cluster >= t->count)
+		return 0x0FFFFFFF;
+	
+	EnterCriticalSection(&ctx->fat_lock);
+	if(!t->loaded[cluster / FAT_TABLE_REGION])
+		fat_load_region(ctx, t, cluster / FAT_TABLE_REGION);
+	ret = t->entry[cluster];
+	LeaveCriticalSection(&ctx->fat_lock);
+	
+	return ret;
+}
+/***********************************************************************
+* Check if a FAT entry ends a chain, bad and reserved values do too.
+* 
+* fat_table *t  = FAT table
+* fat_add_t add = entry
+***********************************************************************/
+static BOOL fat_is_last(fat_table *t, fat_add_t add)
+{
+	if(add < 2)
+		return TRUE;
+	
+	switch(t->type) {
+		case 12: return add >= 0x00000FF7;
+		case 16: return add >= 0x0000FFF7;
+	}
+	
+	return add >= 0x0FFFFFF7;
+}
+/***********************************************************************
+* Free a parsed directory.
+***********************************************************************/
+static void fat_free_dir(fat_dir *d)
+{
+	free(d->e);
+	free(d->sfn);
+	free(d->hash);
+	free(d->chain);
+	free(d);
+}
+/***********************************************************************
+* Free the FAT tables and parsed directories of all volumes.
+* 
+* ps3_context *ctx = ps3 device information
+***********************************************************************/
+void fat_free_tables(ps3_context *ctx)
+{
+	fat_table *t, *next;
+	fat_dir *d, *next_dir;
+	
+	for(t = ctx->fat_tables; t; t = next) {
+		next = t->next;
+		for(d = t->dirs; d; d = next_dir) {
+			next_dir = d->next;
+			fat_free_dir(d);
+		}
+		free(t->entry);
+		free(t->loaded);
+		free(t);
+	}
+	
+	ctx->fat_tables = NULL;
+}
+/***********************************************************************
+* Count zero entries of a decoded FAT, 8 entries per step with AVX2.
+* 
+* const u32 *e = entries
+* u32 n        = entry count
+***********************************************************************/
+__attribute__((target("avx2")))
+static u64 fat_count_free_avx2(const u32 *e, u32 n)
+{
+	u32 i;
+	u64 count = 0;
+	__m256i zero = _mm256_setzero_si256();
+	
+	for(i = 0; i + 8 <= n; i += 8)
+		count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(
+		           _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(e + i)), zero))));
+	
+	for(; i < n; i++)
+		if(e[i] == 0)
+			count++;
+	
+	return count;
+}
+/***********************************************************************
+* Count zero entries of a decoded FAT.
+* 
+* const u32 *e = entries
+* u32 n        = entry count
+***********************************************************************/
+static u64 fat_count_free(const u32 *e, u32 n)
+{
+	u32 i;
+	u64 count = 0;
+	
+	if(__builtin_cpu_supports("avx2"))
+		return fat_count_free_avx2(e, n);
+	
+	for(i = 0; i < n; i++)
+		if(e[i] == 0)
+			count++;
+	
+	return count;
+}
+/***********************************************************************
+* Get the free cluster count from the FAT32 FSInfo sector.
+* 
+* ps3_context *ctx       = ps3 device information
+* u64 storage						 = partition
+* struct fat32_bs *fat32 = Fat32 bootsector
+* u64 data_clu           = data cluster in partition
+* 
+* return: free cluster count, -1 if FSInfo is missing or not valid
+***********************************************************************/
+static s64 fat32_info_free(ps3_context *ctx, u64 storage, struct fat32_bs *fat32, u64 data_clu)
+{
+	struct fat32_info info;
+	
+	if(fat32->bs32_fsinfo == 0 || fat32->bs32_fsinfo == 0xFFFF || fat32->bs32_fsinfo >= fat32->bs_rsec)
+		return -1;
+	
+	device_read(ctx, (u8*)&info, sizeof(info), (storage * SECTOR_SIZE) + (fat32->bs32_fsinfo * fat32->bs_ssize));
+	
+	if(info.i_m1 != FAT32_INFO_SIG_1 || info.i_m2 != FAT32_INFO_SIG_2 || info.i_sig != FAT32_SEC_SIG)
+		return -1;
+	
+	// 0xFFFFFFFF means unknown
+	if(info.i_fclu > data_clu)
+		return -1;
+	
+	return info.i_fclu;
+}
+/***********************************************************************
+* Return the size of the free memory in the file system. FAT32 uses
+* the FSInfo count if valid, else the FAT is read and counted.
+* 
+* ps3_context *ctx = ps3 device information
+* u64 storage						 = partition
+* struct fat_bs *fat_fs  = Fat12/16 bootsector
+* struct fat32_bs *fat32 = Fat32 bootsector
+***********************************************************************/
+u64 fat_how_many_free_bytes(ps3_context *ctx, u64 storage, struct fat_bs *fat, struct fat32_bs *fat32)
+{
+	s64 count;
+	u64 data_clu, cluster_size;
+	fat_table *t;
+	
+	if(fat) {
+		data_clu = ((fat->bs_tsec + fat->bs_nrsec) * fat->bs_ssize - data_off(fat)) / clu_size(fat); /* data cluster in partition */
+		cluster_size = clu_size(fat);
+	}
+	else {
+		data_clu = (fat32->bs_nrsec * fat32->bs_ssize - data_off32(fat32)) / clu_size32(fat32);     /* data cluster in partition */
+		cluster_size = clu_size32(fat32);
+		
+		if((count = fat32_info_free(ctx, storage, fat32, data_clu)) >= 0)
+			return count * cluster_size;
+	}
+	
+	t = fat_get_table(ctx, storage, fat, fat32);
+	fat_load_table(ctx, t);
+	
+	// data clusters are numbered from 2
+	if(data_clu + 2 > t->count)
+		data_clu = (t->count > 2) ? t->count - 2 : 0;
+	count = fat_count_free(t->entry + 2, data_clu);                 /* free cluster zählen... */
+	
+	return count * cluster_size;
+}
+/***********************************************************************
+* Get the cluster list of a chain, the FAT is walked in memory.
 * 
 * ps3_context *ctx       = ps3 device information
 * u64 storage						 = partition
@@ -207,154 +415,39 @@ u64 fat_how_many_free_bytes(ps3_context *ctx, u64 storage, struct fat_bs *fat, s
 ***********************************************************************/
 fat_clu_list* fat_get_cluster_list(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct fat32_bs *fat32, fat_add_t cluster)
 {
-	s32 i, fat_typ;
-	u32 count = 0;
-	fat_add_t tmp = cluster;
-	struct f_entry *add;
-	u8 *buf = malloc(0x04);
-	u32 *clu_list;
-	fat_clu_list *list = NULL;
+	u32 max = 16;
+	fat_add_t tmp;
+	fat_table *t;
+	fat_clu_list *list = malloc(sizeof(*list));
+	
+	// FAT12/16 root dir is outside the data area
+	if(fat_fs && cluster == 0) {
+		list->count = root_size(fat_fs) / clu_size(fat_fs);
+		list->clu_add = malloc((list->count + 1) * sizeof(*list->clu_add));
+		list->clu_add[0] = 0;
+		return list;
+	}
 	
+	if(fat32 && cluster == 0)
+		cluster = 2;
 	
-	if(fat_fs) {
-		fat_typ = get_fat_type(fat_fs);
-		
-		switch(fat_typ) {
-			case 12: 
-				if(cluster == 0) {	 
-					count = root_size(fat_fs) / clu_size(fat_fs);
-					clu_list = malloc(count * sizeof(*clu_list));
-					clu_list = malloc(sizeof(*clu_list));
-					list = malloc(sizeof(*list));
-					list->clu_add = clu_list;
-					list->count = count;
-					clu_list[0] = 0;
-					return list;
-				}
-			
-				for(i = 0;; i++) {	 
-					device_read(ctx, buf, 0x02, (storage * SECTOR_SIZE) + fat12_e(fat_fs, tmp));
-					
-					add = (struct f_entry*)buf; 
-					if((tmp % 2) == 0) {add->entry = add->entry & 0x00000FFF;} 
-					else {add->entry = add->entry >> 4 & 0x00000FFF;}
-					add->entry &= 0x00000FFF;
-				
-					tmp = add->entry; 
-					count++; 
-				
-					if(add->entry == 0x00000FFE || add->entry == 0x00000FFF) 
-						break;
-				}
-				
-				clu_list = malloc(count * sizeof(*clu_list)); 
-				list = malloc(sizeof(*list));	 
-				list->clu_add = clu_list; 
-				list->count = count; 
-			
-				tmp = cluster; 
-					
-				for(i = 0; i < count; i++) { 
-					clu_list[i] = tmp; 
-					
-					device_read(ctx, buf, 0x02, (storage * SECTOR_SIZE) + fat12_e(fat_fs, tmp));
-					
-					if((tmp % 2) == 0) {add->entry = add->entry & 0x00000FFF;}	 
-					else {add->entry = add->entry >> 4 & 0x00000FFF;}
-					
-					add = (struct f_entry*)buf;	 
-					tmp = add->entry; 
-					
-					if(add->entry == 0x00000FFE || add->entry == 0x00000FFF) 
-						break;
-				}	
-			break;
-			case 16: 
-				if(cluster == 0) {	 
-					count = root_size(fat_fs) / clu_size(fat_fs);
-					clu_list = malloc(count * sizeof(*clu_list));
-					clu_list = malloc(sizeof(*clu_list));
-					list = malloc(sizeof(*list));
-					list->clu_add = clu_list;
-					list->count = count;
-					clu_list[0] = 0;
-					return list;
-				}
-				
-				for(i = 0;; i++) {	 
-					device_read(ctx, buf, 0x02, (storage * SECTOR_SIZE) + fat16_e(fat_fs, tmp));	
-
-					add = ((struct f_entry*)buf); 
-					add->entry &= 0x0000FFFF; 
-					tmp = add->entry; 
-					
-					count++; 
-					
-					if(add->entry == 0x0000FFFE || add->entry == 0x0000FFFF) 
-						break;
-				}
-			
-				clu_list = malloc(count * sizeof(*clu_list)); 
-				list = malloc(sizeof(*list)); 
-				list->clu_add = clu_list; 
-				list->count = count;  
-			
-				tmp = cluster; 
-				
-				for(i = 0; i < count; i++) {	 
-					clu_list[i] = tmp; 
-					
-					device_read(ctx, buf, 0x02, (storage * SECTOR_SIZE) + fat16_e(fat_fs, tmp));
-					
-					add = (struct f_entry*)buf;	 
-					tmp = add->entry; 
-				
-					if(add->entry == 0x0000FFFE || add->entry == 0x0000FFFF) 
-					break;
-				}
-			break;
-		}	
+	t = fat_get_table(ctx, storage, fat_fs, fat32);
 	
-	return list;
-	}
-	else {  
-		
-		if(cluster == 0){	 
-			cluster = 2;
-		}
-		
-		for(i = 0;; i++){	 
-			device_read(ctx, buf, 0x04, (storage * SECTOR_SIZE) + fat32_e(fat32, tmp));
-			
-			add = ((struct f_entry*)buf);	 
-			tmp = add->entry; 
-			count++; 
-					
-			if(add->entry == 0x0FFFFFFE || add->entry == 0x0FFFFFFF) 
-				break;
-		}
-		
-		clu_list = malloc(count * sizeof(*clu_list)); 
-		list = malloc(sizeof(*list));	 
-		list->clu_add = clu_list;	 
-		list->count = count;  
-			
-		tmp = cluster; 
-		
-		for(i = 0; i < count; i++) {	 
-			clu_list[i] = tmp; 
-			
-			device_read(ctx, buf, 0x04, (storage * SECTOR_SIZE) + fat32_e(fat32, tmp));
-			
-			add = (struct f_entry*)buf;	 
-			tmp = add->entry;	 
-				
-			if(add->entry == 0x0FFFFFFE || add->entry == 0x0FFFFFFF) 
-			break;
+	list->clu_add = malloc(max * sizeof(*list->clu_add));
+	list->clu_add[0] = cluster;
+	list->count = 1;
+	
+	// a chain longer than the FAT is a loop
+	for(tmp = fat_next_cluster(ctx, t, cluster); !fat_is_last(t, tmp) && list->count < t->count; 
+	    tmp = fat_next_cluster(ctx, t, tmp)) {
+		if(list->count == max) {
+			max *= 2;
+			list->clu_add = realloc(list->clu_add, max * sizeof(*list->clu_add));
 		}
-		
-		return list;
+		list->clu_add[list->count++] = tmp;
 	}
+	
+	return list;
 }
 /***********************************************************************
 * Free a cluster list.
@@ -367,7 +460,7 @@ void fat_free_cluster_list(fat_clu_list *list)
 	free(list);
 }
 /***********************************************************************
-* Read all cluster of a chain.
+* Read all cluster of a chain, consecutive clusters with one read.
 * 
 * ps3_context *ctx       = ps3 device information
 * u64 storage						 = partition
@@ -382,104 +475,38 @@ void fat_free_cluster_list(fat_clu_list *list)
 ***********************************************************************/
 s32 fat_read_cluster(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct fat32_bs *fat32, fat_clu_list *list, u8 *buf, u32 start, u32 count)
 {
-	s32 i;
+	u32 i, j;
+	s64 size = fat_fs ? clu_size(fat_fs) : clu_size32(fat32);
 	
 	
-	if(fat_fs) {
-		if(list) {
-			if(list->clu_add[0] == 0) { 
-				for(i = 0; i < list->count; i++)
-					device_read(ctx, buf + (i * clu_size(fat_fs)), clu_size(fat_fs), (storage * SECTOR_SIZE) + root_off(fat_fs) + (i * clu_size(fat_fs)));
-				return i;
-			}
-			
-			if(list->clu_add[0] >= 2) {  
-				for(i = 0; i < list->count; i++)
-					device_read(ctx, buf + (i * clu_size(fat_fs)), clu_size(fat_fs), (storage * SECTOR_SIZE) + clu_off(fat_fs, list->clu_add[i]));
-				return i;	
-			}
+	if(list) {
+		// FAT12/16 root dir lies in one piece before the data area
+		if(fat_fs && list->clu_add[0] == 0) { 
+			device_read(ctx, buf, list->count * size, (storage * SECTOR_SIZE) + root_off(fat_fs));
+			return list->count;
 		}
 		
-		for(i = 0; i < count; i++)
-			device_read(ctx, buf + (i * clu_size(fat_fs)), clu_size(fat_fs), (storage * SECTOR_SIZE) + clu_off(fat_fs, start));
-		return i;
-	}
-	else {
-		if(list) {
-			if(list->clu_add[0] >= 2) { 
-				for(i = 0; i < list->count; i++)
-					device_read(ctx, buf + (i * clu_size32(fat32)), clu_size32(fat32), (storage * SECTOR_SIZE) + clu_off32(fat32, list->clu_add[i]));
-				return i;	
-			}
-		}
-		
-		for(i = 0; i < count; i++)
-			device_read(ctx, buf + (i * clu_size32(fat32)), clu_size32(fat32), (storage * SECTOR_SIZE) + clu_off32(fat32, start));
-		
-		return i;
-	}
-}
-/***********************************************************************
-* Determines the number of clusters in a dir.
-* 
-* u8 *clusters = entry data
-* 
-* return: number of clusters
-***********************************************************************/
-s32 fat_get_entry_count(u8 *clusters)
-{
-	s32 i;
-	u8 c, cs1, cs2, seq;
-	u8 *p = clusters;
-	u8 *tmp = malloc(0x20);
-	struct sfn_e *sfn;
-	
-	c = cs1 = cs2 = seq = 0;
-	
-	
-	while(*p != 0x00) {  
-		if(*p != 0xE5) { 
-			p += 0x0B; 
-			
-			if(*p == 0x0F) {	 
-				p += 0x02; 
-				cs1 = *p; 
-				p -= 0x0D; 
-				seq = *p & 0x1F; 
-			
-				for(i = 0; i < seq; i++) {	 
-					p += 0x0D; 
+		if(list->clu_add[0] >= 2) {
+			// one read per run of consecutive clusters
+			for(i = 0; i < list->count; i = j) {
+				for(j = i + 1; j < list->count && list->clu_add[j] == list->clu_add[j - 1] + 1; j++);
 				
-					if(*p == cs1) { 
-						p -= 0x0D; 
-						p += 0x20; 
-					}
-				}
-				memcpy(tmp, p, 0x20); 
-				sfn = (struct sfn_e*)tmp;
-			
-				for (i = 0; i < 11; i++) { 
-					cs2 = ((cs2 & 0x01) ? 0x80 : 0) + (cs2 >> 1);
-					cs2 = cs2 + sfn->d_name[i];
-				}
-			
-				if(cs2 == cs1) { 
-					c++; 
-				}
-				cs2 = 0;
+				if(fat_fs)
+					device_read(ctx, buf + (i * size), (j - i) * size, (storage * SECTOR_SIZE) + clu_off(fat_fs, list->clu_add[i]));
+				else
+					device_read(ctx, buf + (i * size), (j - i) * size, (storage * SECTOR_SIZE) + clu_off32(fat32, list->clu_add[i]));
 			}
-			else { 
-				p -= 0x0B; 
-				c++; 
-			}
-			p += 0x20; 
-		}
-		else {
-			p += 0x20; 
+			return i;
 		}
 	}
 	
-	return c; 
+	// count consecutive clusters from start
+	if(fat_fs)
+		device_read(ctx, buf, count * size, (storage * SECTOR_SIZE) + clu_off(fat_fs, start));
+	else
+		device_read(ctx, buf, count * size, (storage * SECTOR_SIZE) + clu_off32(fat32, start));
+	
+	return count;
 }
 /***********************************************************************
 * get LFN entrie name
@@ -538,294 +565,281 @@ s32 get_sfn_name(u8 *sfn_name, u8 *name)
 	return -1;
 }
 /***********************************************************************
-* Funktion: fat_get_entry_list, erstellt eine puffer mit allen entries
-* plus daten.
-* 	u8 *cluster = fat-cluster/s mit entry daten.
-* 	u8 *name    = entry name der gesucht wird.
+* Hash of an entry name, FNV-1a.
+***********************************************************************/
+static u32 fat_name_hash(const char *name)
+{
+	u32 h = 0x811C9DC5;
+	
+	for(; *name; name++) {
+		h ^= (u8)*name;
+		h *= 0x01000193;
+	}
+	
+	return h;
+}
+/***********************************************************************
+* Put a name into the hash index of a directory.
+* 
+* fat_dir *d  = directory
+* s32 slot    = entry number, plus count for the short name
+***********************************************************************/
+static void fat_dir_hash_add(fat_dir *d, s32 slot, const char *name)
+{
+	u32 h = fat_name_hash(name) & (d->n_hash - 1);
+	
+	d->chain[slot] = d->hash[h];
+	d->hash[h] = slot;
+}
+/***********************************************************************
+* Decode the entries of a directory in one pass. LFN parts are put
+* together as they come and only used if their checksum matches the
+* short entry that follows them. Every long name and the short name
+* of entries that have one are put into a hash index.
+* 
+* u8 *buf = directory clusters
+* u64 len = byte count of buf
+* 
+* return: directory
 ***********************************************************************/
-s32 fat_dir_search_entry(u8 *cluster, u8 *s_name, u8 *tmp)
+static fat_dir* fat_parse_dir(u8 *buf, u64 len)
 {
-	s32 i, x, y;
-	u16 n_len;
-	u8 *e_ptr = cluster;
-	u8 cs_1, cs_2, seq;
-	char part[M_LFN_LENGTH] = {0};
-	char lfname[M_LFN_ENTRIES][M_LFN_LENGTH];
-	char name[260];
+	s32 i, ord;
+	u8 cs, lfn_cs = 0;
+	BOOL have_lfn = FALSE;
+	u8 *p;
+	char part[M_LFN_LENGTH];
+	char lfn[M_NAME_LENGTH + 1];
+	char sfn_name[M_NAME_LENGTH + 1];
 	struct sfn_e *sfn;
+	struct fat_dir_entry *e;
+	u32 max = 0;
+	fat_dir *d = malloc(sizeof(*d));
 	
-	cs_1 = cs_2 = seq = n_len = 0;
-	for(x = 0; x < M_LFN_ENTRIES; x++)
-		for(y = 0; y < M_LFN_LENGTH; y++)
-			lfname[x][y] = 0x00;
+	memset(d, 0, sizeof(*d));
 	
-	e_ptr = cluster;
-	while(*e_ptr != 0x00) { 
-		if(*e_ptr != 0xE5) { 
-			e_ptr += 0x0B; 
+	for(p = buf; p + ENTRY_SIZE <= buf + len && *p != N_LAST; p += ENTRY_SIZE) {
+		if(*p == N_DELET) {
+			have_lfn = FALSE;
+			continue;
+		}
 		
-		if(*e_ptr == 0x0F) {	 
-			e_ptr += 0x02; 
-			cs_2 = *e_ptr; 
-			e_ptr -= 0x0D; 
-			seq = *e_ptr & 0x1F; 
-			
-			for(i = 0; i < seq; i++) { 
-				memcpy(tmp, e_ptr, 0x20);	 
-				
-				if(tmp[0x0D] == cs_2) { 
-					get_lfn_name(tmp, part);
-					strncpy(lfname[seq - 1 - i], part, 13);
-					e_ptr += 0x20;
-				}
-			}
-			
-			memcpy(tmp, e_ptr, 0x20); 
-			sfn = (struct sfn_e*)tmp;
-			
-			for (i = 0; i < 11; i++) { 
-				cs_1 = ((cs_1 & 0x01) ? 0x80 : 0) + (cs_1 >> 1);
-				cs_1 = cs_1 + sfn->d_name[i];
+		// long name part, the last one comes first
+		if(p[0x0B] == A_L_NAME) {
+			if(*p & 0x40) {
+				memset(lfn, 0, sizeof(lfn));
+				lfn_cs = p[0x0D];
+				have_lfn = TRUE;
 			}
-
-			if(cs_1 == cs_2) {	 
-				cs_1 = 0;						 
-				memcpy(name, lfname, 260); 
-				
-				for(x = 0; x < M_LFN_ENTRIES; x++) 
-					for(y = 0; y < M_LFN_LENGTH; y++)
-						lfname[x][y] = 0x00;
-				
-				if(strcmp(name, (const char *)s_name) == 0) { 
-					return sfn->d_start_clu;
-				}
+			else if(p[0x0D] != lfn_cs) {
+				have_lfn = FALSE;
 			}
-		}
-		else if(*e_ptr != 0x0F) { 
-			e_ptr -= 0x0B;
-			memcpy(tmp, e_ptr, 0x20); 
-			sfn = (struct sfn_e*)tmp;
-			get_sfn_name(sfn->d_name, (u8*)name); 
 			
-			if(strcmp(name, (const char *)s_name) == 0) { 
-				return sfn->d_start_clu;
+			ord = *p & 0x1F;
+			if(have_lfn && ord >= 1 && ord <= M_LFN_ENTRIES) {
+				get_lfn_name(p, part);
+				memcpy(lfn + ((ord - 1) * M_LFN_LENGTH), part, M_LFN_LENGTH);
 			}
+			continue;
 		}
-			e_ptr += 0x20; 
-		} 
-		else {
-			e_ptr += 0x20;
+		
+		sfn = (struct sfn_e*)p;
+		for(i = 0, cs = 0; i < 11; i++)
+			cs = ((cs & 0x01) ? 0x80 : 0) + (cs >> 1) + sfn->d_name[i];
+		
+		if(d->count == max) {
+			max = max ? max * 2 : 64;
+			d->e   = realloc(d->e, max * sizeof(*d->e));
+			d->sfn = realloc(d->sfn, max * sizeof(*d->sfn));
 		}
+		e = &d->e[d->count];
+		memcpy(&d->sfn[d->count], sfn, sizeof(*sfn));
+		
+		memcpy(e->fd_dos_name, sfn->d_name, 11);
+		e->fd_att       = sfn->d_att;
+		e->fd_case      = sfn->d_case;
+		e->fd_ctime_ms  = sfn->d_ctime_ms;
+		e->fd_ctime     = sfn->d_ctime;
+		e->fd_cdate     = sfn->d_cdate;
+		e->fd_atime     = sfn->d_atime;
+		e->fd_adate     = sfn->d_adate;
+		e->fd_mtime     = sfn->d_mtime;
+		e->fd_mdate     = sfn->d_mdate;
+		e->fd_start_clu = sfn->d_start_clu;
+		e->fd_size      = sfn->d_size;
 		
+		if(have_lfn && cs == lfn_cs)
+			memcpy(e->fd_name, lfn, M_NAME_LENGTH + 1);
+		else
+			get_sfn_name(sfn->d_name, e->fd_name);
+		e->fd_name[M_NAME_LENGTH] = '\0';
+		
+		have_lfn = FALSE;
+		d->count++;
 	}
-	return -1;
+	
+	// index, long names in slot i, short names in slot count + i
+	for(d->n_hash = 16; d->n_hash < d->count * 2; d->n_hash *= 2);
+	d->hash  = malloc(d->n_hash * sizeof(*d->hash));
+	d->chain = malloc((d->count * 2 + 1) * sizeof(*d->chain));
+	memset(d->hash, 0xFF, d->n_hash * sizeof(*d->hash));
+	
+	for(i = 0; i < d->count; i++) {
+		fat_dir_hash_add(d, i, (char*)d->e[i].fd_name);
+		get_sfn_name(d->e[i].fd_dos_name, (u8*)sfn_name);
+		if(strcmp(sfn_name, (char*)d->e[i].fd_name) != 0)
+			fat_dir_hash_add(d, d->count + i, sfn_name);
+	}
+	
+	return d;
 }
 /***********************************************************************
-* Funktion: fat_lookup_path, gibt cluster-adresse eines files oder dirs
-* 					zurück, oder 0 wenn file/dir nicht existiert.
-* 	HANDLE device         = device-handle
-* 	u64 storage						= partition
-* 	struct fat_bs *fat_fs = struct fat_fs
-* 	u8 *path 		    	    = gesuchter pfad
-* 	fat_add_t fat_root    = root-verzeichniss, ab diesem verzeichniss
-* 													soll gesucht werden. wenn 0, wird vom ROOT
-* 													des fs ausgegangen.
+* Get a parsed directory, it is read and decoded once per volume and
+* start cluster.
+* 
+* ps3_context *ctx       = ps3 device information
+* u64 storage						 = partition
+* struct fat_bs *fat_fs  = Fat12/16 bootsector
+* struct fat32_bs *fat32 = Fat32 bootsector
+* fat_add_t cluster		   = start cluster, 0 for FAT12/16 root
 ***********************************************************************/
-struct sfn_e* fat_lookup_path(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct fat32_bs *fat32, u8 *path, fat_add_t fat_root)
+fat_dir* fat_open_dir(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct fat32_bs *fat32, fat_add_t cluster)
 {
-	s32 ret;
-	u8 *str, *n_str, *clu_data;
-	fat_add_t cluster;
-	fat_add_t tmp_clu = 0; 
-	fat_clu_list *list; 
-	struct sfn_e *entry;
-	u8 *s_entry = malloc(0x20);
+	u64 len;
+	u8 *buf;
+	fat_dir *d, *cached;
+	fat_clu_list *list;
+	fat_table *t = fat_get_table(ctx, storage, fat_fs, fat32);
 	
+	EnterCriticalSection(&ctx->fat_lock);
+	for(d = t->dirs; d; d = d->next)
+		if(d->start_clu == cluster)
+			break;
+	LeaveCriticalSection(&ctx->fat_lock);
 	
-	str = malloc(MAX_PATH); 
+	if(d)
+		return d;
 	
-	if(fat_fs) {
-		if(path[0] == '/') {	 
-			memcpy(str, &path[1], strlen((char*)path));	 
-			cluster = 0; 
-		}
-    
-	  for(n_str = str; n_str && n_str[0]; n_str = str) {
-		  if((str = memchr(str, 0x2F, strlen((char*)str)))) {
-			  *str = '\0';
-			  str++;
-		  }
-    
-		  tmp_clu = cluster;
-      
-		  list = fat_get_cluster_list(ctx, storage, fat_fs, 0, tmp_clu);	 
-		  clu_data = malloc(list->count * clu_size(fat_fs));	 
-		  fat_read_cluster(ctx, storage, fat_fs, 0, list, clu_data, 0, 0); 
-		  fat_free_cluster_list(list); 
-			
-		  ret = fat_dir_search_entry(clu_data, n_str, s_entry);
-			
-		  if(ret != -1) { 
-			  cluster = ret; 
-		  }
-		  else {	 
-			  free(clu_data);
-			  return NULL;
-		  }	
-	  }
-	  
-	  entry = (struct sfn_e*)s_entry; 
-	  
-	  free(clu_data);
-	  return entry;
+	list = fat_get_cluster_list(ctx, storage, fat_fs, fat32, cluster);
+	len  = list->count * (fat_fs ? clu_size(fat_fs) : clu_size32(fat32));
+	buf  = malloc(len);
+	fat_read_cluster(ctx, storage, fat_fs, fat32, list, buf, 0, 0);
+	fat_free_cluster_list(list);
+	
+	d = fat_parse_dir(buf, len);
+	d->start_clu = cluster;
+	free(buf);
+	
+	// another thread may have parsed it meanwhile
+	EnterCriticalSection(&ctx->fat_lock);
+	for(cached = t->dirs; cached; cached = cached->next)
+		if(cached->start_clu == cluster)
+			break;
+	if(cached == NULL) {
+		d->next = t->dirs;
+		t->dirs = d;
 	}
-	else {
-		
-		if(path[0] == '/') {	 
-			memcpy(str, &path[1], strlen((char*)path)); 
-			cluster = 2; 
+	LeaveCriticalSection(&ctx->fat_lock);
+	
+	if(cached) {
+		fat_free_dir(d);
+		return cached;
+	}
+	
+	return d;
+}
+/***********************************************************************
+* Find an entry of a parsed directory by long or short name.
+* 
+* fat_dir *d       = directory
+* const char *name = entry name
+* 
+* return: entry number or -1
+***********************************************************************/
+s32 fat_dir_find(fat_dir *d, const char *name)
+{
+	s32 slot;
+	char sfn_name[M_NAME_LENGTH + 1];
+	
+	for(slot = d->hash[fat_name_hash(name) & (d->n_hash - 1)]; slot >= 0; slot = d->chain[slot]) {
+		if(slot < d->count) {
+			if(strcmp((char*)d->e[slot].fd_name, name) == 0)
+				return slot;
 		}
-
-		for(n_str = str; n_str && n_str[0]; n_str = str) {
-			if((str = memchr(str, 0x2F, strlen((char*)str)))) {
-				*str = '\0';
-				str++;
-			}
-			
-			tmp_clu = cluster;
-      
-			list = fat_get_cluster_list(ctx, storage, 0, fat32, tmp_clu); 
-			clu_data = malloc(list->count * clu_size32(fat32)); 
-			fat_read_cluster(ctx, storage, 0, fat32, list, clu_data, 0, 0); 
-			fat_free_cluster_list(list); 
-			
-			ret = fat_dir_search_entry(clu_data, n_str, s_entry);
-			
-			if(ret != -1) { 
-				cluster = ret;
-			}
-			else { 
-				free(clu_data);
-				return NULL;
-			}
+		else {
+			get_sfn_name(d->e[slot - d->count].fd_dos_name, (u8*)sfn_name);
+			if(strcmp(sfn_name, name) == 0)
+				return slot - d->count;
 		}
-		
-		entry = (struct sfn_e*)s_entry; 
-		
-		if(entry->d_start_clu == 0)
-			entry->d_start_clu = 2;
-		
-		free(str);
-		free(clu_data);
-		return entry;
 	}
+	
+	return -1;
 }
 /***********************************************************************
-* Funktion: fat_get_entries, erstellt eine puffer mit metadaten aller
-* entries.
-* 	u8 *in  									 = puffer mit roh entry daten.
-* 	struct fat_dir_entry *dirs = struct array für entries.
+* Funktion: fat_lookup_path, gibt den entry eines files oder dirs
+* 					zurück, oder NULL wenn file/dir nicht existiert.
+* 	ps3_context *ctx       = ps3 device information
+* 	u64 storage						 = partition
+* 	struct fat_bs *fat_fs  = Fat12/16 bootsector
+* 	struct fat32_bs *fat32 = Fat32 bootsector
+* 	u8 *path 		    	     = gesuchter pfad
+* 	fat_add_t fat_root     = root-verzeichniss, ab diesem verzeichniss
+* 													 soll gesucht werden. wenn 0, wird vom ROOT
+* 													 des fs ausgegangen.
 ***********************************************************************/
-s32 fat_get_entries(u8 *buf, struct fat_dir_entry *dirs)
+struct sfn_e* fat_lookup_path(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct fat32_bs *fat32, u8 *path, fat_add_t fat_root)
 {
-	s32 i, k, l, m;
-	u8 cs_1, cs_2, sq;
-	u8 *e_ptr = buf;
-	u8 *tmp = malloc(0x20);
-	char lfname[M_LFN_ENTRIES][M_LFN_LENGTH];
-	char part[M_LFN_LENGTH] = {0};
-	char name[260];
-	struct sfn_e *sfn;
+	s32 n;
+	char *str, *n_str, *sorig;
+	fat_add_t cluster = fat_root;
+	fat_dir *d;
+	struct sfn_e *found = NULL, *entry;
 	
-	e_ptr = buf;
 	
-	cs_1 = cs_2 = sq = m = 0;
-	for(k = 0; k < M_LFN_ENTRIES; k++)
-		for(l = 0; l < M_LFN_LENGTH; l++)
-			lfname[k][l] = 0x00;
+	if(path[0] == '/' || cluster == 0)
+		cluster = fat_fs ? 0 : 2;
 	
-	while(*e_ptr != 0x00) {  
-		if(*e_ptr != 0xE5) { 
-			e_ptr += 0x0B; 
-			
-			if(*e_ptr == 0x0F) { 
-				e_ptr += 0x02; 
-				cs_2 = *e_ptr; 
-				e_ptr -= 0x0D; 
-				sq = *e_ptr & 0x1F; 
-			
-				for(i = 0; i < sq; i++) { 
-					memcpy(tmp, e_ptr, 0x20); 
-				
-					if(tmp[0x0D] == cs_2) { 
-						get_lfn_name(tmp, part); 
-						strncpy(lfname[sq - 1 - i], part, 13);
-						e_ptr += 0x20;
-					}
-				}
-				
-				memcpy(tmp, e_ptr, 0x20); 
-				sfn = (struct sfn_e*)tmp;
-				
-				for (i = 0; i < 11; i++) { 
-					cs_1 = ((cs_1 & 0x01) ? 0x80 : 0) + (cs_1 >> 1);
-					cs_1 = cs_1 + sfn->d_name[i];
-				}
-				
-				if(cs_1 == cs_2) { 
-					cs_1 = 0; 
-					memcpy(name, lfname, 260); 
-					
-					for(k = 0; k < M_LFN_ENTRIES; k++) 
-						for(l = 0; l < M_LFN_LENGTH; l++)
-							lfname[k][l] = 0x00;
-					
-					memcpy(dirs[m].fd_dos_name, sfn->d_name, 11);
-					dirs[m].fd_att 			 = sfn->d_att;
-					dirs[m].fd_case 		 = sfn->d_case;
-					dirs[m].fd_ctime_ms  = sfn->d_ctime_ms;
-					dirs[m].fd_ctime 		 = sfn->d_ctime;
-					dirs[m].fd_cdate 		 = sfn->d_cdate;
-					dirs[m].fd_atime 		 = sfn->d_atime;
-					dirs[m].fd_adate 	   = sfn->d_adate;
-					dirs[m].fd_mtime 	   = sfn->d_mtime;
-					dirs[m].fd_mdate 	   = sfn->d_mdate;
-					dirs[m].fd_start_clu = sfn->d_start_clu;
-					dirs[m].fd_size      = sfn->d_size;
-					memcpy(dirs[m].fd_name, name, 261);
-					m++;
-				}
-			}
-			else {
-				e_ptr -= 0x0B;
-				memcpy(tmp, e_ptr, 0x20);	 
-				sfn = (struct sfn_e*)tmp; 
-				memset(name, 0x00, 260); 
-				get_sfn_name(sfn->d_name, (u8*)name); 
-				
-				memcpy(dirs[m].fd_dos_name, sfn->d_name, 11);
-				dirs[m].fd_att 			 = sfn->d_att;
-				dirs[m].fd_case 		 = sfn->d_case;
-				dirs[m].fd_ctime_ms  = sfn->d_ctime_ms;
-				dirs[m].fd_ctime 		 = sfn->d_ctime;
-				dirs[m].fd_cdate 		 = sfn->d_cdate;
-				dirs[m].fd_atime 		 = sfn->d_atime;
-				dirs[m].fd_adate 	   = sfn->d_adate;
-				dirs[m].fd_mtime 	   = sfn->d_mtime;
-				dirs[m].fd_mdate 	   = sfn->d_mdate;
-				dirs[m].fd_start_clu = sfn->d_start_clu;
-				dirs[m].fd_size      = sfn->d_size;
-				memcpy(dirs[m].fd_name, name, 261);
-				m++;
-			}
-			e_ptr += 0x20; 
+	str = sorig = strdup((char*)path);
+	
+	for(n_str = str; n_str; n_str = str) {
+		if((str = strchr(str, 0x2F))) {
+			*str = '\0';
+			str++;
 		}
-		else {
-			e_ptr += 0x20; 
+		if(n_str[0] == '\0')
+			continue;
+		
+		// only dirs can have a next path component
+		if(found && (found->d_att & A_DIR) != A_DIR) {
+			free(sorig);
+			return NULL;
+		}
+		
+		d = fat_open_dir(ctx, storage, fat_fs, fat32, cluster);
+		
+		if((n = fat_dir_find(d, n_str)) == -1) {
+			free(sorig);
+			return NULL;
 		}
+		
+		found = &d->sfn[n];
+		cluster = found->d_start_clu;
+		if(fat32 && cluster == 0)
+			cluster = 2;
 	}
 	
-	return 0;
+	free(sorig);
+	
+	if(found == NULL)
+		return NULL;
+	
+	entry = malloc(sizeof(*entry));
+	memcpy(entry, found, sizeof(*entry));
+	
+	if(fat32 && entry->d_start_clu == 0)
+		entry->d_start_clu = 2;
+	
+	return entry;
 }
 /***********************************************************************
 * sortier function für directory entries
@@ -889,10 +903,10 @@ struct date_time fat_datetime_from_entry(u16 date, u16 time)
 s32 fat_print_dir_list(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct fat32_bs *fat32, u8 *path, u8 *volume, u64 free_byte)
 {	
 	s32 i, entry_count;
-	u8 *buffer;
 	u64 file_count, dir_count, byte_use, byte_free;
+	fat_add_t cluster;
+	fat_dir *d;
 	struct sfn_e *dir;
-	fat_clu_list *list;
 	struct fat_dir_entry *dirs;
 	struct date_time dt;
 	char timestr[64];
@@ -902,101 +916,27 @@ s32 fat_print_dir_list(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, str
 	file_count = dir_count = byte_use = byte_free = 0;
 	
 	
-	// welches dateisystem ?
-	
-  
-	
-	
-	
-	
-	
-	
-	
-	
-	
-	
-	
-	
-	
-	
-	if(fat_fs) {
-		if((strlen((char*)path)) == 1 && path[0] == 0x2F) {                       // if path == root
-			list = fat_get_cluster_list(ctx, storage, fat_fs, 0, 0); 
-			buffer = malloc(list->count * clu_size(fat_fs)); 
-			fat_read_cluster(ctx, storage, fat_fs, 0, list, buffer, 0, 0); 
-			fat_free_cluster_list(list); 
-			entry_count = fat_get_entry_count(buffer);	 
-			dirs = malloc(entry_count * sizeof(*dirs)); 
-			fat_get_entries(buffer, dirs); 
-			
-		}
-		else {
-			if((dir = fat_lookup_path(ctx, storage, fat_fs, 0, path, 0)) == NULL) {
-				printf("no such file or directory!\n");
-				return -1;
-			}
-      
-			if((dir->d_att & A_DIR) != A_DIR) {
-				printf("can't show, not a directory!\n");
-				return -1;
-			}
-		  
-			list = fat_get_cluster_list(ctx, storage, fat_fs, 0, dir->d_start_clu);	
-			buffer = malloc(list->count * clu_size(fat_fs));	
-			fat_read_cluster(ctx, storage, fat_fs, 0, list, buffer, 0, 0);	
-			fat_free_cluster_list(list);	
-			entry_count = fat_get_entry_count(buffer);	
-			dirs = malloc(entry_count * sizeof(*dirs));	
-			fat_get_entries(buffer, dirs);	
-		}
+	if((strlen((char*)path)) == 1 && path[0] == 0x2F) {                         // if path == root
+		cluster = fat_fs ? 0 : fat32->bs32_rootclu;
 	}
 	else {
-		if((strlen((char*)path)) == 1 && path[0] == 0x2F) {
-			list = fat_get_cluster_list(ctx, storage, 0, fat32, fat32->bs32_rootclu);	
-			buffer = malloc(list->count * clu_size32(fat32));	
-			fat_read_cluster(ctx, storage, 0, fat32, list, buffer, 0, 0);	
-			fat_free_cluster_list(list);	
-			entry_count = fat_get_entry_count(buffer);	
-			dirs = malloc(entry_count * sizeof(*dirs));	
-			fat_get_entries(buffer, dirs);	
-		}
-		else {
-			if((dir = fat_lookup_path(ctx, storage, 0, fat32, path, 0)) == NULL) {
-				printf("no such file or directory!\n");
-				return -1;
-			}
-		  
-			if((dir->d_att & A_DIR) != A_DIR) {
-				printf("can't show, not a directory!\n");
-				return -1;
-			}
-			
-			list = fat_get_cluster_list(ctx, storage, 0, fat32, dir->d_start_clu);
-			buffer = malloc(list->count * clu_size32(fat32));
-			fat_read_cluster(ctx, storage, 0, fat32, list, buffer, 0, 0);
-			fat_free_cluster_list(list);
-			entry_count = fat_get_entry_count(buffer);
-			dirs = malloc(entry_count * sizeof(*dirs));
-			fat_get_entries(buffer, dirs);
+		if((dir = fat_lookup_path(ctx, storage, fat_fs, fat32, path, 0)) == NULL)
+			return PS3HDD_ENOENT;
+		
+		if((dir->d_att & A_DIR) != A_DIR) {
+			free(dir);
+			return PS3HDD_ENOTDIR;
 		}
+		
+		cluster = dir->d_start_clu;
+		free(dir);
 	}
 	
-	
-	
-	
-	
-	
-	
-	
-	
-	
-	
-	
-	
-	
-	
-	
-	free(buffer);	 
+	// the cached entries keep their order, sort a copy
+	d = fat_open_dir(ctx, storage, fat_fs, fat32, cluster);
+	entry_count = d->count;
+	dirs = malloc((entry_count + 1) * sizeof(*dirs));
+	memcpy(dirs, d->e, entry_count * sizeof(*dirs));
 	
 	qsort(dirs, entry_count, sizeof(*dirs), sort_dir); 
 	
@@ -1031,6 +971,99 @@ s32 fat_print_dir_list(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, str
 	return 0;
 }
 /***********************************************************************
+* Funktion: fat_print_stat, zeigt den entry eines file/dir.
+* 	ps3_context *ctx       = ps3 device information
+* 	u64 storage						 = partitions start sektor
+* 	struct fat_bs *fat_fs  = struct fat_fs, wenn FAT12/16
+* 	struct fat32_bs *fat32 = struct fat32_bs, wenn FAT32
+* 	u8 *path 		    	     = pfad zum entry
+***********************************************************************/
+s32 fat_print_stat(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct fat32_bs *fat32, u8 *path)
+{
+	struct sfn_e *dir;
+	struct date_time dt;
+	char attstr[8];
+	char sizestr[32];
+	
+	
+	if((strlen((char*)path)) == 1 && path[0] == 0x2F) {                         // root has no entry
+		printf("  File: %s\n", path);
+		printf("  Type: directory\n");
+		printf("   Clu: %u\n", fat_fs ? 0 : fat32->bs32_rootclu);
+		return 0;
+	}
+	
+	if((dir = fat_lookup_path(ctx, storage, fat_fs, fat32, path, 0)) == NULL)
+		return PS3HDD_ENOENT;
+	
+	attstr[0] = (dir->d_att & A_DIR)      ? 'd' : '-';
+	attstr[1] = (dir->d_att & A_READONLY) ? 'r' : '-';
+	attstr[2] = (dir->d_att & A_HIDDEN)   ? 'h' : '-';
+	attstr[3] = (dir->d_att & A_SYSTEM)   ? 's' : '-';
+	attstr[4] = (dir->d_att & A_FILE)     ? 'a' : '-';
+	attstr[5] = '\0';
+	
+	print_commas(dir->d_size, sizestr);
+	printf("  File: %s\n", path);
+	printf("  Type: %s\n", (dir->d_att & A_DIR) ? "directory" : "regular file");
+	printf("  Attr: %s (0x%02X)\n", attstr, dir->d_att);
+	printf("   Clu: %u\n", dir->d_start_clu);
+	printf("  Size: %s bytes\n", sizestr);
+	
+	dt = fat_datetime_from_entry(dir->d_adate, 0);
+	printf("Access: %02d.%02d.%04d\n", dt.month, dt.day, dt.year + 1980);
+	dt = fat_datetime_from_entry(dir->d_mdate, dir->d_mtime);
+	printf("Modify: %02d.%02d.%04d  %02d:%02d:%02d\n", 
+			dt.month, dt.day, dt.year + 1980, dt.hour, dt.minutes, dt.seconds);
+	dt = fat_datetime_from_entry(dir->d_cdate, dir->d_ctime);
+	printf(" Birth: %02d.%02d.%04d  %02d:%02d:%02d\n", 
+			dt.month, dt.day, dt.year + 1980, dt.hour, dt.minutes, dt.seconds);
+	
+	free(dir);
+	return 0;
+}
+/***********************************************************************
+* Map the clusters of a file to hdd extents.
+* 
+* ps3_context *ctx       = ps3 device information
+* u64 storage						 = partition
+* struct fat_bs *fat_fs  = Fat12/16 bootsector
+* struct fat32_bs *fat32 = Fat32 bootsector
+* struct sfn_e *dir      = entry of the file
+* const char *dest       = output file name
+***********************************************************************/
+extract_file* fat_map_file(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct fat32_bs *fat32, struct sfn_e *dir, const char *dest)
+{
+	u32 i;
+	s64 totalsize = dir->d_size, readsize, read;
+	s64 size = fat_fs ? clu_size(fat_fs) : clu_size32(fat32);
+	fat_clu_list *list;
+	extract_file *file;
+	
+	
+	file = extract_file_new(dest, totalsize, fat2unix_time(dir->d_atime, dir->d_adate), fat2unix_time(dir->d_mtime, dir->d_mdate));
+	if(dir->d_att & A_READONLY)
+		file->mode = 0444;
+	
+	if(totalsize == 0)
+		return file;
+	
+	list = fat_get_cluster_list(ctx, storage, fat_fs, fat32, dir->d_start_clu);
+	
+	for(i = 0, readsize = 0; readsize < totalsize && i < list->count; i++) {
+		read = min(totalsize - readsize, size);
+		if(fat_fs)
+			extract_file_add(file, (storage * SECTOR_SIZE) + clu_off(fat_fs, list->clu_add[i]), read);
+		else
+			extract_file_add(file, (storage * SECTOR_SIZE) + clu_off32(fat32, list->clu_add[i]), read);
+		readsize += read;
+	}
+	
+	fat_free_cluster_list(list);
+	
+	return file;
+}
+/***********************************************************************
 * Funktion: fat_copy_data, kopiert files/folders ins programmverzeichnis.
 * 	HANDLE device          = device-handle
 * 	u64 storage						 = partitions start sektor
@@ -1038,21 +1071,20 @@ s32 fat_print_dir_list(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, str
 * 	struct fat32_bs *fat32 = struct fat32_bs, wenn FAT32
 * 	u8 *srcpath 		    	 = quelle
 * 	u8 *destpath					 = ziel
+* 	extract_job *job       = job that copies the files
 ***********************************************************************/
-s32 fat_copy_data(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct fat32_bs *fat32, char *srcpath, char *destpath)
+s32 fat_copy_data(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct fat32_bs *fat32, char *srcpath, char *destpath, extract_job *job)
 {
 	s32 i, entry_count;
-	u8 *buf;
 	char *tmp;
-	s64 totalsize, readsize, read;
+	s64 totalsize;
 	char string[MAX_PATH];
 	char newdest[MAX_PATH];
 	int using_con;
 	struct sfn_e *dir = NULL;	
-	fat_clu_list *list = NULL;
+	fat_dir *d;
 	struct fat_dir_entry *dirs;
-	struct utimbuf filetime;
-	FILE *out;
+	extract_file *file;
 	
 	
 	if(strlen(srcpath) == 1 && srcpath[0] == 0x2F)
@@ -1061,16 +1093,12 @@ s32 fat_copy_data(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct f
 	using_con = (destpath && (!Stricmp((const char *)destpath, "CON") || !(Strnicmp((const char *)destpath, "CON.", 4))));
   
 	if(fat_fs) {
-		if((dir = fat_lookup_path(ctx, storage, fat_fs, 0, (u8*)srcpath, 0)) == NULL) {
-			printf("can't copy, no such file or directory!\n");
-			return -1;
-		}
+		if((dir = fat_lookup_path(ctx, storage, fat_fs, 0, (u8*)srcpath, 0)) == NULL)
+			return PS3HDD_ENOENT;
 	}
 	else if(fat32) {
-		if((dir = fat_lookup_path(ctx, storage, 0, fat32, (u8*)srcpath, 0)) == NULL) {
-			printf("can't copy, no such file or directory!\n");
-			return -1;
-		}
+		if((dir = fat_lookup_path(ctx, storage, 0, fat32, (u8*)srcpath, 0)) == NULL)
+			return PS3HDD_ENOENT;
 	}
 	
 	if(destpath == NULL) {	 
@@ -1088,6 +1116,22 @@ s32 fat_copy_data(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct f
 	
 	totalsize = dir->d_size;
 	
+	// filtered out folders are not read, filtered out files get no cluster list
+	if(job->filter) {
+		if((dir->d_att & A_DIR) == A_DIR) {
+			if(!filter_want_dir(job->filter, srcpath)) {
+				free(dir);
+				return 0;
+			}
+		}
+		else if(!filter_want_file(job->filter, srcpath, totalsize, fat2unix_time(dir->d_mtime, dir->d_mdate))) {
+			free(dir);
+			return 0;
+		}
+		else if(!job->hash_only && !job->tar)
+			printf("copy -> %s\n", srcpath);
+	}
+	
 	if((dir->d_att & A_DIR) == A_DIR) {
 		char *dirdest;
 		char nextsrc[256] = {0x00};
@@ -1095,12 +1139,21 @@ s32 fat_copy_data(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct f
 		struct stat sb;
 		
 		if(using_con) {
-			return -1;
+			free(dir);
+			return PS3HDD_EISDIR;
 		}
 		
-		if(!stat(newdest, &sb)) {
+		if(job->hash_only || job->tar || job->filter) {
+			// no folders are created here, the names are only used in the manifest or tar
+			// stream, or folders are made when a file passing the filter is written
+			if(job->tar)
+				extract_tar_entry(job, newdest, TAR_DIR, 0755, fat2unix_time(dir->d_mtime, dir->d_mdate), NULL);
+			dirdest = strdup(newdest);
+		}
+		else if(!stat(newdest, &sb)) {
 			if((sb.st_mode & S_IFMT) != S_IFDIR) {
-				return -1;
+				free(dir);
+				return PS3HDD_ELOCAL;
 			}
 			dirdest = strdup(newdest);
 		}
@@ -1109,7 +1162,8 @@ s32 fat_copy_data(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct f
 				dirdest = valid_filename(newdest, 0);
 				if(mkdir(dirdest,0777) == -1) {
 					free(dirdest);
-					return -1;
+					free(dir);
+					return PS3HDD_ELOCAL;
 				}
 			}
 			else {
@@ -1117,24 +1171,12 @@ s32 fat_copy_data(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct f
 			}
 		}
 		 
-		if(fat_fs) {
-			list = fat_get_cluster_list(ctx, storage, fat_fs, 0, dir->d_start_clu); 
-			buf = malloc(list->count * clu_size(fat_fs)); 
-			fat_read_cluster(ctx, storage, fat_fs, 0, list, buf, 0, 0); 
-		}
-		else if(fat32) {
-			list = fat_get_cluster_list(ctx, storage, 0, fat32, dir->d_start_clu); 
-			buf = malloc(list->count * clu_size32(fat32)); 
-			fat_read_cluster(ctx, storage, 0, fat32, list, buf, 0, 0); 
-		}
+		d = fat_open_dir(ctx, storage, fat_fs, fat32, dir->d_start_clu);
+		entry_count = d->count;
+		dirs = malloc((entry_count + 1) * sizeof(*dirs));
+		memcpy(dirs, d->e, entry_count * sizeof(*dirs));
 		
-		fat_free_cluster_list(list); 
-		entry_count = fat_get_entry_count(buf); 
-		dirs = malloc(entry_count * sizeof(*dirs)); 
-		fat_get_entries(buf, dirs); 
-		free(buf);
-		
-		for(i = 0; i < entry_count; ++i) {
+		for(i = 0; i < entry_count && !extract_job_stopped(job); ++i) {
 			if(!strcmp((const char *)dirs[i].fd_name, ".") || !strcmp((const char *)dirs[i].fd_name, ".."))	 
 				continue;
 			
@@ -1148,79 +1190,36 @@ s32 fat_copy_data(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct f
 			strcat(nextdest, "/");
 			strcat(nextdest, (const char *)dirs[i].fd_name);
 			sprintf(string, "%s/%s", srcpath, dirs[i].fd_name);
-			printf("copy -> %s\n", string);
+			if(!job->hash_only && !job->tar && !job->filter)
+				printf("copy -> %s\n", string);
 			
 			if(fat_fs) {
-				fat_copy_data(ctx, storage, fat_fs, 0, nextsrc, nextdest);
+				fat_copy_data(ctx, storage, fat_fs, 0, nextsrc, nextdest, job);
 			}
 			else if(fat32) {
-				fat_copy_data(ctx, storage, 0, fat32, nextsrc, nextdest);
+				fat_copy_data(ctx, storage, 0, fat32, nextsrc, nextdest, job);
 			}
 		}
 		free(dirs);
 		return 0;
 	}
 	
-	readsize = 0;
-	read = 0;
-	
-	tmp = valid_filename(newdest, using_con);
-	
-	strcpy(newdest, (const char *)tmp);
-	free(tmp);
-	
-	out = fopen(newdest, "wb"); 
-	if(!out){	 				
-		printf("can't create file! \"%s\"\n", newdest); 
-		return -1;
+	if(!job->tar) {
+		tmp = valid_filename(newdest, using_con);
+		
+		strcpy(newdest, (const char *)tmp);
+		free(tmp);
 	}
 	
-	if(fat_fs) {
-		buf = malloc(clu_size(fat_fs)); 
-		list = fat_get_cluster_list(ctx, storage, fat_fs, 0, dir->d_start_clu); 
-	
-		for(i = 0; readsize < totalsize; i++) { 
-			if(totalsize - readsize < clu_size(fat_fs)) {
-				read = device_read(ctx, buf, totalsize - readsize, (storage * SECTOR_SIZE) + clu_off(fat_fs, list->clu_add[i]));
-				fwrite(buf, 1, read, out);
-				readsize += read;
-			}
-			else {
-				read = device_read(ctx, buf, clu_size(fat_fs), (storage * SECTOR_SIZE) + clu_off(fat_fs, list->clu_add[i]));
-				fwrite(buf, 1, read, out);
-				readsize += read;
-			}
-			
-			fprintf(stderr,"(%03lld%%)\r", readsize * 100 / totalsize);
-		}
-	}
-	else if(fat32) {
-		buf = malloc(clu_size32(fat32));	
-		list = fat_get_cluster_list(ctx, storage, 0, fat32, dir->d_start_clu);	
-	
-		for(i = 0; readsize < totalsize; i++) {	
-			if(totalsize - readsize < clu_size32(fat32)) {
-				read = device_read(ctx, buf, totalsize - readsize, (storage * SECTOR_SIZE) + clu_off32(fat32, list->clu_add[i]));
-				fwrite(buf, 1, read, out);
-				readsize += read;
-			}
-			else {
-				read = device_read(ctx, buf, clu_size32(fat32), (storage * SECTOR_SIZE) + clu_off32(fat32, list->clu_add[i]));
-				fwrite(buf, 1, read, out);
-				readsize += read;
-			}
-
-			fprintf(stderr,"(%03lld%%)\r", readsize * 100 / totalsize);
-		}
-	}
+	// entry is file, skip it if unchanged since the last run...
+	if(extract_state_check(job, srcpath, newdest, dir->d_start_clu, 0, totalsize, fat2unix_time(dir->d_mtime, dir->d_mdate)))
+		return 0;
 	
-	fat_free_cluster_list(list); 
-	free(buf);						
-	fclose(out);
+	// ...else queue its clusters, consecutive ones merge into one extent
+	file = fat_map_file(ctx, storage, fat_fs, fat32, dir, newdest);
 	
-	filetime.actime = fat2unix_time(dir->d_atime, dir->d_adate); 
-	filetime.modtime = fat2unix_time(dir->d_mtime, dir->d_mdate); 
-	utime(newdest, &filetime); 
+	if(extract_submit(job, file))
+		return extract_job_stopped(job) ? PS3HDD_EINTR : PS3HDD_ELOCAL;
 	
 	return 0;
 }
@@ -1233,100 +1232,70 @@ s32 fat_copy_data(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct f
 * 	struct fat32_bs *fat32 = struct fat32_bs, wenn FAT32
 * 	u8 *srcpath 		    	 = quelle
 * 	u8 *destpath					 = ziel
+* 	BOOL delta             = write only the sectors that differ
 ***********************************************************************/
-s32 fat_replace_data(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct fat32_bs *fat32, char *path)
+s32 fat_replace_data(ps3_context *ctx, u64 storage, struct fat_bs *fat_fs, struct fat32_bs *fat32, char *path, BOOL delta)
 {
-	s32 i, size;
-	u8 *buf;
-	s64 totalsize, done, n_write;
+	s32 i;
+	s64 size, totalsize, done, n_write, cluster_size;
 	struct sfn_e *dir = NULL;	
 	fat_clu_list *list = NULL;
 	u8 *buf_fd = NULL;
+	dev_writer w;
 	FILE *fd;
 	
 	if(strlen(path) == 1 && path[0] == 0x2F)
 		return 0;
 	
-	if(fat_fs) {
-		if((dir = fat_lookup_path(ctx, storage, fat_fs, 0, (u8*)path, 0)) == NULL) {
-			printf("can't copy, no such file or directory!\n");
-			return -1;
-		}
-	}
-	else if(fat32) {
-		if((dir = fat_lookup_path(ctx, storage, 0, fat32, (u8*)path, 0)) == NULL) {
-			printf("can't copy, no such file or directory!\n");
-			return -1;
-		}
-	}
+	if((dir = fat_lookup_path(ctx, storage, fat_fs, fat32, (u8*)path, 0)) == NULL)
+		return PS3HDD_ENOENT;
 	
 	totalsize = dir->d_size;
 	 
 	if((fd = fopen(strrchr(path, '/') + 1, "rb")) == NULL) {
-		printf("can't open patched file!\n");
-		return 0;
+		free(dir);
+		return PS3HDD_ELOCAL;
 	}
 	
-	fseek(fd, 0, SEEK_END);
-	size = ftell(fd);
-	fseek(fd, 0, SEEK_SET);
+	_fseeki64(fd, 0, SEEK_END);
+	size = _ftelli64(fd);
+	_fseeki64(fd, 0, SEEK_SET);
 	
 	if(size != totalsize) {
-		printf("file size wrong!\n");
-	  return 0;
+		free(dir);
+		fclose(fd);
+	  return PS3HDD_ESIZE;
 	}
 	
 	done    = 0;
 	n_write = 0;
 	
-	if(fat_fs)
-	  buf_fd = malloc(clu_size(fat_fs));
-  if(fat32)
-    buf_fd = malloc(clu_size32(fat32));
+	cluster_size = fat_fs ? clu_size(fat_fs) : clu_size32(fat32);
+	buf_fd = malloc(cluster_size);
+	list = fat_get_cluster_list(ctx, storage, fat_fs, fat32, dir->d_start_clu);
+	dev_writer_init(&w, ctx);
+	w.delta = delta;
 	
-	if(fat_fs) {
-		buf = malloc(clu_size(fat_fs)); 
-		list = fat_get_cluster_list(ctx, storage, fat_fs, 0, dir->d_start_clu); 
-	
-		for(i = 0; done < totalsize; i++) { 
-			if(totalsize - done < clu_size(fat_fs)) {
-				fseek(fd, done, SEEK_SET);
-				fread(buf_fd, sizeof(u8), totalsize - done, fd);
-				n_write = device_write(ctx, buf_fd, totalsize - done, (storage * SECTOR_SIZE) + clu_off(fat_fs, list->clu_add[i]));
-				done += n_write;
-			}
-			else {
-				fseek(fd, done, SEEK_SET);
-			  fread(buf_fd, sizeof(u8), clu_size(fat_fs), fd);
-				n_write = device_write(ctx, buf_fd, clu_size(fat_fs), (storage * SECTOR_SIZE) + clu_off(fat_fs, list->clu_add[i]));
-				done += n_write;
-			}
-			fprintf(stderr,"(%03lld%%)\r", done * 100 / totalsize);
-		}
-	}
-	else if(fat32) {
-		buf = malloc(clu_size32(fat32));	
-		list = fat_get_cluster_list(ctx, storage, 0, fat32, dir->d_start_clu);	
-	
-		for(i = 0; done < totalsize; i++) {	
-			if(totalsize - done < clu_size32(fat32)) {
-				fseek(fd, done, SEEK_SET);
-				fread(buf_fd, sizeof(u8), totalsize - done, fd);
-				n_write = device_write(ctx, buf_fd, totalsize - done, (storage * SECTOR_SIZE) + clu_off32(fat32, list->clu_add[i]));
-				done += n_write;
-			}
-			else {
-				fseek(fd, done, SEEK_SET);
-			  fread(buf_fd, sizeof(u8), clu_size32(fat32), fd);
-				n_write = device_write(ctx, buf_fd, clu_size32(fat32), (storage * SECTOR_SIZE) + clu_off32(fat32, list->clu_add[i]));
-				done += n_write;
-			}
-			fprintf(stderr,"(%03lld%%)\r", done * 100 / totalsize);
-		}
+	// read the patched file in order, clusters that follow each other are written at once
+	for(i = 0; done < totalsize && i < list->count; i++) {
+		n_write = min(totalsize - done, cluster_size);
+		fread(buf_fd, sizeof(u8), n_write, fd);
+		
+		if(fat_fs)
+			dev_writer_write(&w, buf_fd, n_write, (storage * SECTOR_SIZE) + clu_off(fat_fs, list->clu_add[i]));
+		else
+			dev_writer_write(&w, buf_fd, n_write, (storage * SECTOR_SIZE) + clu_off32(fat32, list->clu_add[i]));
+		done += n_write;
+		
+		fprintf(stderr,"(%03lld%%)\r", done * 100 / totalsize);
 	}
 	
+	dev_writer_close(&w);
+	if(delta)
+		printf("%lld bytes changed, %lld bytes written\n", w.changed, w.written);
 	fat_free_cluster_list(list); 
-	free(buf);						
+	free(buf_fd);
+	free(dir);
 	fclose(fd);
 	
 	return 0;
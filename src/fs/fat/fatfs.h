@@ -41,6 +41,20 @@ typedef struct _fat_clu_list_{
 	u32 *clu_add;		/* addres of each cluster */
 }fat_clu_list;
 
+#define FAT_TABLE_REGION 0x40000  /* entries decoded per read, 1 MiB of FAT32 */
+
+typedef struct _fat_table_{
+	u64 storage;          /* partition start sector */
+	s32 type;             /* 12, 16 or 32 */
+	s64 fat_off;          /* byte offset of fat 1 on hdd */
+	u32 count;            /* entries in the FAT */
+	u32 *entry;           /* decoded entries, native endian */
+	u32 n_region;         /* region count */
+	u8 *loaded;           /* regions read so far */
+	struct _fat_dir_ *dirs;  /* parsed directories */
+	struct _fat_table_ *next;
+}fat_table;
+
 
 #define SECS_PER_MIN    60
 #define SECS_PER_HOUR   (60 * 60)
@@ -183,6 +197,17 @@ struct fat_dir_entry{
 	u8 	fd_name[M_NAME_LENGTH + 1];	/* name of entry */
 }__attribute__ ((__packed__));
 
+typedef struct _fat_dir_{
+	fat_add_t start_clu;           /* first cluster, 0 for FAT12/16 root */
+	s32 count;                     /* entries */
+	struct fat_dir_entry *e;       /* decoded entries, directory order */
+	struct sfn_e *sfn;             /* short entry of each entry */
+	u32 n_hash;                    /* hash buckets, power of 2 */
+	s32 *hash;                     /* first slot of each bucket, -1 if empty */
+	s32 *chain;                    /* next slot in the same bucket */
+	struct _fat_dir_ *next;
+}fat_dir;
+
 
 /* Macros FAT12/16*/
 /* berechne cluster size. */
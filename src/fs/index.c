@@ -0,0 +1,225 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "index.h"
+
+
+
+
+
+/***********************************************************************
+* Identify the hdd and the filesystem an index belongs to.
+* 
+* ps3_context *ctx = ps3 device information
+* struct fs *ufs2  = superblock
+* index_header *h  = receives magic and identity
+***********************************************************************/
+static void index_identify(ps3_context *ctx, struct fs *ufs2, index_header *h)
+{
+	u32 i;
+	u64 hash = 0xCBF29CE484222325ULL;  // FNV-1a 64
+	u8 *buf = malloc(8 * SECTOR_SIZE);
+	
+	// decrypted partition table, differs per console and layout
+	block_read(ctx, buf, 8, 0);
+	for(i = 0; i < 8 * SECTOR_SIZE; i++) {
+		hash ^= buf[i];
+		hash *= 0x100000001B3ULL;
+	}
+	free(buf);
+	
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, INDEX_MAGIC, 8);
+	h->disk_id  = hash;
+	h->fs_id[0] = _ES32(ufs2->fs_id[0]);
+	h->fs_id[1] = _ES32(ufs2->fs_id[1]);
+	h->fs_time  = _ES64(ufs2->fs_time);
+	h->ncg      = ufs2->fs_ncg;
+	h->ipg      = ufs2->fs_ipg;
+}
+
+/***********************************************************************
+* Load an index file.
+* 
+* const char *file  = index file name
+* index_header *h   = receives the header
+* index_header *cur = header of the hdd, bounds the sizes read
+* 
+* return: inventory or NULL if missing or damaged
+***********************************************************************/
+static ufs_inventory* index_load(const char *file, index_header *h, index_header *cur)
+{
+	u32 i;
+	u16 name_len;
+	ufs_inv_node *node;
+	ufs_inventory *inv;
+	FILE *fd = fopen(file, "rb");
+	
+	if(fd == NULL)
+		return NULL;
+	
+	if(fread(h, sizeof(*h), 1, fd) != 1 || memcmp(h->magic, INDEX_MAGIC, 8) != 0 || h->ncg <= 0) {
+		fclose(fd);
+		return NULL;
+	}
+	
+	// the header sizes all allocations, it must fit the superblock
+	if(h->ncg != cur->ncg || h->ipg != cur->ipg) {
+		printf("index belongs to another hdd, rebuilding...\n");
+		fclose(fd);
+		return NULL;
+	}
+	if((s64)h->count > cur->ncg * cur->ipg) {
+		printf("index file damaged, rebuilding...\n");
+		fclose(fd);
+		return NULL;
+	}
+	
+	if((inv = malloc(sizeof(*inv))) == NULL) {
+		fclose(fd);
+		return NULL;
+	}
+	memset(inv, 0, sizeof(*inv));
+	inv->ncg = h->ncg;
+	inv->cg_time = malloc(inv->ncg * sizeof(*inv->cg_time));
+	inv->node = malloc(((size_t)h->count + 1) * sizeof(*inv->node));
+	if(inv->cg_time == NULL || inv->node == NULL)
+		goto damaged;
+	
+	if(fread(inv->cg_time, sizeof(*inv->cg_time), inv->ncg, fd) != inv->ncg)
+		goto damaged;
+	
+	for(i = 0; i < h->count; i++) {
+		node = &inv->node[i];
+		memset(node, 0, sizeof(*node));
+		inv->count++;
+		
+		if(fread(&node->ino, sizeof(node->ino), 1, fd) != 1 ||
+		   fread(&node->parent, sizeof(node->parent), 1, fd) != 1 ||
+		   fread(&name_len, sizeof(name_len), 1, fd) != 1)
+			goto damaged;
+		
+		if(name_len) {
+			if((node->name = malloc(name_len + 1)) == NULL || fread(node->name, 1, name_len, fd) != name_len)
+				goto damaged;
+			node->name[name_len] = '\0';
+		}
+		
+		if(fread(&node->n_ext, sizeof(node->n_ext), 1, fd) != 1 || node->n_ext > 0x1000000)
+			goto damaged;
+		if(node->n_ext) {
+			if((node->ext = malloc(node->n_ext * sizeof(*node->ext))) == NULL || fread(node->ext, sizeof(*node->ext), node->n_ext, fd) != node->n_ext)
+				goto damaged;
+		}
+		
+		if(fread(&node->di, sizeof(node->di), 1, fd) != 1)
+			goto damaged;
+	}
+	
+	fclose(fd);
+	ufs_inv_link(inv);
+	return inv;
+	
+damaged:
+	printf("index file damaged, rebuilding...\n");
+	fclose(fd);
+	ufs_free_inventory(inv);
+	return NULL;
+}
+
+/***********************************************************************
+* Save an inventory as index file.
+* 
+* ps3_context *ctx   = ps3 device information
+* struct fs *ufs2    = superblock
+* ufs_inventory *inv = inventory
+* const char *file   = index file name
+***********************************************************************/
+s32 ufs_index_save(ps3_context *ctx, struct fs *ufs2, ufs_inventory *inv, const char *file)
+{
+	u32 i;
+	u16 name_len;
+	index_header h;
+	ufs_inv_node *node;
+	FILE *fd = fopen(file, "wb");
+	
+	if(fd == NULL) {
+		printf("can't create index file!\n");
+		return -1;
+	}
+	
+	index_identify(ctx, ufs2, &h);
+	h.count = inv->count;
+	fwrite(&h, sizeof(h), 1, fd);
+	fwrite(inv->cg_time, sizeof(*inv->cg_time), inv->ncg, fd);
+	
+	for(i = 0; i < inv->count; i++) {
+		node = &inv->node[i];
+		name_len = node->name ? strlen(node->name) : 0;
+		fwrite(&node->ino, sizeof(node->ino), 1, fd);
+		fwrite(&node->parent, sizeof(node->parent), 1, fd);
+		fwrite(&name_len, sizeof(name_len), 1, fd);
+		fwrite(node->name, 1, name_len, fd);
+		fwrite(&node->n_ext, sizeof(node->n_ext), 1, fd);
+		fwrite(node->ext, sizeof(*node->ext), node->n_ext, fd);
+		fwrite(&node->di, sizeof(node->di), 1, fd);
+	}
+	
+	if(fclose(fd) != 0) {
+		printf("can't write index file!\n");
+		return -1;
+	}
+	
+	return 0;
+}
+
+/***********************************************************************
+* Open the metadata index of dev_hdd0. An index of another hdd or
+* filesystem is rebuilt, an index older than the superblock is
+* refreshed, only changed inodes and directories are read again then.
+* 
+* ps3_context *ctx = ps3 device information
+* struct fs *ufs2  = superblock
+* const char *file = index file name
+* s32 threads      = worker thread count
+* 
+* return: inventory or NULL
+***********************************************************************/
+ufs_inventory* ufs_index_open(ps3_context *ctx, struct fs *ufs2, const char *file, s32 threads)
+{
+	index_header h, cur;
+	ufs_inventory *inv;
+	
+	index_identify(ctx, ufs2, &cur);
+	inv = index_load(file, &h, &cur);
+	
+	if(inv && (h.disk_id != cur.disk_id || h.fs_id[0] != cur.fs_id[0] || h.fs_id[1] != cur.fs_id[1] || 
+	           h.ncg != cur.ncg || h.ipg != cur.ipg)) {
+		printf("index belongs to another hdd, rebuilding...\n");
+		ufs_free_inventory(inv);
+		inv = NULL;
+	}
+	
+	if(inv && h.fs_time == cur.fs_time)
+		return inv;
+	
+	if(inv) {
+		printf("refreshing index...\n");
+		inv = ufs_refresh_inodes(ctx, ufs2, inv, threads);
+	}
+	else {
+		printf("building index...\n");
+		inv = ufs_scan_inodes(ctx, ufs2, threads);
+	}
+	
+	if(inv)
+		ufs_index_save(ctx, ufs2, inv, file);
+	
+	return inv;
+}
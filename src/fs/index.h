@@ -0,0 +1,27 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#ifndef _INDEX_H_
+#define _INDEX_H_
+
+#include "../types.h"
+#include "ufs.h"
+
+#define INDEX_MAGIC   "PS3UIDX1"     // index file magic and version
+
+typedef struct _index_header_ {
+	u8  magic[8];             // INDEX_MAGIC
+	u64 disk_id;              // hash of the partition table sectors
+	s32 fs_id[2];             // unique filesystem id
+	s64 fs_time;              // superblock time at save
+	s64 ncg;                  // cylinder group count
+	s64 ipg;                  // inodes per group
+	u32 count;                // inode records
+} index_header;
+
+ufs_inventory* ufs_index_open(ps3_context *ctx, struct fs *ufs2, const char *file, s32 threads);
+s32 ufs_index_save(ps3_context *ctx, struct fs *ufs2, ufs_inventory *inv, const char *file);
+
+#endif  // _INDEX_H_
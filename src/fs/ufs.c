@@ -104,9 +104,6 @@ static s32 ufs_read_data_by_blocklist(ps3_context *ctx, struct fs *ufs2, struct
 	}
 	
 	for(total = 0; total < len; ++i){
-		if(bl[i] != 0 && seek_device(ctx->dev, (bl[i] * ufs2->fs_fsize) + (ctx->hdd0_start * SECTOR_SIZE) + (offset * SECTOR_SIZE)) <= 0)
-			return -1;
-		
 		read = sblksize(ufs2, _ES64(di->di_size), i) - offset;
 		
 		offset = 0;
@@ -414,14 +411,10 @@ ufs_inop ufs_lookup_path(ps3_context *ctx, struct fs* ufs2, u8* path, int follow
 ***********************************************************************/
 s32 ufs_print_dir_list(ps3_context *ctx, struct fs* ufs2, u8* path, u8* volume)
 {
-	s32 i, ret, entry_count;	
-	u8 *buffer, *tmp;		
+	s32 i, entry_count;	
 	u64 file_count, dir_count, byte_use, byte_free;
 	ufs_inop inode;	
-	struct ufs2_dinode *root_inode;	
-	root_inode = malloc(sizeof(struct ufs2_dinode));	
 	ufs2_block_list *block_list;	
-	struct direct direntry_tmp;	
 	struct direct *dirs;	
 	struct ufs2_dinode dinode_tmp;	
 	struct tm *tm;	
@@ -435,42 +428,11 @@ s32 ufs_print_dir_list(ps3_context *ctx, struct fs* ufs2, u8* path, u8* volume)
 	
 	inode = ufs_lookup_path(ctx, ufs2, path, 1, ROOTINO); 
 	
-	if(!inode){ 
-		printf("no such file or directory!\n");
-		return -1;
-	}
+	if(!inode)
+		return PS3HDD_ENOENT;
 	
-	read_inode(ctx, ufs2, inode, root_inode); 
-	
-	if (!(root_inode->di_mode & IFDIR)) { 
-		printf("can't show, not a directory!\n");
-		return -1;
-	}
-	 
-	block_list = get_block_list(ctx, ufs2, root_inode);
-	buffer = malloc(_ES64(root_inode->di_size) + sizeof(struct direct));
-	ufs_read_data_by_blocklist(ctx, ufs2, root_inode, block_list, buffer, 0, 0);
-	ufs_free_block_list(block_list);
-	
-	tmp = buffer;
-  
-	for(entry_count = 0; tmp - buffer < _ES64(root_inode->di_size); ++entry_count){
-		ret = ufs_read_direntry(tmp, &direntry_tmp);
-		tmp += ret;
-	}
-	
-	dirs = malloc(entry_count * sizeof(*dirs));
-	
-	tmp = buffer;
-	
-	for(i = 0; i < entry_count; ++i){
-		ret = ufs_read_direntry(tmp, &dirs[i]);
-		tmp += ret;
-	}
-	
-	free(buffer);
-	
-	qsort(dirs, entry_count, sizeof(*dirs), ufs_sort_dir);
+	if((entry_count = ufs_read_dir(ctx, ufs2, inode, &dirs)) < 0)
+		return PS3HDD_ENOTDIR;
   
 	printf("\n Volume is ps3_hdd %s\n", volume);
 	printf(" Directory of %s/%s\n\n", volume, path);
@@ -525,6 +487,164 @@ s32 ufs_print_dir_list(ps3_context *ctx, struct fs* ufs2, u8* path, u8* volume)
 	return 0;
 }
 /***********************************************************************
+* Check if an inode is a folder.
+* 	ps3_context *ctx = ps3 device information
+* 	struct fs *ufs2  = superblock of the filesystem
+* 	ufs_inop ino     = inode to check
+***********************************************************************/
+BOOL ufs_is_dir(ps3_context *ctx, struct fs *ufs2, ufs_inop ino)
+{
+	struct ufs2_dinode di;
+	
+	read_inode(ctx, ufs2, ino, &di);
+	
+	return (_ES16(di.di_mode) & IFMT) == IFDIR;
+}
+/***********************************************************************
+* Read an inode, for callers outside this file.
+* 	ps3_context *ctx       = ps3 device information
+* 	struct fs *ufs2        = superblock of the filesystem
+* 	ufs_inop ino           = inode to read
+* 	struct ufs2_dinode *di = receives the inode, big endian as on disk
+***********************************************************************/
+s32 ufs_read_inode(ps3_context *ctx, struct fs *ufs2, ufs_inop ino, struct ufs2_dinode *di)
+{
+	return read_inode(ctx, ufs2, ino, di);
+}
+/***********************************************************************
+* Read the entries of a folder, sorted by name with "." and ".." first.
+* 	ps3_context *ctx      = ps3 device information
+* 	struct fs *ufs2       = superblock of the filesystem
+* 	ufs_inop ino          = inode of the folder
+* 	struct direct **dirs  = receives the entries, free it after use
+* 
+* return: entry count, -1 if not a folder
+***********************************************************************/
+s32 ufs_read_dir(ps3_context *ctx, struct fs *ufs2, ufs_inop ino, struct direct **dirs)
+{
+	s32 i, ret, entry_count;
+	u8 *buffer, *tmp;
+	ufs2_block_list *block_list;
+	struct direct direntry_tmp;
+	struct ufs2_dinode di;
+	
+	
+	read_inode(ctx, ufs2, ino, &di);
+	
+	if((_ES16(di.di_mode) & IFMT) != IFDIR)
+		return -1;
+	
+	block_list = get_block_list(ctx, ufs2, &di);
+	buffer = malloc(_ES64(di.di_size) + sizeof(struct direct));
+	ufs_read_data_by_blocklist(ctx, ufs2, &di, block_list, buffer, 0, 0);
+	ufs_free_block_list(block_list);
+	
+	for(tmp = buffer, entry_count = 0; tmp - buffer < _ES64(di.di_size); ++entry_count){
+		ret = ufs_read_direntry(tmp, &direntry_tmp);
+		tmp += ret;
+	}
+	
+	*dirs = malloc((entry_count + 1) * sizeof(**dirs));
+	
+	for(tmp = buffer, i = 0; i < entry_count; ++i){
+		ret = ufs_read_direntry(tmp, &(*dirs)[i]);
+		tmp += ret;
+	}
+	
+	free(buffer);
+	
+	qsort(*dirs, entry_count, sizeof(**dirs), ufs_sort_dir);
+	
+	return entry_count;
+}
+/***********************************************************************
+* Map the data of a file to hdd extents, unallocated blocks are holes.
+* 	ps3_context *ctx       = ps3 device information
+* 	struct fs *ufs2        = superblock of the filesystem
+* 	struct ufs2_dinode *di = inode of the file
+* 	const char *dest       = output file name
+***********************************************************************/
+extract_file* ufs_map_file(ps3_context *ctx, struct fs *ufs2, struct ufs2_dinode *di, const char *dest)
+{
+	s64 i, done, n_read, totalsize = _ES64(di->di_size);
+	ufs2_block_list *block_list;
+	extract_file *file;
+	s64 *bl;
+	
+	
+	block_list = get_block_list(ctx, ufs2, di);
+	file = extract_file_new(dest, totalsize, _ES64(di->di_atime), _ES64(di->di_mtime));
+	file->mode = _ES16(di->di_mode) & 07777;
+	bl = block_list->blk_add;
+	
+	for(i = 0, done = 0; done < totalsize; i++) {
+		n_read = (totalsize - done < ufs2->fs_bsize) ? totalsize - done : ufs2->fs_bsize;
+		if(bl[i] == 0)
+			extract_file_add(file, EXTRACT_HOLE, n_read);
+		else
+			extract_file_add(file, (bl[i] * ufs2->fs_fsize) + (ctx->hdd0_start * SECTOR_SIZE), n_read);
+		done += n_read;
+	}
+	
+	ufs_free_block_list(block_list);
+	
+	return file;
+}
+/***********************************************************************
+* Print the inode of a file or folder.
+* 	ps3_context *ctx = ps3 device information
+* 	struct fs *ufs2  = superblock of the filesystem
+* 	u8 *path         = path on the volume
+***********************************************************************/
+s32 ufs_print_stat(ps3_context *ctx, struct fs *ufs2, u8 *path)
+{
+	ufs_inop ino;
+	struct ufs2_dinode di;
+	time_t t;
+	char timestr[64];
+	char sizestr[32];
+	const char *type;
+	
+	
+	if((ino = ufs_lookup_path(ctx, ufs2, path, 0, ROOTINO)) == 0)
+		return PS3HDD_ENOENT;
+	
+	read_inode(ctx, ufs2, ino, &di);
+	
+	switch(_ES16(di.di_mode) & IFMT) {
+		case IFDIR: type = "directory";     break;
+		case IFLNK: type = "symbolic link"; break;
+		case IFREG: type = "regular file";  break;
+		default:    type = "special file";  break;
+	}
+	
+	print_commas(_ES64(di.di_size), sizestr);
+	printf("  File: %s\n", path);
+	printf("  Type: %s\n", type);
+	printf(" Inode: %llu\n", (u64)ino);
+	printf("  Mode: %04o\n", _ES16(di.di_mode) & 07777);
+	printf(" Links: %d\n", _ES16(di.di_nlink));
+	printf("   Uid: %u  Gid: %u\n", _ES32(di.di_uid), _ES32(di.di_gid));
+	printf("  Size: %s bytes\n", sizestr);
+	printf("Blocks: %llu\n", _ES64(di.di_blocks));
+	printf("   Gen: %u\n", _ES32(di.di_gen));
+	
+	t = _ES64(di.di_atime);
+	strftime(timestr, 64, "%m.%d.%Y  %H:%M:%S", localtime(&t));
+	printf("Access: %s\n", timestr);
+	t = _ES64(di.di_mtime);
+	strftime(timestr, 64, "%m.%d.%Y  %H:%M:%S", localtime(&t));
+	printf("Modify: %s\n", timestr);
+	t = _ES64(di.di_ctime);
+	strftime(timestr, 64, "%m.%d.%Y  %H:%M:%S", localtime(&t));
+	printf("Change: %s\n", timestr);
+	t = _ES64(di.di_birthtime);
+	strftime(timestr, 64, "%m.%d.%Y  %H:%M:%S", localtime(&t));
+	printf(" Birth: %s\n", timestr);
+	
+	return 0;
+}
+/***********************************************************************
 *Funktion: read_file
 * 	s32 device        = *hdd
 * 	struct fs *fs     = struct fs
@@ -532,20 +652,19 @@ s32 ufs_print_dir_list(ps3_context *ctx, struct fs* ufs2, u8* path, u8* volume)
 * 	ufs_inop ino      = 
 * 	char *srcpath     = 
 * 	char *destpath    = 
+* 	extract_job *job  = job that copies the files
 ***********************************************************************/
-s32 ufs_copy_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop ino, char *srcpath, char *destpath)
+s32 ufs_copy_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop ino, char *srcpath, char *destpath, extract_job *job)
 {
-  FILE *fd;
 	const char *dir_ = "..";
-	s64 i, totalsize, done, n_read;
+	s64 i, totalsize;
 	ufs2_block_list *block_list;
 	char *buf, *dir, *tmp;
 	char newdest[MAX_PATH];
 	s32 using_con;
 	struct ufs2_dinode dinode;
-	struct utimbuf filetime;
 	ufs_inop symlink_ino;
-	s64 *bl;
+	extract_file *file;
 	char string[MAX_PATH];
 	
 	
@@ -554,13 +673,40 @@ s32 ufs_copy_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop
 	
 	using_con = (destpath && (!Stricmp(destpath, "CON") || !(Strnicmp(destpath, "CON.", 4))));
 	
-	if(!root_ino || !ino){
-		printf("can't copy, no such file or directory!\n");
-		return -1;
+	if(!root_ino || !ino)
+		return PS3HDD_ENOENT;
+	
+	if(destpath == NULL){
+		char *base = basename(srcpath);
+		strcpy(newdest, "./");
+		strcat(newdest, base);
+		free(base);
+	}
+	else{	
+		while(destpath[strlen(destpath) - 1] == '/')
+			destpath[strlen(destpath) - 1] = '\0';
+	
+		strcpy(newdest, destpath);
 	}
 	
 	read_inode(ctx, ufs2, ino, &dinode);
 	
+	// a tar stream keeps the symlink itself
+	if((_ES16(dinode.di_mode) & IFMT) == IFLNK && job->tar){
+		u8 tmpname[MAX_PATH];
+		
+		if(_ES64(dinode.di_size) >= MAX_PATH)
+			return PS3HDD_EPATH;
+		if(job->filter && !filter_want_file(job->filter, srcpath, _ES64(dinode.di_size), _ES64(dinode.di_mtime)))
+			return 0;
+		block_list = get_block_list(ctx, ufs2, &dinode);
+		ufs_read_data_by_blocklist(ctx, ufs2, &dinode, block_list, tmpname, 0, 0);
+		ufs_free_block_list(block_list);
+		tmpname[_ES64(dinode.di_size)] = '\0';
+		extract_tar_entry(job, newdest, TAR_SYMLINK, _ES16(dinode.di_mode), _ES64(dinode.di_mtime), (char*)tmpname);
+		return 0;
+	}
+	
 	if((_ES16(dinode.di_mode) & IFMT) == IFLNK){  
 		ino = ufs_lookup_path(ctx, ufs2, (u8*)srcpath, 1, ROOTINO);
 		dir = dirname(srcpath);
@@ -568,9 +714,8 @@ s32 ufs_copy_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop
 
 		for(;; symlink_ino = ufs_lookup_path(ctx, ufs2, (u8*)dir_, 0, symlink_ino)){
 			if(symlink_ino == ino){
-				printf("\"%s\" is a recursive symlink loop\n", srcpath);
 				free(dir);
-				return -1;
+				return PS3HDD_ELOOP;
 			}
 
 			if(symlink_ino == ROOTINO)
@@ -579,21 +724,20 @@ s32 ufs_copy_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop
 		free(dir);
 	}
 	
-	if(destpath == NULL){
-		char *base = basename(srcpath);
-		strcpy(newdest, "./");
-		strcat(newdest, base);
-		free(base);
-	}
-	else{	
-		while(destpath[strlen(destpath) - 1] == '/')
-			destpath[strlen(destpath) - 1] = '\0';
+	read_inode(ctx, ufs2, ino, &dinode);
 	
-		strcpy(newdest, destpath);
+	// filtered out folders are not read, filtered out files get no block list
+	if(job->filter){
+		if(_ES16(dinode.di_mode) & IFDIR){
+			if(!filter_want_dir(job->filter, srcpath))
+				return 0;
+		}
+		else if(!filter_want_file(job->filter, srcpath, _ES64(dinode.di_size), _ES64(dinode.di_mtime)))
+			return 0;
+		else if(!job->hash_only && !job->tar)
+			printf("copy -> %s\n", srcpath);
 	}
 	
-	read_inode(ctx, ufs2, ino, &dinode);
-	block_list = get_block_list(ctx, ufs2, &dinode);
 	totalsize = _ES64(dinode.di_size);
 	
 	if(_ES16(dinode.di_mode) & IFDIR){
@@ -604,15 +748,24 @@ s32 ufs_copy_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop
 		struct direct direct_tmp;
 		struct stat sb;
 
+		block_list = get_block_list(ctx, ufs2, &dinode);
+		
 		if(using_con){
-			printf("can't copy directory!\n");
 			ufs_free_block_list(block_list);
-			return -1;
+			return PS3HDD_EISDIR;
 		}
 
-		if(!stat(newdest, &sb)){
+		if(job->hash_only || job->tar || job->filter){
+			// no folders are created here, the names are only used in the manifest or tar
+			// stream, or folders are made when a file passing the filter is written
+			if(job->tar)
+				extract_tar_entry(job, newdest, TAR_DIR, _ES16(dinode.di_mode), _ES64(dinode.di_mtime), NULL);
+			dirdest = strdup(newdest);
+		}
+		else if(!stat(newdest, &sb)){
 			if((sb.st_mode & S_IFMT) != S_IFDIR){
-				return -1;
+				ufs_free_block_list(block_list);
+				return PS3HDD_ELOCAL;
 			}
 			dirdest = strdup(newdest);
 		}
@@ -620,8 +773,9 @@ s32 ufs_copy_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop
 			if(mkdir(newdest, 0777) == -1){
 				dirdest = valid_filename(newdest, 0);
 				if(mkdir(dirdest,0777) == -1){
+					ufs_free_block_list(block_list);
 					free(dirdest);
-					return -1;
+					return PS3HDD_ELOCAL;
 				}
 			}
 			else{
@@ -633,7 +787,7 @@ s32 ufs_copy_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop
 		ufs_read_data_by_blocklist(ctx, ufs2, &dinode, block_list, (u8*)buf, 0, 0);
 		tmp = buf;
 		
-		for(i = 0;; ++i){
+		for(i = 0; !extract_job_stopped(job); ++i){
 			ret = ufs_read_direntry(tmp, &direct_tmp);
 			
 			if(tmp - buf >= _ES64(dinode.di_size) || !ret)
@@ -655,8 +809,9 @@ s32 ufs_copy_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop
 			strcat(nextdest, direct_tmp.d_name);
 			
 			sprintf(string, "%s/%s", srcpath, direct_tmp.d_name);
-			printf("copy -> %s\n", string);
-			ufs_copy_data(ctx, ufs2, ino, _ES32(direct_tmp.d_ino), nextsrc, nextdest);
+			if(!job->hash_only && !job->tar && !job->filter)
+				printf("copy -> %s\n", string);
+			ufs_copy_data(ctx, ufs2, ino, _ES32(direct_tmp.d_ino), nextsrc, nextdest, job);
 		}
 		
 		ufs_free_block_list(block_list);
@@ -665,46 +820,21 @@ s32 ufs_copy_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop
 		return 0;
 	}
 	
-	// entry is file...
-	done = 0;
-	n_read = 0;
-
-	tmp = valid_filename(newdest, using_con);
-	strcpy(newdest, tmp);
-	free(tmp);
-	
-	fd = fopen(newdest, "wb");
-	if(!fd) {
-		printf("can't create file!\n");
-		return -1;																			
+	// entry is file, skip it if unchanged since the last run...
+	if(!job->tar){
+		tmp = valid_filename(newdest, using_con);
+		strcpy(newdest, tmp);
+		free(tmp);
 	}
 	
-	buf = malloc(ufs2->fs_bsize);
-	bl = block_list->blk_add;
-	
-	for(i = 0; done < totalsize; i++) {
-		if(totalsize - done < ufs2->fs_bsize) { 
-			n_read = device_read(ctx, (u8*)buf, totalsize - done, (bl[i] * ufs2->fs_fsize) + (ctx->hdd0_start * SECTOR_SIZE));
-			
-			fwrite(buf, 1, n_read, fd);
-			done += n_read;
-		}
-		else { 
-			n_read = device_read(ctx, (u8*)buf, ufs2->fs_bsize, (bl[i] * ufs2->fs_fsize) + (ctx->hdd0_start * SECTOR_SIZE));
-			
-			fwrite(buf, 1, n_read, fd);
-			done += n_read;
-		}
-		fprintf(stderr,"(%03lld%%)\r", done * 100 / totalsize);
-	}
+	if(extract_state_check(job, srcpath, newdest, ino, _ES32(dinode.di_gen), totalsize, _ES64(dinode.di_mtime)))
+		return 0;
 	
-	fclose(fd);
-	filetime.actime = _ES64(dinode.di_atime);
-	filetime.modtime = _ES64(dinode.di_mtime);
-	utime(newdest, &filetime);
+	// ...else queue its blocks, unallocated blocks are holes
+	file = ufs_map_file(ctx, ufs2, &dinode, newdest);
 	
-	free(buf);
-	ufs_free_block_list(block_list);
+	if(extract_submit(job, file))
+		return extract_job_stopped(job) ? PS3HDD_EINTR : PS3HDD_ELOCAL;
 	
 	return 0;
 }
@@ -715,11 +845,13 @@ s32 ufs_copy_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop
 * 	ufs_inop root_ino = root
 * 	ufs_inop ino      = 
 * 	char *path        = 
+* 	BOOL delta        = write only the sectors that differ
 ***********************************************************************/
-s32 ufs_replace_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop ino, char *path)
+s32 ufs_replace_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop ino, char *path, BOOL delta)
 {
 	struct ufs2_dinode dinode;
-	s64 i, size, totalsize, done = 0, n_write = 0;
+	s64 i, j, size, totalsize, done = 0, n_write = 0;
+	dev_writer w;
 	ufs2_block_list *block_list = NULL;
 	u8 *buf_fd = NULL;
 	FILE *fd = NULL;
@@ -729,57 +861,812 @@ s32 ufs_replace_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_i
 	if(strlen(path) == 1 && path[0] == 0x2F)
 		return 0;
 	
-	if(!root_ino || !ino){
-		printf("can't copy, no such file or directory!\n");
-		return -1;
-	}
+	if(!root_ino || !ino)
+		return PS3HDD_ENOENT;
 	 
-	if((fd = fopen(strrchr(path, '/') + 1, "rb")) == NULL) {
-		printf("can't open patched file!\n");
-		return 0;
-	}
+	if((fd = fopen(strrchr(path, '/') + 1, "rb")) == NULL)
+		return PS3HDD_ELOCAL;
 	
-	fseek(fd, 0, SEEK_END);
-	size = ftell(fd);
-	fseek(fd, 0, SEEK_SET);
+	_fseeki64(fd, 0, SEEK_END);
+	size = _ftelli64(fd);
+	_fseeki64(fd, 0, SEEK_SET);
 	 
 	read_inode(ctx, ufs2, ino, &dinode);
 	
 	if(_ES16(dinode.di_mode) & IFDIR) {
-		printf("not a file!\n");
-	  return 0;
+		fclose(fd);
+	  return PS3HDD_EISDIR;
 	}
 	totalsize = _ES64(dinode.di_size);
 	
 	if(size != totalsize) {
-		printf("file size wrong!\n");
-	  return 0;
+		fclose(fd);
+	  return PS3HDD_ESIZE;
 	}
 	 
 	block_list = get_block_list(ctx, ufs2, &dinode);
 	buf_fd = malloc(ufs2->fs_bsize);
 	bl = block_list->blk_add;
 	
+	// a hole has no block to write to, it must stay zero, checked before anything is written
+	for(i = 0; done < totalsize; i++, done += n_write) {
+		n_write = (totalsize - done < ufs2->fs_bsize) ? totalsize - done : ufs2->fs_bsize;
+		if(bl[i] != 0)
+			continue;
+		
+		_fseeki64(fd, done, SEEK_SET);
+		fread(buf_fd, sizeof(u8), n_write, fd);
+		for(j = 0; j < n_write && buf_fd[j] == 0; j++);
+		if(j < n_write) {
+			ufs_free_block_list(block_list);
+			free(buf_fd);
+			fclose(fd);
+			return PS3HDD_EHOLE;
+		}
+	}
+	_fseeki64(fd, 0, SEEK_SET);
+	done = 0;
+	
+	dev_writer_init(&w, ctx);
+	w.delta = delta;
 	
+	// read the patched file in order, blocks that follow each other are written at once
 	for(i = 0; done < totalsize; i++) {
-		if(totalsize - done < ufs2->fs_bsize) {  
-			fseek(fd, done, SEEK_SET);
-			fread(buf_fd, sizeof(u8), totalsize - done, fd);
-			n_write = device_write(ctx, buf_fd, totalsize - done, (bl[i] * ufs2->fs_fsize) + (ctx->hdd0_start * SECTOR_SIZE));
-			done += n_write;
-		}
-		else {  
-			fseek(fd, done, SEEK_SET);
-			fread(buf_fd, sizeof(u8), ufs2->fs_bsize, fd);
-			n_write = device_write(ctx, buf_fd, ufs2->fs_bsize, (bl[i] * ufs2->fs_fsize) + (ctx->hdd0_start * SECTOR_SIZE));
-			done += n_write;
-		}
+		n_write = (totalsize - done < ufs2->fs_bsize) ? totalsize - done : ufs2->fs_bsize;
+		fread(buf_fd, sizeof(u8), n_write, fd);
+		
+		if(bl[i] != 0)
+			dev_writer_write(&w, buf_fd, n_write, (bl[i] * ufs2->fs_fsize) + (ctx->hdd0_start * SECTOR_SIZE));
+		done += n_write;
 		
 		fprintf(stderr,"(%03lld%%)\r", done * 100 / totalsize);
 	}
 	
+	dev_writer_close(&w);
+	if(delta)
+		printf("%lld bytes changed, %lld bytes written\n", w.changed, w.written);
+	ufs_free_block_list(block_list);
 	free(buf_fd);
 	fclose(fd);
 	
 	return 0;
 }
+/***********************************************************************
+* Cylinder group scan task, reads the cg header and the initialized
+* part of its inode table with large sequential reads.
+***********************************************************************/
+typedef struct _ufs_cg_scan_ {
+	ps3_context *ctx;
+	struct fs *ufs2;
+	s64 cg;                   // cylinder group number
+	s64 cg_time;              // time cg was last written
+	u32 count;                // allocated inodes found
+	u32 max;                  // allocated entries in node
+	ufs_inv_node *node;       // allocated inodes of this cg
+} ufs_cg_scan;
+
+static void ufs_scan_cg(void *arg, s32 worker)
+{
+	ufs_cg_scan *scan = arg;
+	ps3_context *ctx = scan->ctx;
+	struct fs *ufs2 = scan->ufs2;
+	u8 *cg_buf, *used, *tab;
+	struct cg *cgp;
+	struct ufs2_dinode *di;
+	ufs_inv_node *node;
+	s64 i, j, n, initediblk, per_read;
+	s64 part = ctx->hdd0_start * SECTOR_SIZE;
+	
+	cg_buf = malloc(ufs2->fs_cgsize);
+	device_read(ctx, cg_buf, ufs2->fs_cgsize, part + (cgtod(ufs2, scan->cg) * ufs2->fs_fsize));
+	cgp = (struct cg *)cg_buf;
+	
+	// no inodes from a bad group, counted in n_bad of the inventory
+	if(_ES32(cgp->cg_magic) != CG_MAGIC) {
+		scan->cg_time = -1;
+		free(cg_buf);
+		return;
+	}
+	
+	scan->cg_time = _ES64(cgp->cg_time);
+	
+	// inode blocks after cg_initediblk were never written
+	initediblk = _ES32(cgp->cg_initediblk);
+	if(initediblk > ufs2->fs_ipg)
+		initediblk = ufs2->fs_ipg;
+	used = cg_buf + _ES32(cgp->cg_iusedoff);
+	
+	per_read = EXTRACT_BUF_SIZE / sizeof(struct ufs2_dinode);
+	tab = malloc(per_read * sizeof(struct ufs2_dinode));
+	
+	for(i = 0; i < initediblk; i += n) {
+		n = (initediblk - i < per_read) ? initediblk - i : per_read;
+		device_read(ctx, tab, n * sizeof(struct ufs2_dinode), 
+		            part + (cgimin(ufs2, scan->cg) * ufs2->fs_fsize) + (i * sizeof(struct ufs2_dinode)));
+		
+		for(j = 0; j < n; j++) {
+			if((used[(i + j) / 8] & (1 << ((i + j) % 8))) == 0)
+				continue;
+			
+			di = (struct ufs2_dinode *)(tab + (j * sizeof(struct ufs2_dinode)));
+			if(di->di_mode == 0 || (scan->cg * ufs2->fs_ipg) + i + j < ROOTINO)
+				continue;
+			
+			if(scan->count == scan->max) {
+				scan->max = scan->max ? scan->max * 2 : 256;
+				scan->node = realloc(scan->node, scan->max * sizeof(*scan->node));
+			}
+			node = &scan->node[scan->count++];
+			memset(node, 0, sizeof(*node));
+			node->ino   = (scan->cg * ufs2->fs_ipg) + i + j;
+			node->dirty = TRUE;
+			memcpy(&node->di, di, sizeof(*di));
+		}
+	}
+	
+	free(tab);
+	free(cg_buf);
+}
+
+/***********************************************************************
+* Directory scan task, collects inode number and name of all entries.
+***********************************************************************/
+typedef struct _ufs_dir_scan_ {
+	ps3_context *ctx;
+	struct fs *ufs2;
+	ufs_inv_node *dir;        // directory to read
+	u32 count;                // entries found
+	u32 max;                  // allocated entries
+	ufs_inop *ino;            // inode of each entry
+	char **name;              // name of each entry
+} ufs_dir_scan;
+
+static void ufs_scan_dir(void *arg, s32 worker)
+{
+	ufs_dir_scan *scan = arg;
+	struct ufs2_dinode *di = &scan->dir->di;
+	ufs2_block_list *block_list;
+	struct direct dir;
+	u8 *buf, *p;
+	s32 ret;
+	
+	buf = malloc(_ES64(di->di_size) + sizeof(struct direct));
+	block_list = get_block_list(scan->ctx, scan->ufs2, di);
+	ufs_read_data_by_blocklist(scan->ctx, scan->ufs2, di, block_list, buf, 0, 0);
+	ufs_free_block_list(block_list);
+	
+	for(p = buf; p - buf < _ES64(di->di_size); p += ret) {
+		ret = ufs_read_direntry(p, &dir);
+		if(ret <= 0)
+			break;
+		
+		if(dir.d_ino == 0 || !strcmp(dir.d_name, ".") || !strcmp(dir.d_name, ".."))
+			continue;
+		
+		if(scan->count == scan->max) {
+			scan->max = scan->max ? scan->max * 2 : 32;
+			scan->ino  = realloc(scan->ino, scan->max * sizeof(*scan->ino));
+			scan->name = realloc(scan->name, scan->max * sizeof(*scan->name));
+		}
+		scan->ino[scan->count]  = _ES32(dir.d_ino);
+		scan->name[scan->count] = strdup(dir.d_name);
+		scan->count++;
+	}
+	
+	free(buf);
+}
+
+/***********************************************************************
+* Extent task, turns the block list of an inode into hdd extents.
+***********************************************************************/
+typedef struct _ufs_ext_scan_ {
+	ps3_context *ctx;
+	struct fs *ufs2;
+	ufs_inv_node *node;       // inode to map
+} ufs_ext_scan;
+
+static void ufs_scan_ext(void *arg, s32 worker)
+{
+	ufs_ext_scan *scan = arg;
+	ufs_inv_node *node = scan->node;
+	struct fs *ufs2 = scan->ufs2;
+	s64 i, len, done, off, size = _ES64(node->di.di_size);
+	u32 max = 0;
+	ufs2_block_list *block_list;
+	s64 *bl;
+	
+	block_list = get_block_list(scan->ctx, ufs2, &node->di);
+	bl = block_list->blk_add;
+	
+	for(i = 0, done = 0; done < size; i++, done += len) {
+		len = sblksize(ufs2, size, i);
+		if(len > size - done)
+			len = size - done;
+		if(bl[i] == 0)
+			continue;
+		
+		off = (scan->ctx->hdd0_start * SECTOR_SIZE) + (bl[i] * ufs2->fs_fsize);
+		if(node->n_ext && node->ext[node->n_ext - 1].dev_off + node->ext[node->n_ext - 1].len == off) {
+			node->ext[node->n_ext - 1].len += len;
+			continue;
+		}
+		if(node->n_ext == max) {
+			max = max ? max * 2 : 4;
+			node->ext = realloc(node->ext, max * sizeof(*node->ext));
+		}
+		node->ext[node->n_ext].dev_off = off;
+		node->ext[node->n_ext].len     = len;
+		node->n_ext++;
+	}
+	
+	ufs_free_block_list(block_list);
+}
+/***********************************************************************
+* Find an inode in an inventory.
+* 
+* ufs_inventory *inv = inventory
+* ufs_inop ino       = inode number
+***********************************************************************/
+ufs_inv_node* ufs_inv_find(ufs_inventory *inv, ufs_inop ino)
+{
+	s64 lo = 0, hi = (s64)inv->count - 1, mid;
+	
+	while(lo <= hi) {
+		mid = (lo + hi) / 2;
+		if(inv->node[mid].ino == ino)
+			return &inv->node[mid];
+		if(inv->node[mid].ino < ino)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	
+	return NULL;
+}
+/***********************************************************************
+* sortier function für inventory children, by parent then name
+***********************************************************************/
+static s32 ufs_sort_child(const void *first, const void *second)
+{
+	const ufs_inv_node *a = *(ufs_inv_node * const *)first;
+	const ufs_inv_node *b = *(ufs_inv_node * const *)second;
+	
+	if(a->parent != b->parent)
+		return (a->parent < b->parent) ? -1 : 1;
+	
+	return strcmp(a->name, b->name);
+}
+/***********************************************************************
+* Build the parent/name index of an inventory, used for path lookups.
+* 
+* ufs_inventory *inv = inventory
+***********************************************************************/
+void ufs_inv_link(ufs_inventory *inv)
+{
+	u32 i;
+	
+	free(inv->child);
+	inv->child = malloc((inv->count + 1) * sizeof(*inv->child));
+	inv->n_child = 0;
+	
+	for(i = 0; i < inv->count; i++)
+		if(inv->node[i].name)
+			inv->child[inv->n_child++] = &inv->node[i];
+	
+	qsort(inv->child, inv->n_child, sizeof(*inv->child), ufs_sort_child);
+}
+/***********************************************************************
+* Read directories of an inventory and name their entries.
+* 
+* thread_pool *pool  = workers
+* ufs_inventory *inv = inventory
+* BOOL all           = read all directories, else only dirty ones
+***********************************************************************/
+static void ufs_inv_read_dirs(ps3_context *ctx, struct fs *ufs2, thread_pool *pool, ufs_inventory *inv, BOOL all)
+{
+	s64 i, j, n_dir = 0;
+	ufs_dir_scan *dirs;
+	ufs_inv_node *child;
+	
+	dirs = malloc((inv->count + 1) * sizeof(*dirs));
+	
+	for(i = 0; i < inv->count; i++) {
+		if((_ES16(inv->node[i].di.di_mode) & IFMT) != IFDIR || (!all && !inv->node[i].dirty))
+			continue;
+		memset(&dirs[n_dir], 0, sizeof(*dirs));
+		dirs[n_dir].ctx  = ctx;
+		dirs[n_dir].ufs2 = ufs2;
+		dirs[n_dir].dir  = &inv->node[i];
+		pool_submit(pool, ufs_scan_dir, &dirs[n_dir]);
+		n_dir++;
+	}
+	pool_wait(pool);
+	
+	for(i = 0; i < n_dir; i++) {
+		for(j = 0; j < dirs[i].count; j++) {
+			child = ufs_inv_find(inv, dirs[i].ino[j]);
+			// first name found wins for hard links
+			if(child && child->name == NULL) {
+				child->parent = dirs[i].dir->ino;
+				child->name   = dirs[i].name[j];
+			}
+			else {
+				free(dirs[i].name[j]);
+			}
+		}
+		free(dirs[i].ino);
+		free(dirs[i].name);
+	}
+	free(dirs);
+}
+/***********************************************************************
+* Build an inventory of all allocated inodes. The inode tables of the
+* cylinder groups are read in parallel, then the directories are read
+* to give every inode its parent and name, then the block lists are
+* turned into extents. The tasks read only through device_read, the
+* device is shared and only block_read seeks and reads under io_lock.
+* 
+* With an old inventory the inode tables of all groups are read again,
+* cg_time does not move when an inode is changed in place. Inodes that
+* kept their generation keep their name, unless it came from a changed
+* directory, unchanged inodes keep their extents, and only new or
+* changed directories are read again.
+* If inodes stay without a name after that, because a directory in an
+* unchanged group got new entries, all directories are read again.
+* 
+* ps3_context *ctx   = ps3 device information
+* struct fs *ufs2    = superblock
+* s32 threads        = worker thread count
+* ufs_inventory *old = inventory to refresh or NULL, freed
+***********************************************************************/
+static ufs_inventory* ufs_inv_build(ps3_context *ctx, struct fs *ufs2, s32 threads, ufs_inventory *old)
+{
+	s64 i, j, k, cg_end;
+	BOOL orphans = FALSE, refresh;
+	thread_pool *pool;
+	ufs_inventory *inv;
+	ufs_cg_scan *cgs;
+	ufs_ext_scan *ext;
+	ufs_inv_node *n, *o;
+	
+	if((pool = pool_create(threads)) == NULL) {
+		if(old)
+			ufs_free_inventory(old);
+		return NULL;
+	}
+	
+	if(old && old->ncg != ufs2->fs_ncg) {
+		ufs_free_inventory(old);
+		old = NULL;
+	}
+	refresh = (old != NULL);
+	
+	cgs = malloc(ufs2->fs_ncg * sizeof(*cgs));
+	memset(cgs, 0, ufs2->fs_ncg * sizeof(*cgs));
+	for(i = 0; i < ufs2->fs_ncg; i++) {
+		cgs[i].ctx  = ctx;
+		cgs[i].ufs2 = ufs2;
+		cgs[i].cg   = i;
+		pool_submit(pool, ufs_scan_cg, &cgs[i]);
+	}
+	pool_wait(pool);
+	
+	inv = malloc(sizeof(*inv));
+	memset(inv, 0, sizeof(*inv));
+	inv->ncg = ufs2->fs_ncg;
+	inv->cg_time = malloc(inv->ncg * sizeof(*inv->cg_time));
+	
+	for(i = 0; i < ufs2->fs_ncg; i++) {
+		inv->cg_time[i] = cgs[i].cg_time;
+		inv->count += cgs[i].count;
+		if(cgs[i].cg_time == -1)
+			inv->n_bad++;
+	}
+	inv->node = malloc((inv->count + 1) * sizeof(*inv->node));
+	
+	// cgs are in inode order, so is the merged list
+	for(i = 0, j = 0, k = 0; i < ufs2->fs_ncg; i++) {
+		cg_end = (i + 1) * ufs2->fs_ipg;
+		
+		for(n = cgs[i].node; n < cgs[i].node + cgs[i].count; n++) {
+			// rescanned inode, keep what did not change
+			for(; old && k < old->count && old->node[k].ino < n->ino; k++);
+			o = (old && k < old->count && old->node[k].ino == n->ino) ? &old->node[k] : NULL;
+			
+			if(o && o->di.di_gen == n->di.di_gen) {
+				n->parent = o->parent;
+				n->name   = o->name;
+				o->name   = NULL;
+				if(memcmp(&o->di, &n->di, sizeof(n->di)) == 0) {
+					n->n_ext = o->n_ext;
+					n->ext   = o->ext;
+					n->dirty = FALSE;
+					o->ext   = NULL;
+				}
+			}
+			inv->node[j++] = *n;
+		}
+		for(; old && k < old->count && old->node[k].ino < cg_end; k++);
+		free(cgs[i].node);
+	}
+	free(cgs);
+	
+	if(old)
+		ufs_free_inventory(old);
+	
+	// names given by changed directories are read again
+	for(i = 0; refresh && i < inv->count; i++) {
+		n = ufs_inv_find(inv, inv->node[i].parent);
+		if(n == NULL || n->dirty) {
+			free(inv->node[i].name);
+			inv->node[i].name = NULL;
+		}
+	}
+	
+	// name the entries of all directories, or the dirty ones on refresh
+	ufs_inv_read_dirs(ctx, ufs2, pool, inv, !refresh);
+	
+	if(refresh) {
+		for(i = 0; i < inv->count && !orphans; i++)
+			if(inv->node[i].name == NULL && inv->node[i].ino != ROOTINO)
+				orphans = TRUE;
+		if(orphans)
+			ufs_inv_read_dirs(ctx, ufs2, pool, inv, TRUE);
+	}
+	
+	// extents of new or changed files and directories
+	ext = malloc((inv->count + 1) * sizeof(*ext));
+	for(i = 0, j = 0; i < inv->count; i++) {
+		n = &inv->node[i];
+		if(!n->dirty || _ES64(n->di.di_blocks) == 0 || 
+		   ((_ES16(n->di.di_mode) & IFMT) != IFREG && (_ES16(n->di.di_mode) & IFMT) != IFDIR))
+			continue;
+		ext[j].ctx  = ctx;
+		ext[j].ufs2 = ufs2;
+		ext[j].node = n;
+		pool_submit(pool, ufs_scan_ext, &ext[j]);
+		j++;
+	}
+	pool_wait(pool);
+	pool_destroy(pool);
+	free(ext);
+	
+	ufs_inv_link(inv);
+	
+	return inv;
+}
+/***********************************************************************
+* Build an inventory of all allocated inodes.
+* 
+* ps3_context *ctx = ps3 device information
+* struct fs *ufs2  = superblock
+* s32 threads      = worker thread count
+***********************************************************************/
+ufs_inventory* ufs_scan_inodes(ps3_context *ctx, struct fs *ufs2, s32 threads)
+{
+	return ufs_inv_build(ctx, ufs2, threads, NULL);
+}
+/***********************************************************************
+* Refresh an inventory, only changed inodes are mapped again.
+* 
+* ps3_context *ctx   = ps3 device information
+* struct fs *ufs2    = superblock
+* ufs_inventory *inv = inventory to refresh, freed
+* s32 threads        = worker thread count
+***********************************************************************/
+ufs_inventory* ufs_refresh_inodes(ps3_context *ctx, struct fs *ufs2, ufs_inventory *inv, s32 threads)
+{
+	return ufs_inv_build(ctx, ufs2, threads, inv);
+}
+/***********************************************************************
+* Free an inventory.
+***********************************************************************/
+void ufs_free_inventory(ufs_inventory *inv)
+{
+	u32 i;
+	
+	for(i = 0; i < inv->count; i++) {
+		free(inv->node[i].name);
+		free(inv->node[i].ext);
+	}
+	free(inv->child);
+	free(inv->cg_time);
+	free(inv->node);
+	free(inv);
+}
+/***********************************************************************
+* Build the full path of an inventory node.
+* 
+* ufs_inventory *inv = inventory
+* ufs_inv_node *node = node
+* char *out          = buffer for the path, MAX_PATH * 4 bytes
+***********************************************************************/
+void ufs_inv_path(ufs_inventory *inv, ufs_inv_node *node, char *out)
+{
+	s32 i, depth = 0;
+	ufs_inv_node *stack[128];
+	
+	out[0] = '\0';
+	
+	if(node->ino == ROOTINO) {
+		strcpy(out, "/");
+		return;
+	}
+	
+	while(node && node->ino != ROOTINO && depth < 128) {
+		if(node->name == NULL) {
+			sprintf(out, "#%lld", node->ino);
+			break;
+		}
+		stack[depth++] = node;
+		node = ufs_inv_find(inv, node->parent);
+	}
+	
+	for(i = depth - 1; i >= 0; i--) {
+		if(strlen(out) + strlen(stack[i]->name) + 2 >= MAX_PATH * 4)
+			break;
+		strcat(out, "/");
+		strcat(out, stack[i]->name);
+	}
+}
+/***********************************************************************
+* Find a named entry of a directory in an inventory.
+***********************************************************************/
+static ufs_inv_node* ufs_inv_child(ufs_inventory *inv, ufs_inop parent, const char *name)
+{
+	s64 lo = 0, hi = (s64)inv->n_child - 1, mid;
+	s32 c;
+	
+	while(lo <= hi) {
+		mid = (lo + hi) / 2;
+		if(inv->child[mid]->parent != parent)
+			c = (inv->child[mid]->parent < parent) ? -1 : 1;
+		else
+			c = strcmp(inv->child[mid]->name, name);
+		if(c == 0)
+			return inv->child[mid];
+		if(c < 0)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	
+	return NULL;
+}
+/***********************************************************************
+* Look up a path in an inventory, without reading the hdd. Symlinks
+* inside the path are followed if their target is stored in the inode.
+* 
+* ufs_inventory *inv = inventory
+* u8 *path           = absolute path
+* int follow         = follow a symlink as last component too
+* 
+* return: inode number, 0 if not found or not resolvable
+***********************************************************************/
+ufs_inop ufs_inv_lookup(ufs_inventory *inv, u8 *path, int follow)
+{
+	s32 hops = 0;
+	char *s, *sorig, *name;
+	char link[MAX_PATH * 2];
+	ufs_inop dir = ROOTINO;
+	ufs_inv_node *node = NULL;
+	
+	s = sorig = strdup((char*)path);
+	
+	while(s && *s) {
+		name = s;
+		if((s = strchr(s, '/')))
+			*s++ = '\0';
+		if(*name == '\0' || !strcmp(name, "."))
+			continue;
+		
+		if(!strcmp(name, "..")) {
+			node = ufs_inv_find(inv, dir);
+			if(node && node->ino != ROOTINO)
+				dir = node->parent;
+			continue;
+		}
+		
+		if((node = ufs_inv_child(inv, dir, name)) == NULL) {
+			free(sorig);
+			return 0;
+		}
+		
+		if((_ES16(node->di.di_mode) & IFMT) == IFLNK && (follow || (s && *s))) {
+			// only symlinks kept inside the inode can be resolved
+			if(_ES64(node->di.di_blocks) != 0 || ++hops > 16 || _ES64(node->di.di_size) >= MAX_PATH) {
+				free(sorig);
+				return 0;
+			}
+			memcpy(link, node->di.di_db, _ES64(node->di.di_size));
+			link[_ES64(node->di.di_size)] = '\0';
+			if(s && *s) {
+				strcat(link, "/");
+				strncat(link, s, sizeof(link) - strlen(link) - 1);
+			}
+			if(link[0] == '/')
+				dir = ROOTINO;
+			free(sorig);
+			s = sorig = strdup(link);
+			continue;
+		}
+		
+		dir = node->ino;
+	}
+	
+	free(sorig);
+	return dir;
+}
+/***********************************************************************
+* Print a directory like ufs_print_dir_list, from an inventory.
+* 
+* ps3_context *ctx   = ps3 device information
+* struct fs *ufs2    = superblock
+* ufs_inventory *inv = inventory
+* u8 *path           = directory
+* u8 *volume         = volume name
+***********************************************************************/
+s32 ufs_inv_print_dir_list(ps3_context *ctx, struct fs *ufs2, ufs_inventory *inv, u8 *path, u8 *volume)
+{
+	s64 lo, hi, i;
+	u64 file_count = 0, dir_count = 0, byte_use = 0;
+	ufs_inop ino;
+	ufs_inv_node *dir, *e;
+	ufs_inv_node *parent;
+	ufs2_block_list *block_list;
+	time_t mtime;
+	struct tm *tm;
+	char timestr[64];
+	char sizestr[32];
+	char byte_use_str[32];
+	char byte_free_str[32];
+	char symlinkstr[1028];
+	u8 tmpname[1024];
+	
+	if((ino = ufs_inv_lookup(inv, path, 1)) == 0 || (dir = ufs_inv_find(inv, ino)) == NULL)
+		return PS3HDD_ENOENT;
+	
+	if((_ES16(dir->di.di_mode) & IFMT) != IFDIR)
+		return PS3HDD_ENOTDIR;
+	
+	// children of dir are one sorted run in the child index
+	for(lo = 0, hi = inv->n_child; lo < hi;) {
+		i = (lo + hi) / 2;
+		if(inv->child[i]->parent < ino)
+			lo = i + 1;
+		else
+			hi = i;
+	}
+	
+	printf("\n Volume is ps3_hdd %s\n", volume);
+	printf(" Directory of %s/%s\n\n", volume, path);
+	
+	parent = (ino == ROOTINO) ? dir : ufs_inv_find(inv, dir->parent);
+	for(i = 0; i < 2; i++) {
+		e = (i == 0) ? dir : (parent ? parent : dir);
+		mtime = _ES64(e->di.di_mtime);
+		tm = localtime(&mtime);
+		strftime(timestr, 64, "%m.%d.%Y  %H:%M", tm);
+		printf("%s    %-14s %s\n", timestr, "<DIR>", i == 0 ? "." : "..");
+		dir_count++;
+	}
+	
+	for(i = lo; i < inv->n_child && inv->child[i]->parent == ino; i++) {
+		e = inv->child[i];
+		mtime = _ES64(e->di.di_mtime);
+		tm = localtime(&mtime);
+		strftime(timestr, 64, "%m.%d.%Y  %H:%M", tm);
+		
+		// entry is link
+		symlinkstr[0] = '\0';
+		if((_ES16(e->di.di_mode) & IFMT) == IFLNK && _ES64(e->di.di_size) < sizeof(tmpname)) {
+			block_list = get_block_list(ctx, ufs2, &e->di);
+			ufs_read_data_by_blocklist(ctx, ufs2, &e->di, block_list, tmpname, 0, 0);
+			ufs_free_block_list(block_list);
+			tmpname[_ES64(e->di.di_size)] = '\0';
+			sprintf(symlinkstr, " -> %s", tmpname);
+		}
+		
+		if((_ES16(e->di.di_mode) & IFMT) == IFDIR) {
+			dir_count++;
+			printf("%s    %-14s %s\n", timestr, "<DIR>", e->name);
+		}
+		else {
+			file_count++;
+			byte_use += _ES64(e->di.di_size);
+			print_commas(_ES64(e->di.di_size), sizestr);
+			printf("%s    %14s %s %s\n", timestr, sizestr, e->name, symlinkstr);
+		}
+	}
+	
+	print_commas(byte_use, byte_use_str);
+	print_commas(_ES64(ufs2->fs_cstotal.cs_nbfree) * ufs2->fs_bsize, byte_free_str);
+	printf("%16llu File(s),  ", file_count);
+	printf("%s bytes\n", byte_use_str);
+	printf("%16llu Dir(s),  ", dir_count);
+	printf("%s bytes free\n", byte_free_str);
+	
+	return 0;
+}
+/***********************************************************************
+* Write a string as JSON or CSV field.
+***********************************************************************/
+static void ufs_put_str(FILE *out, const char *s, BOOL csv)
+{
+	fputc('"', out);
+	for(; *s; s++) {
+		if(csv) {
+			if(*s == '"')
+				fputc('"', out);
+			fputc(*s, out);
+		}
+		else if(*s == '"' || *s == '\\') {
+			fputc('\\', out);
+			fputc(*s, out);
+		}
+		else if((u8)*s < 0x20) {
+			fprintf(out, "\\u%04x", (u8)*s);
+		}
+		else {
+			fputc(*s, out);
+		}
+	}
+	fputc('"', out);
+}
+/***********************************************************************
+* Write the extents of an inode as hdd sector and byte count pairs.
+***********************************************************************/
+static void ufs_put_extents(ufs_inv_node *node, FILE *out, BOOL csv)
+{
+	u32 i;
+	
+	fputs(csv ? "\"" : "[", out);
+	for(i = 0; i < node->n_ext; i++)
+		fprintf(out, csv ? "%s%lld:%lld" : "%s[%lld,%lld]", i ? (csv ? " " : ",") : "", 
+		        node->ext[i].dev_off / SECTOR_SIZE, node->ext[i].len);
+	fputs(csv ? "\"" : "]", out);
+}
+/***********************************************************************
+* Write an inventory as JSON lines or CSV, one line per inode.
+* 
+* ps3_context *ctx   = ps3 device information
+* struct fs *ufs2    = superblock
+* ufs_inventory *inv = inventory
+* FILE *out          = output stream
+* BOOL csv           = CSV instead of JSON lines
+***********************************************************************/
+s32 ufs_print_inventory(ps3_context *ctx, struct fs *ufs2, ufs_inventory *inv, FILE *out, BOOL csv)
+{
+	u32 i;
+	char *path = malloc(MAX_PATH * 4);
+	struct ufs2_dinode *di;
+	
+	if(csv)
+		fprintf(out, "path,inode,size,mode,atime,mtime,ctime,birthtime,extents\n");
+	
+	for(i = 0; i < inv->count; i++) {
+		di = &inv->node[i].di;
+		ufs_inv_path(inv, &inv->node[i], path);
+		
+		if(csv) {
+			ufs_put_str(out, path, TRUE);
+			fprintf(out, ",%lld,%lld,%o,%lld,%lld,%lld,%lld,", 
+			        inv->node[i].ino, _ES64(di->di_size), _ES16(di->di_mode), 
+			        _ES64(di->di_atime), _ES64(di->di_mtime), _ES64(di->di_ctime), _ES64(di->di_birthtime));
+			ufs_put_extents(&inv->node[i], out, TRUE);
+			fputc('\n', out);
+		}
+		else {
+			fputs("{\"path\":", out);
+			ufs_put_str(out, path, FALSE);
+			fprintf(out, ",\"inode\":%lld,\"size\":%lld,\"mode\":%u,\"atime\":%lld,\"mtime\":%lld,\"ctime\":%lld,\"birthtime\":%lld,\"extents\":", 
+			        inv->node[i].ino, _ES64(di->di_size), _ES16(di->di_mode), 
+			        _ES64(di->di_atime), _ES64(di->di_mtime), _ES64(di->di_ctime), _ES64(di->di_birthtime));
+			ufs_put_extents(&inv->node[i], out, FALSE);
+			fputs("}\n", out);
+		}
+	}
+	
+	free(path);
+	return 0;
+}
@@ -7,18 +7,54 @@
 #define _UFS2_H_
 
 #include "../types.h"
+#include "../ps3hdd.h"
 #include "../device.h"
 #include "../util.h"
+#include "../extract.h"
 #include "ufs/dinode.h"
 #include "ufs/fs.h"
 #include "ufs/dir.h"
 #include "ufs/ps3.h"
 #include "misc.h"
 
+typedef struct _ufs_inv_node_ {
+	ufs_inop ino;             // inode number
+	ufs_inop parent;          // directory naming this inode, 0 if none
+	char *name;               // name in parent directory
+	u32 n_ext;                // extent count
+	extract_extent *ext;      // data on hdd, holes left out
+	u8 dirty;                 // new or changed in the last scan
+	struct ufs2_dinode di;    // on-disk inode
+} ufs_inv_node;
+
+typedef struct _ufs_inventory_ {
+	u32 count;                // allocated inodes
+	ufs_inv_node *node;       // sorted by inode number
+	u32 n_child;              // named inodes
+	ufs_inv_node **child;     // named inodes, sorted by parent and name
+	s64 ncg;                  // cylinder group count
+	s64 *cg_time;             // cg_time of each group at scan time
+	u32 n_bad;                // cylinder groups with a bad magic, their inodes are missing
+} ufs_inventory;
+
 struct fs* ufs_init(ps3_context *ctx);
 ufs_inop ufs_lookup_path(ps3_context *ctx, struct fs* ufs2, u8* path, int follow, ufs_inop root_ino);
 s32 ufs_print_dir_list(ps3_context *ctx, struct fs* ufs2, u8* path, u8* volume);
-s32 ufs_copy_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop ino, char *srcpath, char *destpath);
-s32 ufs_replace_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop ino, char *path);
+BOOL ufs_is_dir(ps3_context *ctx, struct fs *ufs2, ufs_inop ino);
+s32 ufs_read_inode(ps3_context *ctx, struct fs *ufs2, ufs_inop ino, struct ufs2_dinode *di);
+s32 ufs_read_dir(ps3_context *ctx, struct fs *ufs2, ufs_inop ino, struct direct **dirs);
+extract_file* ufs_map_file(ps3_context *ctx, struct fs *ufs2, struct ufs2_dinode *di, const char *dest);
+s32 ufs_print_stat(ps3_context *ctx, struct fs *ufs2, u8 *path);
+s32 ufs_copy_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop ino, char *srcpath, char *destpath, extract_job *job);
+s32 ufs_replace_data(ps3_context *ctx, struct fs *ufs2, ufs_inop root_ino, ufs_inop ino, char *path, BOOL delta);
+ufs_inventory* ufs_scan_inodes(ps3_context *ctx, struct fs *ufs2, s32 threads);
+ufs_inventory* ufs_refresh_inodes(ps3_context *ctx, struct fs *ufs2, ufs_inventory *inv, s32 threads);
+ufs_inv_node* ufs_inv_find(ufs_inventory *inv, ufs_inop ino);
+void ufs_inv_link(ufs_inventory *inv);
+ufs_inop ufs_inv_lookup(ufs_inventory *inv, u8 *path, int follow);
+s32 ufs_inv_print_dir_list(ps3_context *ctx, struct fs *ufs2, ufs_inventory *inv, u8 *path, u8 *volume);
+void ufs_inv_path(ufs_inventory *inv, ufs_inv_node *node, char *out);
+void ufs_free_inventory(ufs_inventory *inv);
+s32 ufs_print_inventory(ps3_context *ctx, struct fs *ufs2, ufs_inventory *inv, FILE *out, BOOL csv);
 
 #endif  // _UFS2_H_
@@ -0,0 +1,740 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "vfs.h"
+#include "index.h"
+
+typedef struct _vfs_entry_ {
+	const char *name;         // volume name
+	const vfs_ops *ops;       // filesystem of the volume
+} vfs_entry;
+
+
+
+/***********************************************************************
+* Copy a path into a buffer, the filesystems may change it.
+*
+* const char *path = path on the volume
+* char *tmp        = receives the path, MAX_PATH bytes
+***********************************************************************/
+static s32 vfs_path(const char *path, char *tmp)
+{
+	if(strlen(path) >= MAX_PATH)
+		return -1;
+	strcpy(tmp, path);
+
+	return 0;
+}
+
+/***********************************************************************
+* Fill a node from a UFS2 inode.
+*
+* vfs_node *node         = node
+* ufs_inop ino           = inode number
+* struct ufs2_dinode *di = inode, big endian
+***********************************************************************/
+static void vfs_ufs2_node(vfs_node *node, ufs_inop ino, struct ufs2_dinode *di)
+{
+	switch(_ES16(di->di_mode) & IFMT) {
+		case IFDIR: node->type = VFS_DIR;   break;
+		case IFLNK: node->type = VFS_LINK;  break;
+		case IFREG: node->type = VFS_FILE;  break;
+		default:    node->type = VFS_OTHER; break;
+	}
+
+	node->mode  = _ES16(di->di_mode) & 07777;
+	node->size  = _ES64(di->di_size);
+	node->id    = ino;
+	node->atime = _ES64(di->di_atime);
+	node->mtime = _ES64(di->di_mtime);
+	node->ctime = _ES64(di->di_ctime);
+	node->di    = *di;
+}
+
+/***********************************************************************
+* Read a UFS2 inode, from the index if there is one.
+*
+* vfs_volume *vol        = volume
+* ufs_inop ino           = inode number
+* struct ufs2_dinode *di = receives the inode
+***********************************************************************/
+static void vfs_ufs2_inode(vfs_volume *vol, ufs_inop ino, struct ufs2_dinode *di)
+{
+	ufs_inv_node *n;
+
+	if(vol->inv && (n = ufs_inv_find(vol->inv, ino)) != NULL)
+		*di = n->di;
+	else
+		ufs_read_inode(vol->ctx, vol->ufs2, ino, di);
+}
+
+/***********************************************************************
+* Find the inode of a UFS2 path, in the index if there is one.
+*
+* vfs_volume *vol = volume
+* char *path      = path on the volume
+* int follow      = follow a symlink at the end
+***********************************************************************/
+static ufs_inop vfs_ufs2_find(vfs_volume *vol, char *path, int follow)
+{
+	ufs_inop ino = 0;
+
+	if(vol->inv)
+		ino = ufs_inv_lookup(vol->inv, (u8*)path, follow);
+	if(ino == 0)
+		ino = ufs_lookup_path(vol->ctx, vol->ufs2, (u8*)path, follow, ROOTINO);
+
+	return ino;
+}
+
+/***********************************************************************
+* UFS2 mount, read the superblock.
+***********************************************************************/
+static s32 vfs_ufs2_mount(vfs_volume *vol)
+{
+	if((vol->ufs2 = ufs_init(vol->ctx)) == NULL)
+		return PS3HDD_ENOMEM;
+
+	// a failed read leaves no superblock
+	if(vol->ufs2->fs_magic != FS_UFS2_MAGIC) {
+		free(vol->ufs2);
+		vol->ufs2 = NULL;
+		return PS3HDD_EIO;
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+* UFS2 umount, free the superblock and index.
+***********************************************************************/
+static void vfs_ufs2_umount(vfs_volume *vol)
+{
+	if(vol->inv)
+		ufs_free_inventory(vol->inv);
+	free(vol->ufs2);
+}
+
+/***********************************************************************
+* UFS2 index, load the index file or scan all inodes.
+***********************************************************************/
+static s32 vfs_ufs2_index(vfs_volume *vol, const char *file, s32 threads)
+{
+	if(vol->inv == NULL) {
+		if(file)
+			vol->inv = ufs_index_open(vol->ctx, vol->ufs2, file, threads);
+		else
+			vol->inv = ufs_scan_inodes(vol->ctx, vol->ufs2, threads);
+	}
+
+	return vol->inv ? 0 : -1;
+}
+
+/***********************************************************************
+* UFS2 lookup, find the inode of a path.
+***********************************************************************/
+static s32 vfs_ufs2_lookup(vfs_volume *vol, char *path, int follow, vfs_node *node)
+{
+	struct ufs2_dinode di;
+	ufs_inop ino;
+
+	if((ino = vfs_ufs2_find(vol, path, follow)) == 0)
+		return -1;
+
+	vfs_ufs2_inode(vol, ino, &di);
+	vfs_ufs2_node(node, ino, &di);
+
+	return 0;
+}
+
+/***********************************************************************
+* UFS2 readdir, read a folder and its inodes.
+***********************************************************************/
+static s32 vfs_ufs2_readdir(vfs_volume *vol, vfs_node *dir, vfs_node **nodes)
+{
+	struct direct *dirs;
+	struct ufs2_dinode di;
+	vfs_node *n;
+	s32 i, count, ret = 0;
+
+	if((count = ufs_read_dir(vol->ctx, vol->ufs2, dir->id, &dirs)) < 0)
+		return -1;
+
+	n = malloc((count ? count : 1) * sizeof(vfs_node));
+	memset(n, 0, (count ? count : 1) * sizeof(vfs_node));
+
+	for(i = 0; i < count; i++) {
+		if(strcmp(dirs[i].d_name, ".") == 0 || strcmp(dirs[i].d_name, "..") == 0)
+			continue;
+		vfs_ufs2_inode(vol, _ES32(dirs[i].d_ino), &di);
+		vfs_ufs2_node(&n[ret], _ES32(dirs[i].d_ino), &di);
+		strncpy(n[ret].name, dirs[i].d_name, VFS_NAME_MAX - 1);
+		ret++;
+	}
+
+	if(count > 0)
+		free(dirs);
+
+	*nodes = n;
+	return ret;
+}
+
+/***********************************************************************
+* UFS2 extents, map the blocks of an inode.
+***********************************************************************/
+static extract_file* vfs_ufs2_extents(vfs_volume *vol, vfs_node *node, const char *dest)
+{
+	return ufs_map_file(vol->ctx, vol->ufs2, &node->di, dest);
+}
+
+/***********************************************************************
+* UFS2 list, show a folder.
+***********************************************************************/
+static s32 vfs_ufs2_list(vfs_volume *vol, char *path)
+{
+	if(vol->inv)
+		return ufs_inv_print_dir_list(vol->ctx, vol->ufs2, vol->inv, (u8*)path, (u8*)vol->name);
+
+	return ufs_print_dir_list(vol->ctx, vol->ufs2, (u8*)path, (u8*)vol->name);
+}
+
+/***********************************************************************
+* UFS2 stat, show an inode.
+***********************************************************************/
+static s32 vfs_ufs2_stat(vfs_volume *vol, char *path)
+{
+	return ufs_print_stat(vol->ctx, vol->ufs2, (u8*)path);
+}
+
+/***********************************************************************
+* UFS2 copy, copy a file or folder.
+***********************************************************************/
+static s32 vfs_ufs2_copy(vfs_volume *vol, char *path, char *dest, extract_job *job)
+{
+	return ufs_copy_data(vol->ctx, vol->ufs2, ROOTINO, vfs_ufs2_find(vol, path, 0), path, dest, job);
+}
+
+/***********************************************************************
+* UFS2 replace, write a file back.
+***********************************************************************/
+static s32 vfs_ufs2_replace(vfs_volume *vol, char *path, BOOL delta)
+{
+	return ufs_replace_data(vol->ctx, vol->ufs2, ROOTINO, vfs_ufs2_find(vol, path, 0), path, delta);
+}
+
+/***********************************************************************
+* Fill a node from a FAT short entry.
+*
+* vfs_node *node     = node
+* struct sfn_e *sfn  = short entry
+***********************************************************************/
+static void vfs_fat_node(vfs_node *node, struct sfn_e *sfn)
+{
+	BOOL dir = (sfn->d_att & A_DIR) == A_DIR;
+
+	node->type  = dir ? VFS_DIR : VFS_FILE;
+	node->mode  = dir ? 0755 : (sfn->d_att & A_READONLY) ? 0444 : 0644;
+	node->size  = dir ? 0 : sfn->d_size;
+	node->id    = sfn->d_start_clu;
+	node->atime = fat2unix_time(sfn->d_atime, sfn->d_adate);
+	node->mtime = fat2unix_time(sfn->d_mtime, sfn->d_mdate);
+	node->ctime = fat2unix_time(sfn->d_ctime, sfn->d_cdate);
+	node->sfn   = *sfn;
+}
+
+/***********************************************************************
+* FAT32 mount, read the bootsector.
+***********************************************************************/
+static s32 vfs_fat32_mount(vfs_volume *vol)
+{
+	return (vol->fat32 = init_fat32(vol->ctx, vol->storage)) ? 0 : PS3HDD_ENOMEM;
+}
+
+/***********************************************************************
+* FAT12/16 mount, read the bootsector.
+***********************************************************************/
+static s32 vfs_fat_mount(vfs_volume *vol)
+{
+	return (vol->fat_fs = init_fat_old(vol->ctx, vol->storage)) ? 0 : PS3HDD_ENOMEM;
+}
+
+/***********************************************************************
+* FAT umount, free the bootsector.
+***********************************************************************/
+static void vfs_fat_umount(vfs_volume *vol)
+{
+	free(vol->fat32);
+	free(vol->fat_fs);
+}
+
+/***********************************************************************
+* FAT lookup, find the short entry of a path.
+***********************************************************************/
+static s32 vfs_fat_lookup(vfs_volume *vol, char *path, int follow, vfs_node *node)
+{
+	struct sfn_e *sfn;
+
+	// the root has no entry
+	if(strcmp(path, "/") == 0) {
+		node->type = VFS_DIR;
+		node->mode = 0755;
+		node->id   = vol->fat_fs ? 0 : vol->fat32->bs32_rootclu;
+		return 0;
+	}
+
+	if((sfn = fat_lookup_path(vol->ctx, vol->storage, vol->fat_fs, vol->fat32, (u8*)path, 0)) == NULL)
+		return -1;
+
+	vfs_fat_node(node, sfn);
+	free(sfn);
+
+	return 0;
+}
+
+/***********************************************************************
+* FAT readdir, read a folder.
+***********************************************************************/
+static s32 vfs_fat_readdir(vfs_volume *vol, vfs_node *dir, vfs_node **nodes)
+{
+	fat_dir *d;
+	vfs_node *n;
+	s32 i, ret = 0;
+
+	// cached by fat.c, not freed here
+	d = fat_open_dir(vol->ctx, vol->storage, vol->fat_fs, vol->fat32, (fat_add_t)dir->id);
+
+	n = malloc((d->count ? d->count : 1) * sizeof(vfs_node));
+	memset(n, 0, (d->count ? d->count : 1) * sizeof(vfs_node));
+
+	for(i = 0; i < d->count; i++) {
+		if(strcmp((char*)d->e[i].fd_name, ".") == 0 || strcmp((char*)d->e[i].fd_name, "..") == 0)
+			continue;
+		if(d->sfn[i].d_att & A_VOLUME)
+			continue;
+		vfs_fat_node(&n[ret], &d->sfn[i]);
+		strncpy(n[ret].name, (char*)d->e[i].fd_name, VFS_NAME_MAX - 1);
+		ret++;
+	}
+
+	*nodes = n;
+	return ret;
+}
+
+/***********************************************************************
+* FAT extents, map the cluster chain of an entry.
+***********************************************************************/
+static extract_file* vfs_fat_extents(vfs_volume *vol, vfs_node *node, const char *dest)
+{
+	return fat_map_file(vol->ctx, vol->storage, vol->fat_fs, vol->fat32, &node->sfn, dest);
+}
+
+/***********************************************************************
+* FAT list, show a folder with the free space.
+***********************************************************************/
+static s32 vfs_fat_list(vfs_volume *vol, char *path)
+{
+	// free space only changes by replace, count it once
+	if(*vol->free_byte == 0)
+		*vol->free_byte = fat_how_many_free_bytes(vol->ctx, vol->storage, vol->fat_fs, vol->fat32);
+
+	return fat_print_dir_list(vol->ctx, vol->storage, vol->fat_fs, vol->fat32, (u8*)path, (u8*)vol->name, *vol->free_byte);
+}
+
+/***********************************************************************
+* FAT stat, show an entry.
+***********************************************************************/
+static s32 vfs_fat_stat(vfs_volume *vol, char *path)
+{
+	return fat_print_stat(vol->ctx, vol->storage, vol->fat_fs, vol->fat32, (u8*)path);
+}
+
+/***********************************************************************
+* FAT copy, copy a file or folder.
+***********************************************************************/
+static s32 vfs_fat_copy(vfs_volume *vol, char *path, char *dest, extract_job *job)
+{
+	return fat_copy_data(vol->ctx, vol->storage, vol->fat_fs, vol->fat32, path, dest, job);
+}
+
+/***********************************************************************
+* FAT replace, write a file back.
+***********************************************************************/
+static s32 vfs_fat_replace(vfs_volume *vol, char *path, BOOL delta)
+{
+	return fat_replace_data(vol->ctx, vol->storage, vol->fat_fs, vol->fat32, path, delta);
+}
+
+static const vfs_ops vfs_ufs2_ops = {
+	"UFS2", vfs_ufs2_mount, vfs_ufs2_umount, vfs_ufs2_index, vfs_ufs2_lookup, vfs_ufs2_readdir,
+	vfs_ufs2_extents, vfs_ufs2_list, vfs_ufs2_stat, vfs_ufs2_copy, vfs_ufs2_replace
+};
+
+static const vfs_ops vfs_fat32_ops = {
+	"FAT32", vfs_fat32_mount, vfs_fat_umount, NULL, vfs_fat_lookup, vfs_fat_readdir,
+	vfs_fat_extents, vfs_fat_list, vfs_fat_stat, vfs_fat_copy, vfs_fat_replace
+};
+
+static const vfs_ops vfs_fat_ops = {
+	"FAT12/16", vfs_fat_mount, vfs_fat_umount, NULL, vfs_fat_lookup, vfs_fat_readdir,
+	vfs_fat_extents, vfs_fat_list, vfs_fat_stat, vfs_fat_copy, vfs_fat_replace
+};
+
+static const vfs_entry vfs_volumes[VFS_COUNT] = {
+	{"dev_hdd0",   &vfs_ufs2_ops},
+	{"dev_hdd1",   &vfs_fat32_ops},
+	{"dev_flash",  &vfs_fat_ops},
+	{"dev_flash2", &vfs_fat_ops},
+	{"dev_flash3", &vfs_fat_ops},
+};
+
+/***********************************************************************
+* Start sector and free byte counter of a volume.
+*
+* ps3_context *ctx = ps3 device information
+* s32 index        = index into vfs_volumes
+* s64 **free_byte  = receives the free byte counter, or NULL
+*
+* return: start sector, 0 if the hdd has no such volume
+***********************************************************************/
+static s64 vfs_start(ps3_context *ctx, s32 index, s64 **free_byte)
+{
+	s64 *start[VFS_COUNT] = {&ctx->hdd0_start, &ctx->hdd1_start, &ctx->flash_start, &ctx->flash2_start, &ctx->flash3_start};
+	s64 *count[VFS_COUNT] = {NULL, &ctx->hdd1_free, &ctx->flash_free, &ctx->flash2_free, &ctx->flash3_free};
+
+	if(free_byte)
+		*free_byte = count[index];
+
+	return *start[index];
+}
+
+/***********************************************************************
+* Name of a volume the hdd has.
+*
+* ps3_context *ctx = ps3 device information
+* s32 index        = 0 for the first volume
+*
+* return: volume name, NULL after the last
+***********************************************************************/
+const char* vfs_name(ps3_context *ctx, s32 index)
+{
+	s32 i;
+
+	for(i = 0; i < VFS_COUNT; i++)
+		if(vfs_start(ctx, i, NULL) != 0 && index-- == 0)
+			return vfs_volumes[i].name;
+
+	return NULL;
+}
+
+/***********************************************************************
+* Open a volume, its superblock or bootsector is read here. Nothing is
+* printed, ps3hdd_strerror() tells the user why it failed.
+*
+* ps3_context *ctx = ps3 device information
+* const char *name = "dev_hdd0", "dev_hdd1", "dev_flash", ...
+* s32 *err         = receives PS3HDD_ENOVOL, PS3HDD_ENOMEM or PS3HDD_EIO, or NULL
+***********************************************************************/
+vfs_volume* vfs_open(ps3_context *ctx, const char *name, s32 *err)
+{
+	vfs_volume *vol;
+	s32 i, ret;
+
+	for(i = 0; i < VFS_COUNT; i++)
+		if(strcmp(name, vfs_volumes[i].name) == 0 && vfs_start(ctx, i, NULL) != 0)
+			break;
+	if(i == VFS_COUNT) {
+		ret = PS3HDD_ENOVOL;
+		goto fail;
+	}
+
+	if((vol = malloc(sizeof(vfs_volume))) == NULL) {
+		ret = PS3HDD_ENOMEM;
+		goto fail;
+	}
+	memset(vol, 0, sizeof(vfs_volume));
+	vol->name = vfs_volumes[i].name;
+	vol->ops = vfs_volumes[i].ops;
+	vol->ctx = ctx;
+	vol->storage = vfs_start(ctx, i, &vol->free_byte);
+
+	if((ret = vol->ops->mount(vol)) != 0) {
+		free(vol);
+		goto fail;
+	}
+
+	return vol;
+
+fail:
+	if(err)
+		*err = ret;
+	return NULL;
+}
+
+/***********************************************************************
+* Close a volume.
+*
+* vfs_volume *vol = volume
+***********************************************************************/
+void vfs_close(vfs_volume *vol)
+{
+	if(vol == NULL)
+		return;
+
+	vol->ops->umount(vol);
+	free(vol);
+}
+
+/***********************************************************************
+* Load the metadata index of a volume, or read all its inodes if there
+* is no index file. Lookups and listings are then served from memory.
+* Volumes without inodes have nothing to load.
+*
+* vfs_volume *vol  = volume
+* const char *file = index file, or NULL to scan
+* s32 threads      = scan threads
+***********************************************************************/
+s32 vfs_index(vfs_volume *vol, const char *file, s32 threads)
+{
+	if(vol->ops->index == NULL)
+		return 0;
+
+	return vol->ops->index(vol, file, threads);
+}
+
+/***********************************************************************
+* Look up a path on a volume.
+*
+* vfs_volume *vol  = volume
+* const char *path = path from the volume root
+* int follow       = follow a symlink at the end
+* vfs_node *node   = receives the node
+***********************************************************************/
+s32 vfs_lookup(vfs_volume *vol, const char *path, int follow, vfs_node *node)
+{
+	char tmp[MAX_PATH];
+
+	memset(node, 0, sizeof(vfs_node));
+	if(vfs_path(path, tmp))
+		return -1;
+
+	return vol->ops->lookup(vol, tmp, follow, node);
+}
+
+/***********************************************************************
+* Read the entries of a folder, "." and ".." are left out.
+*
+* vfs_volume *vol  = volume
+* vfs_node *dir    = folder, from vfs_lookup
+* vfs_node **nodes = receives the entries, free after use
+*
+* return: entry count, -1 if dir is no folder
+***********************************************************************/
+s32 vfs_readdir(vfs_volume *vol, vfs_node *dir, vfs_node **nodes)
+{
+	if(dir->type != VFS_DIR)
+		return -1;
+
+	return vol->ops->readdir(vol, dir, nodes);
+}
+
+/***********************************************************************
+* Map the data of a file on hdd.
+*
+* vfs_volume *vol  = volume
+* vfs_node *node   = file, from vfs_lookup or vfs_readdir
+* const char *dest = output name
+***********************************************************************/
+extract_file* vfs_extents(vfs_volume *vol, vfs_node *node, const char *dest)
+{
+	return vol->ops->extents(vol, node, dest);
+}
+
+/***********************************************************************
+* Read from a mapped file at an offset, holes read as zeros. All file
+* data read through a volume passes here.
+*
+* vfs_volume *vol  = volume
+* extract_file *f  = file, from vfs_extents
+* u8 *buf          = receives the data
+* s64 offset       = byte offset in the file
+* s64 len          = byte count
+***********************************************************************/
+s64 vfs_pread(vfs_volume *vol, extract_file *f, u8 *buf, s64 offset, s64 len)
+{
+	return extract_file_read(vol->ctx, f, buf, offset, len);
+}
+
+/***********************************************************************
+* Show a folder.
+*
+* vfs_volume *vol  = volume
+* const char *path = folder
+***********************************************************************/
+s32 vfs_list(vfs_volume *vol, const char *path)
+{
+	char tmp[MAX_PATH];
+
+	if(vfs_path(path, tmp))
+		return PS3HDD_EPATH;
+
+	return vol->ops->list(vol, tmp);
+}
+
+/***********************************************************************
+* Show the inode or entry of a file or folder.
+*
+* vfs_volume *vol  = volume
+* const char *path = file or folder
+***********************************************************************/
+s32 vfs_stat(vfs_volume *vol, const char *path)
+{
+	char tmp[MAX_PATH];
+
+	if(vfs_path(path, tmp))
+		return PS3HDD_EPATH;
+
+	return vol->ops->stat(vol, tmp);
+}
+
+/***********************************************************************
+* Copy a file or folder.
+*
+* vfs_volume *vol  = volume
+* const char *path = file or folder
+* const char *dest = output name, or NULL for the program folder
+* extract_job *job = job doing the copy
+***********************************************************************/
+s32 vfs_copy(vfs_volume *vol, const char *path, const char *dest, extract_job *job)
+{
+	char tmp[MAX_PATH], out[MAX_PATH];
+
+	if(vfs_path(path, tmp) || (dest && vfs_path(dest, out)))
+		return PS3HDD_EPATH;
+
+	return vol->ops->copy(vol, tmp, dest ? out : NULL, job);
+}
+
+/***********************************************************************
+* Write a file back to the volume.
+*
+* vfs_volume *vol  = volume
+* const char *path = file
+* BOOL delta       = write changed sectors only
+***********************************************************************/
+s32 vfs_replace(vfs_volume *vol, const char *path, BOOL delta)
+{
+	char tmp[MAX_PATH];
+
+	if(vfs_path(path, tmp))
+		return PS3HDD_EPATH;
+
+	return vol->ops->replace(vol, tmp, delta);
+}
+
+/***********************************************************************
+* Copy a whole volume into a folder, each entry of the root becomes an
+* entry of dest. An entry that fails does not stop the others, the
+* first error is returned.
+*
+* vfs_volume *vol  = volume
+* const char *dest = output folder, made if missing
+* extract_job *job = job doing the copy
+***********************************************************************/
+s32 vfs_copy_volume(vfs_volume *vol, const char *dest, extract_job *job)
+{
+	char src[MAX_PATH], out[MAX_PATH];
+	vfs_node root, *nodes;
+	s32 i, count, err, ret = 0;
+
+	if(vfs_lookup(vol, "/", 1, &root) || (count = vfs_readdir(vol, &root, &nodes)) < 0)
+		return PS3HDD_EIO;
+
+	if(!job->hash_only && !job->tar)
+		mkdir(dest, 0777);
+
+	for(i = 0; i < count && !extract_job_stopped(job); i++) {
+		if(strlen(dest) + strlen(nodes[i].name) + 2 > MAX_PATH) {
+			if(ret == 0)
+				ret = PS3HDD_EPATH;
+			continue;
+		}
+		sprintf(src, "/%s", nodes[i].name);
+		sprintf(out, "%s/%s", dest, nodes[i].name);
+		if((err = vol->ops->copy(vol, src, out, job)) != 0 && ret == 0)
+			ret = err;
+	}
+
+	free(nodes);
+	return ret;
+}
+
+/***********************************************************************
+* Copy whole volumes, each into a subfolder of dest named after it. All
+* volumes go into one job, its workers still copy the files of one
+* volume while the next is walked. With lba_order the data of all of
+* them is read in one pass over the hdd in ascending LBA order. A
+* volume that fails does not stop the others, the first error is
+* returned.
+*
+* ps3_context *ctx       = ps3 device information
+* extract_job *job       = job doing the copy
+* const char *index_file = metadata index of dev_hdd0, or NULL
+* const char *dest       = output folder
+* const char *names      = volumes separated by ",", NULL for all
+***********************************************************************/
+s32 vfs_backup(ps3_context *ctx, extract_job *job, const char *index_file, const char *dest, const char *names)
+{
+	char list[VFS_COUNT][16];
+	char out[MAX_PATH];
+	const char *name;
+	vfs_volume *vol;
+	s32 i, n = 0, err, ret = 0;
+	size_t len;
+
+	if(strlen(dest) + 16 > MAX_PATH)
+		return PS3HDD_EPATH;
+
+	// named volumes in the order given, else all the hdd has
+	if(names) {
+		for(name = names; *name && n < VFS_COUNT; name += len + (name[len] == ',')) {
+			len = strcspn(name, ",");
+			if(len == 0 || len >= sizeof(list[0]))
+				continue;
+			memcpy(list[n], name, len);
+			list[n++][len] = '\0';
+		}
+	}
+	else {
+		for(; (name = vfs_name(ctx, n)) != NULL && n < VFS_COUNT; n++)
+			strcpy(list[n], name);
+	}
+
+	mkdir(dest, 0777);
+
+	for(i = 0; i < n && !extract_job_stopped(job); i++) {
+		if((vol = vfs_open(ctx, list[i], &err)) == NULL) {
+			printf("backup %s -> skipped\n", list[i]);
+			if(ret == 0)
+				ret = err;
+			continue;
+		}
+		if(index_file)
+			vfs_index(vol, index_file, job->threads);
+		sprintf(out, "%s/%s", dest, list[i]);
+		printf("backup %s (%s) -> %s\n", list[i], vol->ops->fs, out);
+		if((err = vfs_copy_volume(vol, out, job)) != 0 && ret == 0)
+			ret = err;
+		vfs_close(vol);
+	}
+
+	return ret;
+}
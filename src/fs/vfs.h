@@ -0,0 +1,79 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#ifndef _VFS_H_
+#define _VFS_H_
+
+#include "../types.h"
+#include "../extract.h"
+#include "ufs.h"
+#include "fat.h"
+
+#define VFS_COUNT     5            // dev_hdd0, dev_hdd1, dev_flash, dev_flash2, dev_flash3
+#define VFS_NAME_MAX  256          // longest entry name with the 0
+
+// node types, same values as the PS3HDD_ types of ps3hdd.h
+#define VFS_FILE      0
+#define VFS_DIR       1
+#define VFS_LINK      2
+#define VFS_OTHER     3
+
+typedef struct _vfs_volume_ vfs_volume;
+
+typedef struct _vfs_node_ {
+	char name[VFS_NAME_MAX];  // entry name, set by readdir only
+	s32 type;                 // VFS_FILE, VFS_DIR, ...
+	u32 mode;                 // permission bits
+	u64 size;                 // byte count
+	u64 id;                   // inode, or start cluster on FAT
+	time_t atime;             // last access time
+	time_t mtime;             // last modified time
+	time_t ctime;             // last change time, creation time on FAT
+	struct ufs2_dinode di;    // inode on UFS2, big endian
+	struct sfn_e sfn;         // entry on FAT, zero for the root
+} vfs_node;
+
+typedef struct _vfs_ops_ {
+	const char *fs;                                                                  // filesystem name
+	s32 (*mount)(vfs_volume *vol);                                                   // read superblock or bootsector, 0 or PS3HDD_E...
+	void (*umount)(vfs_volume *vol);                                                 // free what mount read
+	s32 (*index)(vfs_volume *vol, const char *file, s32 threads);                    // load or scan all inodes, NULL if none
+	s32 (*lookup)(vfs_volume *vol, char *path, int follow, vfs_node *node);          // find a path
+	s32 (*readdir)(vfs_volume *vol, vfs_node *dir, vfs_node **nodes);                // entries of a folder
+	extract_file* (*extents)(vfs_volume *vol, vfs_node *node, const char *dest);     // data of a file on hdd
+	s32 (*list)(vfs_volume *vol, char *path);                                        // show a folder
+	s32 (*stat)(vfs_volume *vol, char *path);                                        // show an entry
+	s32 (*copy)(vfs_volume *vol, char *path, char *dest, extract_job *job);          // copy a file or folder
+	s32 (*replace)(vfs_volume *vol, char *path, BOOL delta);                         // write a file back
+} vfs_ops;
+
+struct _vfs_volume_ {
+	const char *name;         // "dev_hdd0", "dev_hdd1", ...
+	const vfs_ops *ops;       // filesystem of the volume
+	ps3_context *ctx;         // ps3 device information
+	u64 storage;              // partition start sector
+	s64 *free_byte;           // cached free bytes in ctx, 0 until counted
+	struct fs *ufs2;          // UFS2 superblock
+	ufs_inventory *inv;       // UFS2 index, or NULL
+	struct fat_bs *fat_fs;    // FAT12/16 bootsector
+	struct fat32_bs *fat32;   // FAT32 bootsector
+};
+
+const char* vfs_name(ps3_context *ctx, s32 index);
+vfs_volume* vfs_open(ps3_context *ctx, const char *name, s32 *err);
+void vfs_close(vfs_volume *vol);
+s32 vfs_index(vfs_volume *vol, const char *file, s32 threads);
+s32 vfs_lookup(vfs_volume *vol, const char *path, int follow, vfs_node *node);
+s32 vfs_readdir(vfs_volume *vol, vfs_node *dir, vfs_node **nodes);
+extract_file* vfs_extents(vfs_volume *vol, vfs_node *node, const char *dest);
+s64 vfs_pread(vfs_volume *vol, extract_file *f, u8 *buf, s64 offset, s64 len);
+s32 vfs_list(vfs_volume *vol, const char *path);
+s32 vfs_stat(vfs_volume *vol, const char *path);
+s32 vfs_copy(vfs_volume *vol, const char *path, const char *dest, extract_job *job);
+s32 vfs_replace(vfs_volume *vol, const char *path, BOOL delta);
+s32 vfs_copy_volume(vfs_volume *vol, const char *dest, extract_job *job);
+s32 vfs_backup(ps3_context *ctx, extract_job *job, const char *index_file, const char *dest, const char *names);
+
+#endif  // _VFS_H_
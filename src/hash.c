@@ -0,0 +1,265 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#include <string.h>
+#include <immintrin.h>
+
+#include "hash.h"
+
+#define ROR32(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const u32 sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static u32 crc32c_table[256];
+static volatile BOOL crc32c_ready = FALSE;
+
+
+
+/***********************************************************************
+* SHA-256 compression of whole 64 byte blocks, portable version.
+*
+* u32 *state     = intermediate hash
+* const u8 *data = blocks
+* u64 blocks     = block count
+***********************************************************************/
+static void sha256_blocks_c(u32 *state, const u8 *data, u64 blocks)
+{
+	s32 i;
+	u32 w[64], a, b, c, d, e, f, g, h, t1, t2;
+
+	for(; blocks; blocks--, data += 64) {
+		for(i = 0; i < 16; i++)
+			w[i] = (data[i * 4] << 24) | (data[i * 4 + 1] << 16) | (data[i * 4 + 2] << 8) | data[i * 4 + 3];
+		for(; i < 64; i++)
+			w[i] = w[i - 16] + (ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+			       w[i - 7]  + (ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19)  ^ (w[i - 2] >> 10));
+
+		a = state[0]; b = state[1]; c = state[2]; d = state[3];
+		e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+		for(i = 0; i < 64; i++) {
+			t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+			t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+	}
+}
+
+/***********************************************************************
+* SHA-256 compression of whole 64 byte blocks with the SHA extensions,
+* four rounds per pair of sha256rnds2.
+*
+* u32 *state     = intermediate hash
+* const u8 *data = blocks
+* u64 blocks     = block count
+***********************************************************************/
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_ni(u32 *state, const u8 *data, u64 blocks)
+{
+	s32 i;
+	__m128i st0, st1, tmp, msg, abef, cdgh, w[4];
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+	// state is kept as ABEF and CDGH
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+	st1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+	st0 = _mm_alignr_epi8(tmp, st1, 8);
+	st1 = _mm_blend_epi16(st1, tmp, 0xF0);
+
+	for(; blocks; blocks--, data += 64) {
+		abef = st0;
+		cdgh = st1;
+
+		for(i = 0; i < 16; i++) {
+			if(i < 4)
+				w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i * 16)), mask);
+			else
+				w[i & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]),
+				           _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4)), w[(i + 3) & 3]);
+
+			msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&sha256_k[i * 4]));
+			st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+			st0 = _mm_sha256rnds2_epu32(st0, st1, _mm_shuffle_epi32(msg, 0x0E));
+		}
+
+		st0 = _mm_add_epi32(st0, abef);
+		st1 = _mm_add_epi32(st1, cdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(st0, 0x1B);
+	st1 = _mm_shuffle_epi32(st1, 0xB1);
+	_mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, st1, 0xF0));
+	_mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(st1, tmp, 8));
+}
+
+/***********************************************************************
+* SHA-256 compression, with the SHA extensions if the cpu has them.
+*
+* u32 *state     = intermediate hash
+* const u8 *data = blocks
+* u64 blocks     = block count
+***********************************************************************/
+static void sha256_blocks(u32 *state, const u8 *data, u64 blocks)
+{
+	if(__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1"))
+		sha256_blocks_ni(state, data, blocks);
+	else
+		sha256_blocks_c(state, data, blocks);
+}
+
+/***********************************************************************
+* Start a SHA-256 hash.
+*
+* sha256_context *c = context
+***********************************************************************/
+void sha256_init(sha256_context *c)
+{
+	c->state[0] = 0x6a09e667; c->state[1] = 0xbb67ae85;
+	c->state[2] = 0x3c6ef372; c->state[3] = 0xa54ff53a;
+	c->state[4] = 0x510e527f; c->state[5] = 0x9b05688c;
+	c->state[6] = 0x1f83d9ab; c->state[7] = 0x5be0cd19;
+	c->total = 0;
+}
+
+/***********************************************************************
+* Add data to a SHA-256 hash.
+*
+* sha256_context *c = context
+* const u8 *data    = data
+* u64 len           = byte count
+***********************************************************************/
+void sha256_update(sha256_context *c, const u8 *data, u64 len)
+{
+	u64 used = c->total % 64, n;
+
+	c->total += len;
+
+	if(used) {
+		n = (len < 64 - used) ? len : 64 - used;
+		memcpy(c->buf + used, data, n);
+		data += n;
+		len  -= n;
+		if(used + n < 64)
+			return;
+		sha256_blocks(c->state, c->buf, 1);
+	}
+
+	if(len >= 64) {
+		sha256_blocks(c->state, data, len / 64);
+		data += len & ~63ULL;
+		len  &= 63;
+	}
+
+	if(len)
+		memcpy(c->buf, data, len);
+}
+
+/***********************************************************************
+* Finish a SHA-256 hash.
+*
+* sha256_context *c = context
+* u8 *digest        = receives SHA256_SIZE bytes
+***********************************************************************/
+void sha256_final(sha256_context *c, u8 *digest)
+{
+	s32 i;
+	u64 bits = c->total * 8;
+	u64 used = c->total % 64;
+
+	c->buf[used++] = 0x80;
+	if(used > 56) {
+		memset(c->buf + used, 0, 64 - used);
+		sha256_blocks(c->state, c->buf, 1);
+		used = 0;
+	}
+	memset(c->buf + used, 0, 56 - used);
+	for(i = 0; i < 8; i++)
+		c->buf[56 + i] = (u8)(bits >> (56 - i * 8));
+	sha256_blocks(c->state, c->buf, 1);
+
+	for(i = 0; i < 8; i++) {
+		digest[i * 4]     = (u8)(c->state[i] >> 24);
+		digest[i * 4 + 1] = (u8)(c->state[i] >> 16);
+		digest[i * 4 + 2] = (u8)(c->state[i] >> 8);
+		digest[i * 4 + 3] = (u8)(c->state[i]);
+	}
+}
+
+/***********************************************************************
+* CRC32C with the SSE4.2 crc32 instruction, 8 bytes per step.
+*
+* u32 crc        = crc so far, inverted
+* const u8 *data = data
+* u64 len        = byte count
+***********************************************************************/
+__attribute__((target("sse4.2")))
+static u32 crc32c_hw(u32 crc, const u8 *data, u64 len)
+{
+#if defined(__x86_64__)
+	u64 crc64 = crc, v;
+
+	for(; len >= 8; len -= 8, data += 8) {
+		memcpy(&v, data, 8);
+		crc64 = _mm_crc32_u64(crc64, v);
+	}
+	crc = (u32)crc64;
+#else
+	u32 v;
+
+	for(; len >= 4; len -= 4, data += 4) {
+		memcpy(&v, data, 4);
+		crc = _mm_crc32_u32(crc, v);
+	}
+#endif
+	for(; len; len--)
+		crc = _mm_crc32_u8(crc, *data++);
+
+	return crc;
+}
+
+/***********************************************************************
+* Add data to a CRC32C (Castagnoli), start with 0.
+*
+* u32 crc        = crc so far
+* const u8 *data = data
+* u64 len        = byte count
+***********************************************************************/
+u32 crc32c_update(u32 crc, const u8 *data, u64 len)
+{
+	u32 i, j, r;
+
+	crc = ~crc;
+
+	if(__builtin_cpu_supports("sse4.2"))
+		return ~crc32c_hw(crc, data, len);
+
+	// every thread builds the same table, a race does no harm
+	if(!crc32c_ready) {
+		for(i = 0; i < 256; i++) {
+			for(r = i, j = 0; j < 8; j++)
+				r = (r >> 1) ^ (0x82F63B78 & (0 - (r & 1)));
+			crc32c_table[i] = r;
+		}
+		crc32c_ready = TRUE;
+	}
+
+	for(; len; len--)
+		crc = crc32c_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
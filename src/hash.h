@@ -0,0 +1,24 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include "types.h"
+
+#define SHA256_SIZE 32
+
+typedef struct _sha256_context_ {
+	u32 state[8];           // intermediate hash
+	u64 total;              // bytes hashed
+	u8 buf[64];             // partial block
+} sha256_context;
+
+void sha256_init(sha256_context *c);
+void sha256_update(sha256_context *c, const u8 *data, u64 len);
+void sha256_final(sha256_context *c, u8 *digest);
+u32 crc32c_update(u32 crc, const u8 *data, u64 len);
+
+#endif  // _HASH_H_
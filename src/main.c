@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <io.h>
 
 #include <time.h>
 
@@ -14,47 +15,71 @@
 #include "kgen.h"
 #include "device.h"
 #include "util.h"
+#include "extract.h"
+#include "shell.h"
+#include "daemon.h"
+#include "fleet.h"
+#include "ps3hdd_int.h"
 #include "fs/ufs.h"
 #include "fs/fat.h"
+#include "fs/index.h"
+#include "fs/vfs.h"
 
 
 
 
 
 /***********************************************************************
-* Read sector/s from HDD.
+* Read sector/s from HDD. With a journal the sectors read are noted, a
+* read stopped by Ctrl+C goes on from there with -resume.
 * 
 * ps3_context *ctx = ps3 device information
 * const char *name = output file name
 * s64 start        = start sector on hdd
 * s64 count        = count of sectors to read
+* extract_job *job = job holding the journal
 ***********************************************************************/
-void read_sector(ps3_context *ctx, const char *name, s64 start, s64 count)
+void read_sector(ps3_context *ctx, const char *name, s64 start, s64 count, extract_job *job)
 {
-	s64 i;
+	s64 n, done = 0;
+	BOOL complete = FALSE;
 	u8 *buf = NULL;
-	FILE *fd = fopen(name, "wb");
-	s64 n_64k = count / 128;
-	s64 n_sec = count % 128;
+	FILE *fd = NULL;
 	
-	if(n_64k) {
-		buf = malloc(128 * SECTOR_SIZE);
-		for(i = 0; i < n_64k; i++) {
-		  block_read(ctx, buf, 128, start);
-		  fwrite(buf, sizeof(u8), (128 * SECTOR_SIZE), fd);
-		  start += 128;
+	if(job->journal)
+		done = extract_journal_resume(job, name, &complete) / SECTOR_SIZE;
+	if(complete)
+		return;
+	
+	if(done && (fd = fopen(name, "r+b")) != NULL)
+		_fseeki64(fd, done * SECTOR_SIZE, SEEK_SET);
+	else {
+		done = 0;
+		fd = fopen(name, "wb");
+	}
+	if(fd == NULL) {
+		printf("can't create file! \"%s\"\n", name);
+		return;
+	}
+	
+	buf = malloc(128 * SECTOR_SIZE);
+	
+	while(done < count && !extract_interrupted()) {
+		n = (count - done < 128) ? count - done : 128;
+		block_read(ctx, buf, n, start + done);
+		fwrite(buf, sizeof(u8), (n * SECTOR_SIZE), fd);
+		done += n;
+		
+		if(job->journal && done % (EXTRACT_JOURNAL_STEP / SECTOR_SIZE) == 0) {
+			fflush(fd);
+			extract_journal_mark(job, name, done * SECTOR_SIZE, FALSE);
 		}
-		free(buf);
-  }
-  
-  if(n_sec) {
-		buf = malloc(n_sec * SECTOR_SIZE);
-		block_read(ctx, buf, n_sec, start);
-		fwrite(buf, sizeof(u8), (n_sec * SECTOR_SIZE), fd);
-		free(buf);
 	}
 	
 	fclose(fd);
+	free(buf);
+	if(job->journal)
+		extract_journal_mark(job, name, done * SECTOR_SIZE, done == count);
 }
 
 /***********************************************************************
@@ -111,6 +136,117 @@ void write_sector(ps3_context *ctx, const char *name, s64 start, s64 count)
 
 
 
+/***********************************************************************
+* Take stdout for a stream of data. The stream gets its own handle of
+* stdout, stdout itself then goes to stderr, so all messages printed
+* from there on stay out of the data.
+* 
+* return: stream of the old stdout, stdout if it can't be moved
+***********************************************************************/
+static FILE* stdout_stream(void)
+{
+	FILE *out;
+	
+	fflush(stdout);
+	if((out = _fdopen(_dup(_fileno(stdout)), "w")) == NULL)
+		return stdout;
+	_dup2(_fileno(stderr), _fileno(stdout));
+	
+	return out;
+}
+
+/***********************************************************************
+* Strip options from the command line. The remaining arguments keep
+* their order, so the commands can still be told apart by argc.
+* 
+* s32 *argc        = argument count, updated
+* char *argv[]     = arguments, compacted
+* extract_job *job = extraction job to configure
+* char **index     = receives the index file name
+* BOOL *delta      = set for delta replace
+* char **output    = receives the tar output file name
+* char **script    = receives the command script name
+* BOOL *preload    = set to read the VFLASH volumes into memory
+* char **keyring   = receives the keyring file name
+* FILE **stream    = receives the stream of a tar or manifest on stdout
+***********************************************************************/
+static void parse_options(s32 *argc, char *argv[], extract_job *job, char **index, BOOL *delta, char **output, char **script, BOOL *preload, char **keyring, FILE **stream)
+{
+	s32 i, n = 1;
+	path_filter *pf = filter_new();
+	char *state = NULL;
+	BOOL prune = FALSE;
+	char *journal = NULL;
+	BOOL resume = FALSE;
+	
+	for(i = 1; i < *argc; i++) {
+		if(strcmp(argv[i], "-j") == 0 && i + 1 < *argc)                   // worker threads
+			job->threads = atoi(argv[++i]);
+		else if(strncmp(argv[i], "-j", 2) == 0 && argv[i][2] >= '0' && argv[i][2] <= '9')
+			job->threads = atoi(argv[i] + 2);
+		else if(strcmp(argv[i], "-lba") == 0)                              // read in LBA order
+			job->lba_order = TRUE;
+		else if(strcmp(argv[i], "-idx") == 0 && i + 1 < *argc)            // metadata index of dev_hdd0
+			*index = argv[++i];
+		else if(strcmp(argv[i], "-delta") == 0)                            // replace changed sectors only
+			*delta = TRUE;
+		else if(strcmp(argv[i], "-hash") == 0 && i + 1 < *argc) {          // SHA-256 manifest of copied files
+			if((job->manifest = fopen(argv[++i], "w")) == NULL)
+				printf("can't create file! \"%s\"\n", argv[i]);
+		}
+		else if(strcmp(argv[i], "-crc") == 0)                              // add CRC32C to the manifest
+			job->crc = TRUE;
+		else if(strcmp(argv[i], "-dedup") == 0)                            // hardlink identical files
+			job->dedup = TRUE;
+		else if(strcmp(argv[i], "-o") == 0 && i + 1 < *argc)              // tar output file
+			*output = argv[++i];
+		else if(strcmp(argv[i], "-include") == 0 && i + 1 < *argc)        // copy matching files only
+			filter_include(pf, argv[++i]);
+		else if(strcmp(argv[i], "-exclude") == 0 && i + 1 < *argc)        // leave out matching files
+			filter_exclude(pf, argv[++i]);
+		else if(strcmp(argv[i], "-minsize") == 0 && i + 1 < *argc)        // smallest file size
+			pf->min_size = filter_parse_size(argv[++i]);
+		else if(strcmp(argv[i], "-maxsize") == 0 && i + 1 < *argc)        // largest file size
+			pf->max_size = filter_parse_size(argv[++i]);
+		else if(strcmp(argv[i], "-newer") == 0 && i + 1 < *argc)          // modified after a date
+			pf->newer = filter_parse_date(argv[++i]);
+		else if(strcmp(argv[i], "-incr") == 0 && i + 1 < *argc)           // copy changed files only
+			state = argv[++i];
+		else if(strcmp(argv[i], "-prune") == 0)                            // remove files gone since then
+			prune = TRUE;
+		else if(strcmp(argv[i], "-journal") == 0 && i + 1 < *argc)        // checkpoints of a long copy
+			journal = argv[++i];
+		else if(strcmp(argv[i], "-resume") == 0)                           // go on after a stop
+			resume = TRUE;
+		else if(strcmp(argv[i], "-f") == 0 && i + 1 < *argc)              // session commands from a file
+			*script = argv[++i];
+		else if(strcmp(argv[i], "-ram") == 0)                              // VFLASH volumes in memory
+			*preload = TRUE;
+		else if(strcmp(argv[i], "-keys") == 0 && i + 1 < *argc)           // eid root keys of a fleet run
+			*keyring = argv[++i];
+		else
+			argv[n++] = argv[i];
+	}
+	
+	*argc = n;
+	argv[n] = NULL;
+	
+	// an empty filter would only keep the folders from being made during the walk
+	if(pf->n_include || pf->n_exclude || pf->min_size >= 0 || pf->max_size >= 0 || pf->newer)
+		job->filter = pf;
+	else
+		filter_free(pf);
+	
+	// a tar or manifest on stdout keeps it to itself, before anything else is printed
+	if(*argc == 5 && ((strcmp(argv[3], "tar") == 0 && *output == NULL) || (strcmp(argv[3], "hash") == 0 && job->manifest == NULL)))
+		*stream = stdout_stream();
+	
+	if(state)
+		extract_state_load(job, state, prune);
+	if(journal)
+		extract_journal_open(job, journal, resume);
+}
+
 /***********************************************************************
 * main
 ***********************************************************************/
@@ -118,17 +254,33 @@ s32 main(s32 argc, char *argv[])
 {
 	s32 ret = -1;
 	u8 *eid_root_key = {0};							// eid root key/iv
-	ps3_context *ctx = NULL;            // ps3 hdd context
-	struct fs *ufs2;										// superblock(UFS2)
-	struct fat_bs *fat_fs;              // bootsector(FAT12/16)
-	struct fat32_bs *fat32;           	// bootsector(FAT32)
-	ufs_inop root_ino = ROOTINO;
-	ufs_inop ino;
+	ps3hdd_disk *disk = NULL;           // ps3 hdd or image, opened by the library
+	ps3_context *ctx = NULL;            // ps3 hdd context of disk
+	s32 i, err;
+	ps3hdd_volume *volume;              // volume of the command
+	vfs_volume *vol;                    // its filesystem
+	extract_job job;                    // copy workers
+	char *index_file = NULL;            // metadata index of dev_hdd0
+	BOOL delta = FALSE;                 // replace changed sectors only
+	char *output = NULL;                // tar output file, stdout if none
+	char *script = NULL;                // session commands, "-" for stdin
+	BOOL preload = FALSE;               // read VFLASH volumes into memory
+	char *keyring = NULL;               // eid root keys of a fleet run
+	char *names;                        // volumes of a fleet extract
+	FILE *stream = stdout;              // tar or manifest on stdout, messages go to stderr then
+	
 	
+	// the job gets the context once the disk is open
+	extract_job_init(&job, NULL);
+	parse_options(&argc, argv, &job, &index_file, &delta, &output, &script, &preload, &keyring, &stream);
 	
-	// init ps3 context
-	ctx = malloc(sizeof(ps3_context));
-	memset(ctx, 0, sizeof(ps3_context));
+	// all ps3 hdds at once, each with the key of the keyring that fits
+	if(argc >= 4 && strcmp(argv[1], "fleet") == 0) {
+		names = (argc >= 5 && strncmp(argv[4], "dev_", 4) == 0) ? argv[4] : NULL;
+		i = names ? 5 : 4;
+		ret = fleet_run(&job, keyring, argv[2], argv[3], names, argv + i, argc - i);
+		goto end;
+	}
 	
 	// load rootkey from file
 	if((eid_root_key = _read_buffer((s8*)"eid_root_key", NULL)) == NULL) {		
@@ -136,55 +288,72 @@ s32 main(s32 argc, char *argv[])
 		goto end;
 	}
 	
-	// generate ata/encdec keys
-	generate_ata_keys(eid_root_key, eid_root_key + 0x20, ctx->ata_k1, ctx->ata_k2);		
-  generate_encdec_keys(eid_root_key, eid_root_key + 0x20, ctx->encdec_k1, ctx->encdec_k2);
-	free(eid_root_key);
+	if(argc <= 1 || (strcmp(argv[1], "hdd") != 0 && strcmp(argv[1], "file") != 0)) {
+		free(eid_root_key);
+		goto end;
+	}
 	
-	if(argc <= 1) {
+	// the library finds the hdd or opens the image, makes the keys and reads the partitions
+	err = ps3hdd_open(strcmp(argv[1], "file") == 0 ? "backup.bin" : NULL, eid_root_key, NULL, &disk);
+	free(eid_root_key);
+	if(err != PS3HDD_OK) {
+		if(err == PS3HDD_ENODEV && strcmp(argv[1], "file") == 0)
+			printf("file \"backup.bin\" not found!\n");
+		else
+			printf("%s!\n", ps3hdd_strerror(err));
 		goto end;
 	}
+	ctx = ps3hdd_context(disk);
+	job.ctx = ctx;
 	
-	// get hdd handle and ps3 type
-	if(strcmp(argv[1], "hdd") == 0){
-    if((ret = get_device_handle(ctx, 1)) == -1) {
-		  printf("no PS3 hdd found or eid root key wrong!\n");
-		  goto end;
-	  }
-  }
-  
-  if(strcmp(argv[1], "file") == 0){
-    if((ret = get_device_handle(ctx, 0)) == -1) {
-      printf("file \"backup.bin\" not found!\n");
-		  goto end;
-	  }
-  }
+	// decrypt the small VFLASH volumes once, all later reads come from memory
+	if(preload)
+		device_preload_flash(ctx, job.threads);
 	
-	// get all partitions
-	get_partitions(ctx);
+	// the LBA pass reads on one thread, its big reads are decrypted by workers
+	if(job.lba_order && job.threads > 1)
+		ctx->crypto_pool = pool_create(job.threads);
+	
+	// session, device and volumes stay open for all commands
+	if(script || (argc == 3 && strcmp(argv[2], "shell") == 0)) {
+		FILE *in = (script == NULL || strcmp(script, "-") == 0) ? stdin : fopen(script, "r");
+		if(in == NULL) {
+			printf("file \"%s\" not found!\n", script);
+			goto end;
+		}
+		shell_run(disk, &job, index_file, in, script == NULL);
+		if(in != stdin) fclose(in);
+		goto end;
+	}
 	
 	// list available volumes 
 	if(argc == 2) {
-	  printf("\navailable volumes are...\n\n");
-	  if(ctx->hdd0_start != 0)
-	    printf(" dev_hdd0\n");
-    if(ctx->hdd1_start != 0)
-      printf(" dev_hdd1\n");
-    if(ctx->flash_start != 0)
-      printf(" dev_flash\n");
-    if(ctx->flash2_start != 0)
-      printf(" dev_flash2\n");
-    if(ctx->flash3_start != 0)
-      printf(" dev_flash3\n");
-    else printf("no volumes available.\n");
+		printf("\navailable volumes are...\n\n");
+		for(i = 0; ps3hdd_volume_name(disk, i); i++)
+			printf(" %s\n", ps3hdd_volume_name(disk, i));
+		if(i == 0)
+			printf("no volumes available.\n");
 	}
 	
 	if(argc == 3) {
 		goto end;
 	}
 	
-	// DEBUG: print sector by hdd byte offset
+	// Ctrl+C from here on stops the command, also during the walk over folders
+	extract_trap_interrupt();
+	
+	// all volumes, or the ones named, into one folder
+	if((argc == 4 || argc == 5) && strcmp(argv[2], "backup") == 0) {
+		if((err = vfs_backup(ctx, &job, index_file, argv[3], argc == 5 ? argv[4] : NULL)) != 0)
+			printf("backup incomplete, %s!\n", ps3hdd_strerror(err));
+		goto end;
+	}
+	
 	if(argc == 4) {
+		// serve requests on a socket until ended
+		if(strcmp(argv[2], "daemon") == 0)
+			daemon_run(ctx, &job, index_file, argv[3]);
+		// DEBUG: print sector by hdd byte offset
 		if(strcmp(argv[2], "print") == 0) {
 			u8 *buf = malloc(SECTOR_SIZE);
 			s64 sec_num = strtoll(argv[3], NULL, 16);
@@ -196,132 +365,59 @@ s32 main(s32 argc, char *argv[])
 	}
 	
 	if(argc == 5) {
-		if(strncmp(argv[2], "dev_", 4) == 0) {
-		  if(strcmp(argv[2], "dev_hdd0") == 0) {
-			  ufs2 = ufs_init(ctx);																								       // init gameOS...
-			  if(ufs2 == NULL) {
-			  	printf("can't open dev_hdd0!\n");
-			  }
-			  if(strcmp(argv[3], "dir") == 0 || strcmp(argv[3], "ls") == 0) {    		     // show dir...
-			  	ufs_print_dir_list(ctx, ufs2, (u8*)argv[4], (u8*)argv[2]);    
-			  	free(ufs2);
-		  	}
-		  	else if(strcmp(argv[3], "copy") == 0 || strcmp(argv[3], "cp") == 0) {	     // copy file/dir...
-		  		ino = ufs_lookup_path(ctx, ufs2, (u8*)argv[4], 0, ROOTINO);
-		  		ufs_copy_data(ctx, ufs2, root_ino, ino, argv[4], 0);
-		  		free(ufs2);
-		  	}
-		  	else if(strcmp(argv[3], "replace") == 0) {                                 // replace file
-			    ino = ufs_lookup_path(ctx, ufs2, (u8*)argv[4], 0, ROOTINO);
-			    ufs_replace_data(ctx, ufs2, root_ino, ino, argv[4]);
-			    free(ufs2);
-		    }
-			  else{
-			  	free(ufs2);
-		  	}
-		  }
-			// if partition dev_hdd1(FAT32)...
-		  else if(strcmp(argv[2], "dev_hdd1") == 0) {
-		  	fat32 = init_fat32(ctx, ctx->hdd1_start);
-		  	if(fat32 == NULL) {
-			  	printf("can't open dev_hdd1!\n");
-		  	}
-		  	ctx->hdd1_free = fat_how_many_free_bytes(ctx, ctx->hdd1_start, NULL, fat32);
-		  	if(strcmp(argv[3], "dir") == 0 || strcmp(argv[3], "ls") == 0) {				  			// show dir...
-				  fat_print_dir_list(ctx, ctx->hdd1_start, NULL, fat32, (u8*)argv[4], (u8*)argv[2], ctx->hdd1_free);
-				  free(fat32);
-			  }
-			  else if(strcmp(argv[3], "copy") == 0 || strcmp(argv[3], "cp") == 0) {	  			// copy file/dir...
-			  	fat_copy_data(ctx, ctx->hdd1_start, NULL, fat32, argv[4], 0);
-			  	free(fat32);
-			  }
-			  else if(strcmp(argv[3], "replace") == 0) {                                 // replace file
-			    fat_replace_data(ctx, ctx->hdd1_start, NULL, fat32, argv[4]);
-			    free(fat32);
-		    }
-			  else {
-		  		free(fat32);
-		  	}
-		  }
-			// if partition dev_flash(FAT16)...
-		  else if(strcmp(argv[2], "dev_flash") == 0) {	
-		  	fat_fs = init_fat_old(ctx, ctx->flash_start);
-		  	if(fat_fs == NULL) {
-		  		printf("can't open dev_flash!\n");
-			  }	
-			  ctx->flash_free = fat_how_many_free_bytes(ctx, ctx->flash_start, fat_fs, NULL);
-			  if(strcmp(argv[3], "dir") == 0 || strcmp(argv[3], "ls") == 0) {
-			  	fat_print_dir_list(ctx, ctx->flash_start, fat_fs, NULL, (u8*)argv[4], (u8*)argv[2], ctx->flash_free);
-		  		free(fat_fs);	
-			  }
-			  else if(strcmp(argv[3], "copy") == 0 || strcmp(argv[3], "cp") == 0) {
-			  	fat_copy_data(ctx, ctx->flash_start, fat_fs, 0, argv[4], 0);
-			  	free(fat_fs);
-			  }
-			  else if(strcmp(argv[3], "replace") == 0) {                                 // replace file
-			    fat_replace_data(ctx, ctx->flash_start, fat_fs, NULL, argv[4]);
-			    free(fat_fs);
-		    }
-			  else {
-			  	free(fat_fs);
-			  }
-		  }
-			// if partition dev_flash2(FAT16)...
-		  else if(strcmp(argv[2], "dev_flash2") == 0) {
-		  	fat_fs = init_fat_old(ctx, ctx->flash2_start);
-		  	if(fat_fs == NULL) {
-		  		printf("can't open dev_flash2!\n");
-		  	}
-		  	ctx->flash2_free = fat_how_many_free_bytes(ctx, ctx->flash2_start, fat_fs, NULL);
-		  	if(strcmp(argv[3], "dir") == 0 || strcmp(argv[3], "ls") == 0) {
-		  		fat_print_dir_list(ctx, ctx->flash2_start, fat_fs, NULL, (u8*)argv[4], (u8*)argv[2], ctx->flash2_free);
-		  		free(fat_fs);
-		  	}
-			  else if(strcmp(argv[3], "copy") == 0 || strcmp(argv[3], "cp") == 0) {
-			  	fat_copy_data(ctx, ctx->flash2_start, fat_fs, 0, argv[4], 0);
-		    	free(fat_fs);
-		  	}
-		  	else if(strcmp(argv[3], "replace") == 0) {                                 // replace file
-			    fat_replace_data(ctx, ctx->flash2_start, fat_fs, NULL, argv[4]);
-			    free(fat_fs);
-		    }
-		  	else {
-		  		free(fat_fs);
-		  	}
-		  }
-			// if partition dev_flash3(FAT12)...
-		  else if(strcmp(argv[2], "dev_flash3") == 0) {
-	    	fat_fs = init_fat_old(ctx, ctx->flash3_start);
-		  	if(fat_fs == NULL) {
-		  		printf("can't open dev_flash3!\n");
-		  	}
-		  	ctx->flash3_free = fat_how_many_free_bytes(ctx, ctx->flash3_start, fat_fs, NULL);
-			  if(strcmp(argv[3], "dir") == 0 || strcmp(argv[3], "ls") == 0) {
-			  	fat_print_dir_list(ctx, ctx->flash3_start, fat_fs, NULL, (u8*)argv[4], (u8*)argv[2], ctx->flash3_free);
-			  	free(fat_fs);	
-			  }
-		  	else if(strcmp(argv[3], "copy") == 0 || strcmp(argv[3], "cp") == 0) {
-			  	fat_copy_data(ctx, ctx->flash3_start, fat_fs, 0, argv[4], 0);
-			  	free(fat_fs);	
-			  }
-			  else if(strcmp(argv[3], "replace") == 0) {                                 // replace file
-			    fat_replace_data(ctx, ctx->flash3_start, fat_fs, NULL, argv[4]);
-			    free(fat_fs);
-		    }
-			  else {
-			  	free(fat_fs);	
-			  }
-		  }
-		  else {
-		  	printf("no such volume!\n");
-		  }
+		// hash is a copy without output files
+		if(strcmp(argv[3], "hash") == 0) {
+			job.hash_only = TRUE;
+			if(job.manifest == NULL)
+				job.manifest = stream;
+		}
+		// tar is a copy into one stream
+		if(strcmp(argv[3], "tar") == 0) {
+			FILE *out = output ? fopen(output, "wb") : stream;
+			if(out == NULL) {
+				printf("can't create file! \"%s\"\n", output);
+				goto end;
+			}
+			extract_tar_open(&job, out);
+		}
+		if(strncmp(argv[2], "dev_", 4) == 0 && (err = ps3hdd_volume_open(disk, argv[2], &volume)) != PS3HDD_OK)
+			printf("can't open %s, %s!\n", argv[2], ps3hdd_strerror(err));
+		else if(strncmp(argv[2], "dev_", 4) == 0) {
+			vol = ps3hdd_vfs(volume);
+			err = 0;
+			if(index_file)                                                               // metadata index
+				vfs_index(vol, index_file, job.threads);
+			if(strcmp(argv[3], "dir") == 0 || strcmp(argv[3], "ls") == 0)                // show dir...
+				err = vfs_list(vol, argv[4]);
+			else if(strcmp(argv[3], "copy") == 0 || strcmp(argv[3], "cp") == 0 || job.hash_only || job.tar)	// copy file/dir...
+				err = vfs_copy(vol, argv[4], NULL, &job);
+			else if(strcmp(argv[3], "replace") == 0)                                    // replace file
+				err = vfs_replace(vol, argv[4], delta);
+			else if(strcmp(argv[3], "inventory") == 0) {                                // list all inodes
+				if(vol->ops->index == NULL)
+					printf("%s has no inodes!\n", argv[2]);
+				else if(vfs_index(vol, NULL, job.threads) == 0) {
+					BOOL csv = strlen(argv[4]) > 4 && Stricmp(argv[4] + strlen(argv[4]) - 4, ".csv") == 0;
+					FILE *out = strcmp(argv[4], "-") == 0 ? stdout : fopen(argv[4], "w");
+					if(vol->inv->n_bad)
+						printf("%u cylinder groups with a bad magic, their inodes are missing!\n", vol->inv->n_bad);
+					if(out) {
+						ufs_print_inventory(ctx, vol->ufs2, vol->inv, out, csv);
+						if(out != stdout) fclose(out);
+					}
+					else printf("can't create file!\n");
+				}
+			}
+			if(err)
+				printf("%s!\n", ps3hdd_strerror(err));
+			ps3hdd_volume_close(volume);
 		}
 	}
 	
 	// read/write sector/s from/to HDD
 	if(argc == 6) {
 		if(strcmp(argv[2], "read_block") == 0) {
-			read_sector(ctx, argv[3], strtoll(argv[4], NULL, 16), strtoll(argv[5], NULL, 16));
+			read_sector(ctx, argv[3], strtoll(argv[4], NULL, 16), strtoll(argv[5], NULL, 16), &job);
 		}
 		if(strcmp(argv[2], "write_block") == 0) {
 			write_sector(ctx, argv[3], strtoll(argv[4], NULL, 16), strtoll(argv[5], NULL, 16));
@@ -329,7 +425,13 @@ s32 main(s32 argc, char *argv[])
 	}
 	
 end:
-  if(ctx) free(ctx);
+  extract_job_finish(&job);
+  if(ctx && ctx->crypto_pool) pool_destroy(ctx->crypto_pool);
+  if(job.manifest && job.manifest != stdout) fclose(job.manifest);
+  if(job.tar && job.tar != stdout) fclose(job.tar);
+  if(stream != stdout && stream != job.manifest && stream != job.tar) fclose(stream);
+  filter_free(job.filter);
+  ps3hdd_close(disk);
 	
 	return 0;
 }
@@ -0,0 +1,300 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+typedef struct _pool_worker_arg_ {
+	thread_pool *pool;
+	s32 id;
+} pool_worker_arg;
+
+
+
+/***********************************************************************
+* Push a task to the owner end of a deque, grow the ring if full.
+*
+* pool_deque *q  = deque
+* pool_task *t   = task to push
+***********************************************************************/
+static void deque_push(pool_deque *q, pool_task *t)
+{
+	u32 i, n;
+	pool_task *task;
+
+	EnterCriticalSection(&q->lock);
+
+	n = q->tail - q->head;
+	if(n == q->cap) {
+		task = malloc(q->cap * 2 * sizeof(*task));
+		for(i = 0; i < n; i++)
+			task[i] = q->task[(q->head + i) & (q->cap - 1)];
+		free(q->task);
+		q->task = task;
+		q->head = 0;
+		q->tail = n;
+		q->cap *= 2;
+	}
+	q->task[q->tail & (q->cap - 1)] = *t;
+	q->tail++;
+
+	LeaveCriticalSection(&q->lock);
+}
+
+/***********************************************************************
+* Pop the newest task from the owner end of a deque.
+*
+* pool_deque *q  = deque
+* pool_task *t   = receives the task
+*
+* return: 1 if a task was taken, 0 if empty
+***********************************************************************/
+static s32 deque_pop(pool_deque *q, pool_task *t)
+{
+	s32 ret = 0;
+
+	EnterCriticalSection(&q->lock);
+	if(q->tail != q->head) {
+		q->tail--;
+		*t = q->task[q->tail & (q->cap - 1)];
+		ret = 1;
+	}
+	LeaveCriticalSection(&q->lock);
+
+	return ret;
+}
+
+/***********************************************************************
+* Steal the oldest task from the other end of a deque.
+*
+* pool_deque *q  = deque of another worker
+* pool_task *t   = receives the task
+*
+* return: 1 if a task was taken, 0 if empty
+***********************************************************************/
+static s32 deque_steal(pool_deque *q, pool_task *t)
+{
+	s32 ret = 0;
+
+	EnterCriticalSection(&q->lock);
+	if(q->tail != q->head) {
+		*t = q->task[q->head & (q->cap - 1)];
+		q->head++;
+		ret = 1;
+	}
+	LeaveCriticalSection(&q->lock);
+
+	return ret;
+}
+
+/***********************************************************************
+* Take a task for a worker, own deque first, then steal round robin.
+*
+* thread_pool *pool = pool
+* s32 id            = worker id
+* pool_task *t      = receives the task
+***********************************************************************/
+static s32 pool_take(thread_pool *pool, s32 id, pool_task *t)
+{
+	s32 i;
+
+	if(deque_pop(&pool->q[id], t))
+		goto taken;
+
+	for(i = 1; i < pool->n_workers; i++)
+		if(deque_steal(&pool->q[(id + i) % pool->n_workers], t))
+			goto taken;
+
+	return 0;
+
+taken:
+	EnterCriticalSection(&pool->lock);
+	pool->queued--;
+	LeaveCriticalSection(&pool->lock);
+	return 1;
+}
+
+/***********************************************************************
+* Worker thread, runs tasks until the pool is stopped and drained.
+***********************************************************************/
+static DWORD WINAPI pool_worker(LPVOID param)
+{
+	pool_worker_arg *a = param;
+	thread_pool *pool = a->pool;
+	s32 id = a->id;
+	pool_task t;
+
+	free(a);
+
+	for(;;) {
+		if(pool_take(pool, id, &t)) {
+			t.func(t.arg, id);
+
+			EnterCriticalSection(&pool->lock);
+			if(--pool->pending == 0)
+				WakeAllConditionVariable(&pool->idle);
+			LeaveCriticalSection(&pool->lock);
+			continue;
+		}
+
+		EnterCriticalSection(&pool->lock);
+		while(!pool->stop && pool->queued == 0)
+			SleepConditionVariableCS(&pool->work, &pool->lock, INFINITE);
+		if(pool->stop && pool->queued == 0) {
+			LeaveCriticalSection(&pool->lock);
+			break;
+		}
+		LeaveCriticalSection(&pool->lock);
+	}
+
+	return 0;
+}
+
+/***********************************************************************
+* Get the number of logical processors.
+***********************************************************************/
+s32 pool_cpu_count(void)
+{
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	if(si.dwNumberOfProcessors < 1)
+		return 1;
+
+	return si.dwNumberOfProcessors;
+}
+
+/***********************************************************************
+* Create a work stealing thread pool.
+*
+* s32 n_workers = worker thread count
+*
+* return: pool or NULL
+***********************************************************************/
+thread_pool* pool_create(s32 n_workers)
+{
+	s32 i;
+	thread_pool *pool;
+	pool_worker_arg *a;
+
+	if(n_workers < 1)
+		n_workers = 1;
+	if(n_workers > POOL_MAX_WORKERS)
+		n_workers = POOL_MAX_WORKERS;
+
+	pool = malloc(sizeof(*pool));
+	memset(pool, 0, sizeof(*pool));
+	pool->n_workers = n_workers;
+	pool->threads = malloc(n_workers * sizeof(*pool->threads));
+	pool->q = malloc(n_workers * sizeof(*pool->q));
+
+	InitializeCriticalSection(&pool->lock);
+	InitializeConditionVariable(&pool->work);
+	InitializeConditionVariable(&pool->idle);
+
+	for(i = 0; i < n_workers; i++) {
+		InitializeCriticalSection(&pool->q[i].lock);
+		pool->q[i].cap = 64;
+		pool->q[i].head = pool->q[i].tail = 0;
+		pool->q[i].task = malloc(pool->q[i].cap * sizeof(pool_task));
+	}
+
+	for(i = 0; i < n_workers; i++) {
+		a = malloc(sizeof(*a));
+		a->pool = pool;
+		a->id = i;
+		pool->threads[i] = CreateThread(NULL, 0, pool_worker, a, 0, NULL);
+		if(pool->threads[i] == NULL) {
+			printf("can't create worker thread!\n");
+			free(a);
+			break;
+		}
+		pool->n_threads++;
+	}
+
+	// deques without a thread are drained by stealing
+	if(pool->n_threads == 0) {
+		pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+/***********************************************************************
+* Queue a task, the deques are filled round robin.
+*
+* thread_pool *pool = pool
+* pool_func func    = task function
+* void *arg         = task argument
+***********************************************************************/
+void pool_submit(thread_pool *pool, pool_func func, void *arg)
+{
+	pool_task t;
+	u32 slot;
+
+	t.func = func;
+	t.arg  = arg;
+
+	// counted before the push, a worker taking it at once must not drive queued below 0
+	EnterCriticalSection(&pool->lock);
+	slot = pool->next++ % pool->n_workers;
+	pool->pending++;
+	pool->queued++;
+	LeaveCriticalSection(&pool->lock);
+
+	deque_push(&pool->q[slot], &t);
+
+	EnterCriticalSection(&pool->lock);
+	WakeConditionVariable(&pool->work);
+	LeaveCriticalSection(&pool->lock);
+}
+
+/***********************************************************************
+* Wait until all queued tasks are done.
+*
+* thread_pool *pool = pool
+***********************************************************************/
+void pool_wait(thread_pool *pool)
+{
+	EnterCriticalSection(&pool->lock);
+	while(pool->pending > 0)
+		SleepConditionVariableCS(&pool->idle, &pool->lock, INFINITE);
+	LeaveCriticalSection(&pool->lock);
+}
+
+/***********************************************************************
+* Drain and stop all workers, free the pool.
+*
+* thread_pool *pool = pool
+***********************************************************************/
+void pool_destroy(thread_pool *pool)
+{
+	s32 i;
+
+	EnterCriticalSection(&pool->lock);
+	pool->stop = 1;
+	WakeAllConditionVariable(&pool->work);
+	LeaveCriticalSection(&pool->lock);
+
+	if(pool->n_threads > 0)
+		WaitForMultipleObjects(pool->n_threads, pool->threads, TRUE, INFINITE);
+
+	for(i = 0; i < pool->n_threads; i++)
+		CloseHandle(pool->threads[i]);
+
+	for(i = 0; i < pool->n_workers; i++) {
+		DeleteCriticalSection(&pool->q[i].lock);
+		free(pool->q[i].task);
+	}
+
+	DeleteCriticalSection(&pool->lock);
+	free(pool->q);
+	free(pool->threads);
+	free(pool);
+}
@@ -0,0 +1,48 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include "types.h"
+
+#define POOL_MAX_WORKERS 64   // WaitForMultipleObjects limit
+
+typedef void (*pool_func)(void *arg, s32 worker);
+
+typedef struct _pool_task_ {
+	pool_func func;             // task function
+	void *arg;                  // task argument
+} pool_task;
+
+typedef struct _pool_deque_ {
+	CRITICAL_SECTION lock;
+	pool_task *task;            // ring buffer
+	u32 cap;                    // ring buffer size, power of 2
+	u32 head;                   // steal end (oldest task)
+	u32 tail;                   // owner end (newest task)
+} pool_deque;
+
+typedef struct _thread_pool_ {
+	s32 n_workers;              // worker count, one deque each
+	s32 n_threads;              // worker threads actually started
+	HANDLE *threads;            // worker threads
+	pool_deque *q;              // one deque per worker
+	CRITICAL_SECTION lock;      // guards the counters below
+	CONDITION_VARIABLE work;    // signalled when a task is queued
+	CONDITION_VARIABLE idle;    // signalled when pending drops to 0
+	s64 queued;                 // tasks sitting in a deque
+	s64 pending;                // tasks queued or running
+	u32 next;                   // round robin deque for submit
+	s32 stop;                   // workers exit when set and queue empty
+} thread_pool;
+
+s32 pool_cpu_count(void);
+thread_pool* pool_create(s32 n_workers);
+void pool_submit(thread_pool *pool, pool_func func, void *arg);
+void pool_wait(thread_pool *pool);
+void pool_destroy(thread_pool *pool);
+
+#endif  // _POOL_H_
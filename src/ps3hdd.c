@@ -0,0 +1,446 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ps3hdd.h"
+#include "ps3hdd_int.h"
+#include "types.h"
+#include "kgen.h"
+#include "device.h"
+#include "extract.h"
+#include "fs/vfs.h"
+
+struct _ps3hdd_disk_ {
+	ps3hdd_allocator a;       // allocator of all handles
+	ps3_context *ctx;         // ps3 device information
+};
+
+struct _ps3hdd_volume_ {
+	ps3hdd_disk *disk;        // hdd of the volume
+	vfs_volume *vfs;          // volume
+};
+
+struct _ps3hdd_dir_ {
+	ps3hdd_volume *vol;       // volume of the folder
+	s32 pos;                  // next entry
+	s32 count;                // entry count
+	vfs_node *nodes;          // entries
+};
+
+struct _ps3hdd_file_ {
+	ps3hdd_volume *vol;       // volume of the file
+	extract_file *map;        // data on hdd
+	ps3hdd_attr attr;         // attributes
+};
+
+
+
+
+/***********************************************************************
+* Default allocator, malloc.
+***********************************************************************/
+static void* ps3hdd_malloc(size_t size, void *user)
+{
+	return malloc(size);
+}
+
+/***********************************************************************
+* Default allocator, free.
+***********************************************************************/
+static void ps3hdd_free(void *ptr, void *user)
+{
+	free(ptr);
+}
+
+/***********************************************************************
+* Allocate a zeroed handle with the allocator of a disk.
+*
+* ps3hdd_disk *disk = disk
+* size_t size       = byte count
+***********************************************************************/
+static void* ps3hdd_alloc(ps3hdd_disk *disk, size_t size)
+{
+	void *p = disk->a.alloc(size, disk->a.user);
+
+	if(p)
+		memset(p, 0, size);
+
+	return p;
+}
+
+/***********************************************************************
+* Fill attributes from a node.
+*
+* ps3hdd_attr *attr = attributes
+* vfs_node *node    = node
+***********************************************************************/
+static void ps3hdd_attr_node(ps3hdd_attr *attr, vfs_node *node)
+{
+	attr->type  = node->type;
+	attr->mode  = node->mode;
+	attr->size  = node->size;
+	attr->id    = node->id;
+	attr->atime = node->atime;
+	attr->mtime = node->mtime;
+	attr->ctime = node->ctime;
+}
+
+/***********************************************************************
+* Look up a path on a volume.
+*
+* ps3hdd_volume *vol = volume
+* const char *path   = path from the volume root
+* int follow         = follow a symlink at the end
+* vfs_node *node     = receives the node
+***********************************************************************/
+static s32 ps3hdd_lookup(ps3hdd_volume *vol, const char *path, int follow, vfs_node *node)
+{
+	if(path == NULL || path[0] != '/' || strlen(path) >= MAX_PATH)
+		return PS3HDD_EINVAL;
+
+	if(vfs_lookup(vol->vfs, path, follow, node))
+		return PS3HDD_ENOENT;
+
+	return PS3HDD_OK;
+}
+
+/***********************************************************************
+* Open a ps3 hdd or image. Handles of different disks can be used from
+* different threads at the same time, a volume can be shared by threads.
+*
+* const char *name           = image file or drive, NULL finds the hdd
+* const unsigned char *key   = eid root key and iv, PS3HDD_KEY_SIZE bytes
+* const ps3hdd_allocator *a  = allocator of all handles, NULL for malloc
+* ps3hdd_disk **disk         = receives the disk
+***********************************************************************/
+int ps3hdd_open(const char *name, const unsigned char *key, const ps3hdd_allocator *a, ps3hdd_disk **disk)
+{
+	ps3hdd_allocator def = {ps3hdd_malloc, ps3hdd_free, NULL};
+	u8 eid_root_key[PS3HDD_KEY_SIZE];
+	ps3hdd_disk *d;
+	s32 ret;
+
+	if(key == NULL || disk == NULL)
+		return PS3HDD_EINVAL;
+	if(a == NULL)
+		a = &def;
+
+	if((d = a->alloc(sizeof(*d), a->user)) == NULL)
+		return PS3HDD_ENOMEM;
+	d->a = *a;
+	if((d->ctx = ps3hdd_alloc(d, sizeof(*d->ctx))) == NULL) {
+		a->free(d, a->user);
+		return PS3HDD_ENOMEM;
+	}
+
+	memcpy(eid_root_key, key, PS3HDD_KEY_SIZE);
+	generate_ata_keys(eid_root_key, eid_root_key + 0x20, d->ctx->ata_k1, d->ctx->ata_k2);
+	generate_encdec_keys(eid_root_key, eid_root_key + 0x20, d->ctx->encdec_k1, d->ctx->encdec_k2);
+
+	if(name == NULL)
+		ret = get_device_handle(d->ctx, 1);
+	else {
+		InitializeCriticalSection(&d->ctx->io_lock);
+		InitializeCriticalSection(&d->ctx->fat_lock);
+		ret = open_device(d->ctx, name);
+	}
+
+	if(ret) {
+		close_device(d->ctx);
+		a->free(d->ctx, a->user);
+		a->free(d, a->user);
+		return PS3HDD_ENODEV;
+	}
+
+	get_partitions(d->ctx);
+
+	*disk = d;
+	return PS3HDD_OK;
+}
+
+/***********************************************************************
+* Close a disk, its volumes must be closed first.
+*
+* ps3hdd_disk *disk = disk
+***********************************************************************/
+void ps3hdd_close(ps3hdd_disk *disk)
+{
+	if(disk == NULL)
+		return;
+
+	close_device(disk->ctx);
+	disk->a.free(disk->ctx, disk->a.user);
+	disk->a.free(disk, disk->a.user);
+}
+
+/***********************************************************************
+* Name of a volume the disk has.
+*
+* ps3hdd_disk *disk = disk
+* int index         = 0 for the first volume
+*
+* return: volume name, NULL after the last
+***********************************************************************/
+const char* ps3hdd_volume_name(ps3hdd_disk *disk, int index)
+{
+	return vfs_name(disk->ctx, index);
+}
+
+/***********************************************************************
+* Open a volume.
+*
+* ps3hdd_disk *disk   = disk
+* const char *name    = "dev_hdd0", "dev_hdd1", "dev_flash", ...
+* ps3hdd_volume **vol = receives the volume
+***********************************************************************/
+int ps3hdd_volume_open(ps3hdd_disk *disk, const char *name, ps3hdd_volume **vol)
+{
+	ps3hdd_volume *v;
+	const char *n;
+	s32 i, err;
+
+	for(i = 0; (n = vfs_name(disk->ctx, i)) != NULL; i++)
+		if(strcmp(name, n) == 0)
+			break;
+	if(n == NULL)
+		return PS3HDD_ENOVOL;
+
+	if((v = ps3hdd_alloc(disk, sizeof(*v))) == NULL)
+		return PS3HDD_ENOMEM;
+	v->disk = disk;
+
+	if((v->vfs = vfs_open(disk->ctx, name, &err)) == NULL) {
+		disk->a.free(v, disk->a.user);
+		return err;
+	}
+
+	*vol = v;
+	return PS3HDD_OK;
+}
+
+/***********************************************************************
+* Close a volume, its folders and files must be closed first.
+*
+* ps3hdd_volume *vol = volume
+***********************************************************************/
+void ps3hdd_volume_close(ps3hdd_volume *vol)
+{
+	if(vol == NULL)
+		return;
+
+	vfs_close(vol->vfs);
+	vol->disk->a.free(vol, vol->disk->a.user);
+}
+
+/***********************************************************************
+* Get the attributes of a file or folder.
+*
+* ps3hdd_volume *vol = volume
+* const char *path   = path from the volume root
+* int follow         = follow a symlink at the end
+* ps3hdd_attr *attr  = receives the attributes
+***********************************************************************/
+int ps3hdd_stat(ps3hdd_volume *vol, const char *path, int follow, ps3hdd_attr *attr)
+{
+	vfs_node node;
+	s32 ret;
+
+	if((ret = ps3hdd_lookup(vol, path, follow, &node)) == PS3HDD_OK)
+		ps3hdd_attr_node(attr, &node);
+
+	return ret;
+}
+
+/***********************************************************************
+* Open a folder to read its entries.
+*
+* ps3hdd_volume *vol = volume
+* const char *path   = path from the volume root
+* ps3hdd_dir **dir   = receives the folder
+***********************************************************************/
+int ps3hdd_opendir(ps3hdd_volume *vol, const char *path, ps3hdd_dir **dir)
+{
+	vfs_node node;
+	ps3hdd_dir *d;
+	s32 ret;
+
+	if((ret = ps3hdd_lookup(vol, path, 1, &node)) != PS3HDD_OK)
+		return ret;
+	if(node.type != VFS_DIR)
+		return PS3HDD_ENOTDIR;
+
+	if((d = ps3hdd_alloc(vol->disk, sizeof(*d))) == NULL)
+		return PS3HDD_ENOMEM;
+	d->vol = vol;
+
+	if((d->count = vfs_readdir(vol->vfs, &node, &d->nodes)) < 0) {
+		vol->disk->a.free(d, vol->disk->a.user);
+		return PS3HDD_ENOTDIR;
+	}
+
+	*dir = d;
+	return PS3HDD_OK;
+}
+
+/***********************************************************************
+* Read the next entry of a folder, "." and ".." are left out.
+*
+* ps3hdd_dir *dir     = folder
+* ps3hdd_dirent *ent  = receives the entry
+*
+* return: 1 for an entry, 0 at the end
+***********************************************************************/
+int ps3hdd_readdir(ps3hdd_dir *dir, ps3hdd_dirent *ent)
+{
+	if(dir->pos >= dir->count)
+		return 0;
+
+	memset(ent, 0, sizeof(*ent));
+	strncpy(ent->name, dir->nodes[dir->pos].name, PS3HDD_NAME_MAX - 1);
+	ps3hdd_attr_node(&ent->attr, &dir->nodes[dir->pos]);
+
+	dir->pos++;
+	return 1;
+}
+
+/***********************************************************************
+* Close a folder.
+*
+* ps3hdd_dir *dir = folder
+***********************************************************************/
+void ps3hdd_closedir(ps3hdd_dir *dir)
+{
+	if(dir == NULL)
+		return;
+
+	free(dir->nodes);
+	dir->vol->disk->a.free(dir, dir->vol->disk->a.user);
+}
+
+/***********************************************************************
+* Open a file to read it, symlinks are followed.
+*
+* ps3hdd_volume *vol = volume
+* const char *path   = path from the volume root
+* ps3hdd_file **file = receives the file
+***********************************************************************/
+int ps3hdd_fopen(ps3hdd_volume *vol, const char *path, ps3hdd_file **file)
+{
+	vfs_node node;
+	ps3hdd_file *f;
+	s32 ret;
+
+	if((ret = ps3hdd_lookup(vol, path, 1, &node)) != PS3HDD_OK)
+		return ret;
+	if(node.type == VFS_DIR)
+		return PS3HDD_EISDIR;
+
+	if((f = ps3hdd_alloc(vol->disk, sizeof(*f))) == NULL)
+		return PS3HDD_ENOMEM;
+	f->vol = vol;
+	ps3hdd_attr_node(&f->attr, &node);
+	if((f->map = vfs_extents(vol->vfs, &node, path)) == NULL) {
+		vol->disk->a.free(f, vol->disk->a.user);
+		return PS3HDD_ENOMEM;
+	}
+
+	*file = f;
+	return PS3HDD_OK;
+}
+
+/***********************************************************************
+* Read from a file at an offset, holes read as zeros. Threads may read
+* the same file at once.
+*
+* ps3hdd_file *file  = file
+* void *buf          = receives the data
+* size_t len         = byte count
+* unsigned long long offset = byte offset in the file
+*
+* return: bytes read, 0 at the end of the file
+***********************************************************************/
+long long ps3hdd_pread(ps3hdd_file *file, void *buf, size_t len, unsigned long long offset)
+{
+	if(buf == NULL)
+		return PS3HDD_EINVAL;
+
+	return vfs_pread(file->vol->vfs, file->map, buf, offset, len);
+}
+
+/***********************************************************************
+* Get the attributes of an open file.
+*
+* ps3hdd_file *file = file
+* ps3hdd_attr *attr = receives the attributes
+***********************************************************************/
+int ps3hdd_fstat(ps3hdd_file *file, ps3hdd_attr *attr)
+{
+	*attr = file->attr;
+	return PS3HDD_OK;
+}
+
+/***********************************************************************
+* Close a file.
+*
+* ps3hdd_file *file = file
+***********************************************************************/
+void ps3hdd_fclose(ps3hdd_file *file)
+{
+	if(file == NULL)
+		return;
+
+	extract_file_free(file->map);
+	file->vol->disk->a.free(file, file->vol->disk->a.user);
+}
+
+/***********************************************************************
+* Device information of a disk, for the command line tool.
+*
+* ps3hdd_disk *disk = disk
+***********************************************************************/
+ps3_context* ps3hdd_context(ps3hdd_disk *disk)
+{
+	return disk->ctx;
+}
+
+/***********************************************************************
+* Volume of the filesystem layer, for the command line tool.
+*
+* ps3hdd_volume *vol = volume
+***********************************************************************/
+vfs_volume* ps3hdd_vfs(ps3hdd_volume *vol)
+{
+	return vol->vfs;
+}
+
+/***********************************************************************
+* Text of an error code.
+*
+* int err = error code
+***********************************************************************/
+const char* ps3hdd_strerror(int err)
+{
+	switch(err) {
+		case PS3HDD_OK:      return "no error";
+		case PS3HDD_ENOMEM:  return "out of memory";
+		case PS3HDD_ENODEV:  return "no PS3 hdd found or eid root key wrong";
+		case PS3HDD_ENOVOL:  return "no such volume";
+		case PS3HDD_ENOENT:  return "no such file or directory";
+		case PS3HDD_ENOTDIR: return "not a directory";
+		case PS3HDD_EISDIR:  return "is a directory";
+		case PS3HDD_EINVAL:  return "bad argument";
+		case PS3HDD_EIO:     return "volume not readable";
+		case PS3HDD_ELOOP:   return "recursive symlink loop";
+		case PS3HDD_EPATH:   return "path too long";
+		case PS3HDD_ELOCAL:  return "local file can't be opened or created";
+		case PS3HDD_ESIZE:   return "file size wrong";
+		case PS3HDD_EHOLE:   return "data in a hole of the file";
+		case PS3HDD_EINTR:   return "stopped";
+		default:             return "unknown error";
+	}
+}
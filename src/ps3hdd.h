@@ -0,0 +1,79 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#ifndef _PS3HDD_H_
+#define _PS3HDD_H_
+
+#include <stddef.h>
+#include <time.h>
+
+#define PS3HDD_KEY_SIZE  0x30       // eid root key and iv
+#define PS3HDD_NAME_MAX  256        // longest entry name with the 0
+
+// error codes, all calls return 0 or one of these
+#define PS3HDD_OK         0
+#define PS3HDD_ENOMEM    -1         // allocation failed
+#define PS3HDD_ENODEV    -2         // no ps3 hdd found or eid root key wrong
+#define PS3HDD_ENOVOL    -3         // no such volume on this hdd
+#define PS3HDD_ENOENT    -4         // no such file or directory
+#define PS3HDD_ENOTDIR   -5         // not a directory
+#define PS3HDD_EISDIR    -6         // is a directory
+#define PS3HDD_EINVAL    -7         // bad argument
+#define PS3HDD_EIO       -8         // superblock or bootsector not readable
+#define PS3HDD_ELOOP     -9         // recursive symlink loop
+#define PS3HDD_EPATH     -10        // path too long
+#define PS3HDD_ELOCAL    -11        // local file or folder can't be opened or made
+#define PS3HDD_ESIZE     -12        // local file and entry differ in size
+#define PS3HDD_EHOLE     -13        // data where the entry has a hole
+#define PS3HDD_EINTR     -14        // stopped by Ctrl+C
+
+// entry types
+#define PS3HDD_FILE       0
+#define PS3HDD_DIR        1
+#define PS3HDD_LINK       2
+#define PS3HDD_OTHER      3
+
+typedef struct _ps3hdd_disk_   ps3hdd_disk;
+typedef struct _ps3hdd_volume_ ps3hdd_volume;
+typedef struct _ps3hdd_dir_    ps3hdd_dir;
+typedef struct _ps3hdd_file_   ps3hdd_file;
+
+typedef struct _ps3hdd_allocator_ {
+	void* (*alloc)(size_t size, void *user);  // like malloc
+	void (*free)(void *ptr, void *user);      // like free
+	void *user;                               // passed to both
+} ps3hdd_allocator;
+
+typedef struct _ps3hdd_attr_ {
+	int type;                   // PS3HDD_FILE, PS3HDD_DIR, ...
+	unsigned int mode;          // permission bits
+	unsigned long long size;    // byte count
+	unsigned long long id;      // inode, or start cluster on FAT
+	time_t atime;               // last access time
+	time_t mtime;               // last modified time
+	time_t ctime;               // last change time, creation time on FAT
+} ps3hdd_attr;
+
+typedef struct _ps3hdd_dirent_ {
+	char name[PS3HDD_NAME_MAX]; // entry name
+	ps3hdd_attr attr;           // entry attributes
+} ps3hdd_dirent;
+
+int ps3hdd_open(const char *name, const unsigned char *key, const ps3hdd_allocator *a, ps3hdd_disk **disk);
+void ps3hdd_close(ps3hdd_disk *disk);
+const char* ps3hdd_volume_name(ps3hdd_disk *disk, int index);
+int ps3hdd_volume_open(ps3hdd_disk *disk, const char *name, ps3hdd_volume **vol);
+void ps3hdd_volume_close(ps3hdd_volume *vol);
+int ps3hdd_stat(ps3hdd_volume *vol, const char *path, int follow, ps3hdd_attr *attr);
+int ps3hdd_opendir(ps3hdd_volume *vol, const char *path, ps3hdd_dir **dir);
+int ps3hdd_readdir(ps3hdd_dir *dir, ps3hdd_dirent *ent);
+void ps3hdd_closedir(ps3hdd_dir *dir);
+int ps3hdd_fopen(ps3hdd_volume *vol, const char *path, ps3hdd_file **file);
+long long ps3hdd_pread(ps3hdd_file *file, void *buf, size_t len, unsigned long long offset);
+int ps3hdd_fstat(ps3hdd_file *file, ps3hdd_attr *attr);
+void ps3hdd_fclose(ps3hdd_file *file);
+const char* ps3hdd_strerror(int err);
+
+#endif  // _PS3HDD_H_
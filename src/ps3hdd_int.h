@@ -0,0 +1,19 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#ifndef _PS3HDD_INT_H_
+#define _PS3HDD_INT_H_
+
+#include "ps3hdd.h"
+#include "types.h"
+#include "fs/vfs.h"
+
+// the command line tool opens disks and volumes with the library, the commands
+// the library has no call for (copy, replace, inventory, ...) work on these
+
+ps3_context* ps3hdd_context(ps3hdd_disk *disk);
+vfs_volume* ps3hdd_vfs(ps3hdd_volume *vol);
+
+#endif  // _PS3HDD_INT_H_
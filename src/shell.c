@@ -0,0 +1,361 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shell.h"
+#include "ps3hdd_int.h"
+
+
+
+/***********************************************************************
+* Get a volume, it is opened on first use and kept for the session.
+*
+* shell_session *s = session
+* const char *name = volume name
+***********************************************************************/
+static ps3hdd_volume* shell_open(shell_session *s, const char *name)
+{
+	ps3hdd_volume *vol;
+	s32 i, err;
+
+	for(i = 0; i < VFS_COUNT; i++)
+		if(s->vol[i] && strcmp(ps3hdd_vfs(s->vol[i])->name, name) == 0)
+			return s->vol[i];
+
+	if((err = ps3hdd_volume_open(s->disk, name, &vol)) != PS3HDD_OK) {
+		printf("can't open %s, %s!\n", name, ps3hdd_strerror(err));
+		return NULL;
+	}
+	if(s->index_file)
+		vfs_index(ps3hdd_vfs(vol), s->index_file, s->job->threads);
+
+	for(i = 0; i < VFS_COUNT; i++) {
+		if(s->vol[i] == NULL) {
+			s->vol[i] = vol;
+			break;
+		}
+	}
+
+	return vol;
+}
+
+/***********************************************************************
+* Make the full path of a command argument. "/dev_xxx/..." names the
+* volume, "/..." is taken from the volume root and anything else from
+* the current folder. "." and ".." are resolved.
+*
+* shell_session *s = session
+* const char *arg  = path as typed
+* char *volume     = receives the volume name, 16 bytes
+* char *path       = receives the path on the volume, MAX_PATH bytes
+***********************************************************************/
+static s32 shell_path(shell_session *s, const char *arg, char *volume, char *path)
+{
+	char tmp[MAX_PATH * 2];
+	char *part, *next, *end;
+	size_t n;
+
+	strcpy(volume, s->volume);
+	tmp[0] = '\0';
+
+	if(strncmp(arg, "/dev_", 5) == 0 || strncmp(arg, "dev_", 4) == 0) {
+		if(*arg == '/')
+			arg++;
+		n = strcspn(arg, "/");
+		if(n >= 16) {
+			printf("no such volume!\n");
+			return -1;
+		}
+		memcpy(volume, arg, n);
+		volume[n] = '\0';
+		arg += n;
+	}
+	else if(*arg != '/')
+		strcpy(tmp, s->cwd);
+
+	if(volume[0] == '\0') {
+		printf("no volume, cd to one first!\n");
+		return -1;
+	}
+
+	if(strlen(tmp) + strlen(arg) + 2 > sizeof(tmp)) {
+		printf("path too long!\n");
+		return -1;
+	}
+	strcat(tmp, "/");
+	strcat(tmp, arg);
+
+	// rebuild the path part by part
+	path[0] = '\0';
+	for(part = tmp; part; part = next) {
+		if((next = strchr(part, '/')) != NULL)
+			*next++ = '\0';
+		if(part[0] == '\0' || strcmp(part, ".") == 0)
+			continue;
+		if(strcmp(part, "..") == 0) {
+			if((end = strrchr(path, '/')) != NULL)
+				*end = '\0';
+			continue;
+		}
+		if(strlen(path) + strlen(part) + 2 > MAX_PATH) {
+			printf("path too long!\n");
+			return -1;
+		}
+		strcat(path, "/");
+		strcat(path, part);
+	}
+
+	if(path[0] == '\0')
+		strcpy(path, "/");
+
+	return 0;
+}
+
+/***********************************************************************
+* Split a command line into words, double quotes keep spaces.
+*
+* char *line   = command line, changed
+* char *argv[] = receives up to SHELL_ARGS words
+***********************************************************************/
+static s32 shell_split(char *line, char *argv[])
+{
+	s32 argc = 0;
+	char *out;
+
+	for(;;) {
+		while(*line == ' ' || *line == '\t' || *line == '\r' || *line == '\n')
+			line++;
+		if(*line == '\0' || *line == '#' || argc == SHELL_ARGS)
+			break;
+
+		argv[argc++] = out = line;
+		while(*line && *line != ' ' && *line != '\t' && *line != '\r' && *line != '\n') {
+			if(*line == '"') {
+				for(line++; *line && *line != '"'; )
+					*out++ = *line++;
+				if(*line)
+					line++;
+			}
+			else
+				*out++ = *line++;
+		}
+		if(*line)
+			line++;
+		*out = '\0';
+	}
+
+	return argc;
+}
+
+/***********************************************************************
+* List the volumes of the device.
+*
+* shell_session *s = session
+***********************************************************************/
+static void shell_vol_list(shell_session *s)
+{
+	const char *name;
+	s32 i;
+
+	for(i = 0; (name = ps3hdd_volume_name(s->disk, i)) != NULL; i++)
+		printf(" %s\n", name);
+}
+
+/***********************************************************************
+* cd, change the current folder or volume.
+*
+* shell_session *s = session
+* const char *arg  = new folder
+***********************************************************************/
+static s32 shell_cd(shell_session *s, const char *arg)
+{
+	char volume[16], path[MAX_PATH];
+	ps3hdd_volume *vol;
+	ps3hdd_attr attr;
+	s32 err;
+
+	if(shell_path(s, arg, volume, path) || (vol = shell_open(s, volume)) == NULL)
+		return -1;
+
+	if((err = ps3hdd_stat(vol, path, 1, &attr)) == PS3HDD_OK && attr.type != PS3HDD_DIR)
+		err = PS3HDD_ENOTDIR;
+	if(err) {
+		printf("%s!\n", ps3hdd_strerror(err));
+		return err;
+	}
+
+	strcpy(s->volume, volume);
+	strcpy(s->cwd, path);
+
+	return 0;
+}
+
+/***********************************************************************
+* ls, show a folder.
+*
+* shell_session *s = session
+* const char *arg  = folder
+***********************************************************************/
+static s32 shell_ls(shell_session *s, const char *arg)
+{
+	char volume[16], path[MAX_PATH];
+	ps3hdd_volume *vol;
+	s32 err;
+
+	if(shell_path(s, arg, volume, path) || (vol = shell_open(s, volume)) == NULL)
+		return -1;
+
+	if((err = vfs_list(ps3hdd_vfs(vol), path)) != 0)
+		printf("%s!\n", ps3hdd_strerror(err));
+
+	return err;
+}
+
+/***********************************************************************
+* cp, copy a file or folder. Each copy runs its own job with the
+* options from the command line and waits for it.
+*
+* shell_session *s = session
+* const char *arg  = file or folder
+* const char *dest = output name, or NULL for the current folder
+***********************************************************************/
+static s32 shell_cp(shell_session *s, const char *arg, const char *dest)
+{
+	char volume[16], path[MAX_PATH];
+	ps3hdd_volume *vol;
+	extract_job job;
+	s32 ret;
+
+	if(shell_path(s, arg, volume, path) || (vol = shell_open(s, volume)) == NULL)
+		return -1;
+
+	extract_job_init(&job, ps3hdd_context(s->disk));
+	job.threads   = s->job->threads;
+	job.lba_order = s->job->lba_order;
+	job.manifest  = s->job->manifest;
+	job.crc       = s->job->crc;
+	job.dedup     = s->job->dedup;
+	job.filter    = s->job->filter;
+
+	ret = vfs_copy(ps3hdd_vfs(vol), path, dest, &job);
+	extract_job_finish(&job);
+	if(ret)
+		printf("%s!\n", ps3hdd_strerror(ret));
+
+	return ret;
+}
+
+/***********************************************************************
+* stat, show the inode or entry of a file or folder.
+*
+* shell_session *s = session
+* const char *arg  = file or folder
+***********************************************************************/
+static s32 shell_stat(shell_session *s, const char *arg)
+{
+	char volume[16], path[MAX_PATH];
+	ps3hdd_volume *vol;
+	s32 err;
+
+	if(shell_path(s, arg, volume, path) || (vol = shell_open(s, volume)) == NULL)
+		return -1;
+
+	if((err = vfs_stat(ps3hdd_vfs(vol), path)) != 0)
+		printf("%s!\n", ps3hdd_strerror(err));
+
+	return err;
+}
+
+/***********************************************************************
+* Show the commands.
+***********************************************************************/
+static void shell_help(void)
+{
+	printf(" cd <path>           change folder, \"/dev_xxx\" changes the volume\n");
+	printf(" ls [path]           show a folder\n");
+	printf(" cp <path> [dest]    copy a file or folder\n");
+	printf(" stat <path>         show a file or folder\n");
+	printf(" pwd                 show the current folder\n");
+	printf(" vol                 list the volumes\n");
+	printf(" exit                end the session\n");
+}
+
+/***********************************************************************
+* Run commands until the input ends or exit. The device stays open and
+* each volume is set up on first use, so later commands only pay for
+* what they read.
+*
+* ps3hdd_disk *disk      = ps3 hdd or image
+* extract_job *job       = options of the command line
+* const char *index_file = metadata index of dev_hdd0, or NULL
+* FILE *in               = commands, stdin or a script
+* BOOL interactive       = show a prompt
+***********************************************************************/
+s32 shell_run(ps3hdd_disk *disk, extract_job *job, const char *index_file, FILE *in, BOOL interactive)
+{
+	s32 i, argc, ret = 0;
+	char line[SHELL_LINE];
+	char *argv[SHELL_ARGS];
+	shell_session s;
+
+	memset(&s, 0, sizeof(s));
+	s.disk = disk;
+	s.job = job;
+	s.index_file = index_file;
+	strcpy(s.cwd, "/");
+
+	// start on the first volume there is
+	if(ps3hdd_volume_name(disk, 0))
+		strcpy(s.volume, ps3hdd_volume_name(disk, 0));
+
+	// once for the session, Ctrl+C stops the copy running then
+	extract_trap_interrupt();
+
+	for(;;) {
+		if(interactive) {
+			printf("%s:%s> ", s.volume, s.cwd);
+			fflush(stdout);
+		}
+		if(fgets(line, sizeof(line), in) == NULL)
+			break;
+
+		if((argc = shell_split(line, argv)) == 0)
+			continue;
+
+		if(strcmp(argv[0], "exit") == 0 || strcmp(argv[0], "quit") == 0)
+			break;
+		else if(strcmp(argv[0], "help") == 0 || strcmp(argv[0], "?") == 0)
+			shell_help();
+		else if(strcmp(argv[0], "vol") == 0)
+			shell_vol_list(&s);
+		else if(strcmp(argv[0], "pwd") == 0)
+			printf("%s%s\n", s.volume, s.cwd);
+		else if(strcmp(argv[0], "cd") == 0)
+			ret = shell_cd(&s, argc > 1 ? argv[1] : "/");
+		else if(strcmp(argv[0], "ls") == 0 || strcmp(argv[0], "dir") == 0)
+			ret = shell_ls(&s, argc > 1 ? argv[1] : ".");
+		else if((strcmp(argv[0], "cp") == 0 || strcmp(argv[0], "copy") == 0) && argc > 1)
+			ret = shell_cp(&s, argv[1], argc > 2 ? argv[2] : NULL);
+		else if(strcmp(argv[0], "stat") == 0 && argc > 1)
+			ret = shell_stat(&s, argv[1]);
+		else {
+			printf("unknown command \"%s\", try help\n", argv[0]);
+			ret = -1;
+		}
+
+		// a script stops at the first failing command
+		if(ret && !interactive)
+			break;
+		ret = 0;
+	}
+
+	for(i = 0; i < VFS_COUNT; i++)
+		ps3hdd_volume_close(s.vol[i]);
+
+	return ret;
+}
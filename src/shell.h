@@ -0,0 +1,30 @@
+/*
+* Copyright (c) 2021 by 3141card
+* This file is released under the GPLv2.
+*/
+
+#ifndef _SHELL_H_
+#define _SHELL_H_
+
+#include <stdio.h>
+
+#include "types.h"
+#include "extract.h"
+#include "ps3hdd.h"
+#include "fs/vfs.h"
+
+#define SHELL_LINE   4096         // longest command line
+#define SHELL_ARGS   8            // words of a command
+
+typedef struct _shell_session_ {
+	ps3hdd_disk *disk;        // ps3 hdd or image
+	extract_job *job;         // options of the command line, used by each cp
+	const char *index_file;   // metadata index of dev_hdd0, or NULL
+	char volume[16];          // current volume, empty if none
+	char cwd[MAX_PATH];       // current folder on the volume
+	ps3hdd_volume *vol[VFS_COUNT]; // volumes, opened on first use
+} shell_session;
+
+s32 shell_run(ps3hdd_disk *disk, extract_job *job, const char *index_file, FILE *in, BOOL interactive);
+
+#endif  // _SHELL_H_
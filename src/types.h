@@ -29,6 +29,8 @@ typedef unsigned long long int u64;
 #define TRUE 1
 #define FALSE 0
 
+#include "aes_xts.h"
+
 
 //Endian swap for u16.
 #define _ES16(val) \
@@ -81,6 +83,17 @@ typedef struct {
   s64 flash3_start;     // vflash region 4(FAT12) start sector on HDD
   s64 flash3_size;      // vflash region 4(FAT12) sector count on HDD
   s64 flash3_free;      // vflash region 4(FAT12) start sector on HDD
+  CRITICAL_SECTION io_lock;  // serializes seek + read/write on dev
+  struct _fat_table_ *fat_tables;  // decoded FAT of each opened volume
+  CRITICAL_SECTION fat_lock; // guards fat_tables
+  aes_context cbc_dec;       // layer 1(ATA) decryption, aes-cbc-192
+  aes_xts_ctxt_t xts_dec;    // layer 1(ATA) decryption, aes-xts-128
+  aes_xts_ctxt_t xts_dec_vf; // layer 2(VFLASH) decryption
+  aes_context cbc_enc;       // layer 1(ATA) encryption, aes-cbc-192
+  aes_xts_ctxt_t xts_enc;    // layer 1(ATA) encryption, aes-xts-128
+  aes_xts_ctxt_t xts_enc_vf; // layer 2(VFLASH) encryption
+  u8 *flash_ram[3];          // decrypted dev_flash, dev_flash2, dev_flash3 in memory, or NULL
+  struct _thread_pool_ *crypto_pool; // decryption workers shared by several devices, or NULL
 } ps3_context;
 
 